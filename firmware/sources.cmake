@@ -0,0 +1,38 @@
+# The firmware's sources but main.cpp, shared by the application and the
+# test apps under tests/ that bring their own main()
+set(GETSMART_SRC ${CMAKE_CURRENT_LIST_DIR}/src)
+set(GETSMART_LIB ${CMAKE_CURRENT_LIST_DIR}/lib)
+
+add_compile_definitions(RADIOLIB_EXCLUDE_CC1101 RADIOLIB_EXCLUDE_SX126X RADIOLIB_EXCLUDE_RF69 RADIOLIB_EXCLUDE_RFM2X RADIOLIB_EXCLUDE_SX1233)
+add_compile_definitions(RADIOLIB_EXCLUDE_SX1231 RADIOLIB_EXCLUDE_SX128X RADIOLIB_EXCLUDE_SI443X RADIOLIB_EXCLUDE_NRF24)
+add_compile_definitions(RADIOLIB_EXCLUDE_FSK4)
+
+file(GLOB_RECURSE radiolib_sources
+  "${GETSMART_LIB}/radiolib/src/*.cpp"
+)
+
+file(GLOB_RECURSE radiolib_zephyr_sources
+  "${GETSMART_LIB}/radiolib/zephyr/src/*.cpp"
+)
+
+file(GLOB_RECURSE zephyr_radio_driver_sources
+  "${GETSMART_LIB}/radiolib/zephyr/src/drivers/radio/*.c"
+)
+
+target_include_directories(app PRIVATE ${GETSMART_SRC})
+target_sources(app PRIVATE ${GETSMART_SRC}/config_mgr.c ${GETSMART_SRC}/controller.c ${GETSMART_SRC}/mqtt_thread.c ${GETSMART_SRC}/mqtt_codec.c ${GETSMART_SRC}/mem_mgr.c ${GETSMART_SRC}/stats.c ${GETSMART_SRC}/thread_stats.c ${GETSMART_SRC}/latency.c ${GETSMART_SRC}/trace.c ${GETSMART_SRC}/lights.c ${GETSMART_SRC}/tx_sched.c ${GETSMART_SRC}/airtime.c)
+target_sources_ifdef(CONFIG_WIFI app PRIVATE ${GETSMART_SRC}/wifi.c)
+target_sources_ifdef(CONFIG_GETSMART_RADIO_RADIOLIB app PRIVATE ${GETSMART_SRC}/radio.cpp ${radiolib_sources} ${radiolib_zephyr_sources} ${zephyr_radio_driver_sources})
+target_sources_ifdef(CONFIG_GETSMART_RADIO_SX1278 app PRIVATE ${GETSMART_SRC}/radio_sx1278.c)
+target_sources_ifdef(CONFIG_GETSMART_RADIO_MOCK app PRIVATE ${GETSMART_SRC}/radio_mock.c)
+target_sources_ifdef(CONFIG_GETSMART_REMOTE_RX app PRIVATE ${GETSMART_SRC}/remote_rx.c)
+target_sources_ifdef(CONFIG_GETSMART_REHOME app PRIVATE ${GETSMART_SRC}/rehome.c)
+target_sources_ifdef(CONFIG_GETSMART_RADIO_POWER app PRIVATE ${GETSMART_SRC}/radio_power.c)
+target_sources_ifdef(CONFIG_GETSMART_SCENES app PRIVATE ${GETSMART_SRC}/scene.c)
+target_sources_ifdef(CONFIG_GETSMART_PACING_STATS app PRIVATE ${GETSMART_SRC}/pacing.c)
+target_sources_ifdef(CONFIG_GETSMART_NET_TELEMETRY app PRIVATE ${GETSMART_SRC}/net_telemetry.c)
+if(CONFIG_GETSMART_RADIO_MOCK OR CONFIG_GETSMART_REMOTE_RX)
+  target_sources(app PRIVATE ${GETSMART_SRC}/get_model.c)
+endif()
+target_sources_ifdef(CONFIG_GETSMART_BENCH app PRIVATE ${GETSMART_SRC}/bench.c)
+target_sources_ifdef(CONFIG_GETSMART_FAULT_INJECTION app PRIVATE ${GETSMART_SRC}/fault.c)
@@ -0,0 +1,34 @@
+#ifndef __GET_AFFINITY__
+#define __GET_AFFINITY__
+#include <zephyr/kernel.h>
+#include <zephyr/sys/util.h>
+
+/**
+ * With GETSMART_CPU_PINNING the threads that pace radio frames, the TX
+ * workers and the wall remote decoder, only run on GETSMART_RADIO_CPU.
+ * Every other thread, the network stack, MQTT, stats and the shell
+ * among them, is created pinned to CPU 0 (SCHED_CPU_MASK_PIN_ONLY), so
+ * nothing but an interrupt competes with a dim ramp for its core.
+ *
+ * A thread can only be pinned while it is not runnable: before it is
+ * started, or while it is blocked.
+ */
+#if defined(CONFIG_GETSMART_CPU_PINNING)
+BUILD_ASSERT(CONFIG_GETSMART_RADIO_CPU < CONFIG_MP_MAX_NUM_CPUS,
+             "GETSMART_RADIO_CPU is not a CPU of this SoC");
+#define AFFINITY_RADIO_CPU CONFIG_GETSMART_RADIO_CPU
+#else
+#define AFFINITY_RADIO_CPU -1
+#endif
+
+static inline int affinity_pin_radio(k_tid_t thread)
+{
+#if defined(CONFIG_GETSMART_CPU_PINNING)
+  return k_thread_cpu_pin(thread, CONFIG_GETSMART_RADIO_CPU);
+#else
+  (void)thread;
+  return 0;
+#endif
+}
+
+#endif /*__GET_AFFINITY__*/
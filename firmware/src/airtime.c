@@ -0,0 +1,270 @@
+#include "airtime.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "controller.h"
+#include "radio.h"
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define WINDOW_BUCKETS 60
+#define BUCKET_MS                                                              \
+  ((int64_t)CONFIG_GETSMART_AIRTIME_WINDOW_S * 1000 / WINDOW_BUCKETS)
+#define BUDGET_US                                                              \
+  ((uint64_t)CONFIG_GETSMART_AIRTIME_WINDOW_S * 1000U *                        \
+   CONFIG_GETSMART_AIRTIME_DUTY_PERMILLE)
+/* What low priority work may use, the rest is the reserve */
+#define LOW_BUDGET_US                                                          \
+  (BUDGET_US * (1000U - CONFIG_GETSMART_AIRTIME_RESERVE_PERMILLE) / 1000U)
+
+/* Hourly totals kept for the stats */
+#define HOURS 24
+#define HOUR_MS (3600 * 1000)
+
+BUILD_ASSERT(CONFIG_GETSMART_AIRTIME_WINDOW_S >= WINDOW_BUCKETS,
+             "Window too short for its buckets");
+
+static struct k_spinlock airtime_lock;
+/* Sliding window, bucket_us[epoch % WINDOW_BUCKETS] */
+static uint32_t bucket_us[WINDOW_BUCKETS];
+static int64_t bucket_epoch;
+static uint64_t window_us;
+static uint64_t hour_us[HOURS];
+static int64_t hour_epoch;
+static uint64_t radio_us[RADIO_COUNT];
+static uint64_t light_us[CHANNEL_COUNT];
+static int8_t radio_light[RADIO_COUNT] = {[0 ... RADIO_COUNT - 1] = -1};
+
+/* Drop the buckets that have left the window, call with airtime_lock held */
+static void advance(int64_t now)
+{
+  int64_t epoch = now / BUCKET_MS;
+  int64_t n = MIN(epoch - bucket_epoch, WINDOW_BUCKETS);
+
+  for (int64_t i = 1; i <= n; i++)
+  {
+    uint32_t *b = &bucket_us[(bucket_epoch + i) % WINDOW_BUCKETS];
+
+    window_us -= *b;
+    *b = 0;
+  }
+  bucket_epoch = MAX(bucket_epoch, epoch);
+
+  epoch = now / HOUR_MS;
+  n = MIN(epoch - hour_epoch, HOURS);
+  for (int64_t i = 1; i <= n; i++)
+  {
+    hour_us[(hour_epoch + i) % HOURS] = 0;
+  }
+  hour_epoch = MAX(hour_epoch, epoch);
+}
+
+void airtime_charge(uint8_t radio, uint32_t us)
+{
+  k_spinlock_key_t key = k_spin_lock(&airtime_lock);
+
+  advance(k_uptime_get());
+  bucket_us[bucket_epoch % WINDOW_BUCKETS] += us;
+  window_us += us;
+  hour_us[hour_epoch % HOURS] += us;
+  if (radio < RADIO_COUNT)
+  {
+    radio_us[radio] += us;
+    if (radio_light[radio] >= 0)
+    {
+      light_us[radio_light[radio]] += us;
+    }
+  }
+  k_spin_unlock(&airtime_lock, key);
+}
+
+void airtime_attribute(uint8_t radio, int light)
+{
+  if (radio < RADIO_COUNT)
+  {
+    radio_light[radio] = (light >= 0 && light < CHANNEL_COUNT) ? light : -1;
+  }
+}
+
+int32_t airtime_delay_ms(uint32_t us, bool low_priority)
+{
+  if (!IS_ENABLED(CONFIG_GETSMART_AIRTIME_LIMIT))
+  {
+    return 0;
+  }
+
+  uint64_t limit = low_priority ? LOW_BUDGET_US : BUDGET_US;
+  uint64_t need = MIN((uint64_t)us, limit);
+  int64_t now = k_uptime_get();
+  int64_t delay = 0;
+
+  k_spinlock_key_t key = k_spin_lock(&airtime_lock);
+  advance(now);
+
+  /* Let the oldest buckets drop out until it fits, a bucket leaves the
+   * window WINDOW_BUCKETS buckets after its own started */
+  uint64_t used = window_us;
+  for (int i = 1; used + need > limit && i <= WINDOW_BUCKETS; i++)
+  {
+    int64_t epoch = bucket_epoch - WINDOW_BUCKETS + i;
+
+    if (epoch < 0)
+    {
+      continue;
+    }
+    used -= bucket_us[epoch % WINDOW_BUCKETS];
+    delay = (epoch + WINDOW_BUCKETS) * BUCKET_MS - now;
+  }
+  k_spin_unlock(&airtime_lock, key);
+
+  return (int32_t)MAX(delay, 0);
+}
+
+bool airtime_tight(void)
+{
+  if (!IS_ENABLED(CONFIG_GETSMART_AIRTIME_LIMIT))
+  {
+    return false;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&airtime_lock);
+  advance(k_uptime_get());
+  bool tight = window_us >= LOW_BUDGET_US;
+  k_spin_unlock(&airtime_lock, key);
+  return tight;
+}
+
+/* Stats and shell work on a copy, the lock is a spinlock */
+struct airtime_snapshot {
+  uint64_t window_us;
+  uint64_t hour_us[HOURS];
+  uint64_t radio_us[RADIO_COUNT];
+  uint64_t light_us[CHANNEL_COUNT];
+};
+
+static void snapshot(struct airtime_snapshot *s)
+{
+  k_spinlock_key_t key = k_spin_lock(&airtime_lock);
+
+  advance(k_uptime_get());
+  s->window_us = window_us;
+  /* Most recent hour first */
+  for (int h = 0; h < HOURS; h++)
+  {
+    s->hour_us[h] = (hour_epoch >= h) ? hour_us[(hour_epoch - h) % HOURS] : 0;
+  }
+  memcpy(s->radio_us, radio_us, sizeof(radio_us));
+  memcpy(s->light_us, light_us, sizeof(light_us));
+  k_spin_unlock(&airtime_lock, key);
+}
+
+static int format_ms_array(char *buf, size_t len, const uint64_t *us,
+                           int count)
+{
+  int n = 0;
+
+  for (int i = 0; i < count && n < len; i++)
+  {
+    n += snprintf(buf + n, len - n, "%s%u", (i > 0) ? "," : "",
+                  (unsigned int)(us[i] / 1000U));
+  }
+  return n;
+}
+
+static int airtime_stats_format(char *buf, size_t len)
+{
+  struct airtime_snapshot s;
+  int n;
+
+  snapshot(&s);
+  n = snprintf(buf, len,
+               "\"window_s\":%d,\"budget_ms\":%u,\"used_ms\":%u,"
+               "\"tight\":%s,\"hours_ms\":[",
+               CONFIG_GETSMART_AIRTIME_WINDOW_S,
+               (unsigned int)(BUDGET_US / 1000U),
+               (unsigned int)(s.window_us / 1000U),
+               (s.window_us >= LOW_BUDGET_US) ? "true" : "false");
+  if (n < len)
+  {
+    n += format_ms_array(buf + n, len - n, s.hour_us, HOURS);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "],\"radios_ms\":[");
+  }
+  if (n < len)
+  {
+    n += format_ms_array(buf + n, len - n, s.radio_us, RADIO_COUNT);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "],\"lights_ms\":[");
+  }
+  if (n < len)
+  {
+    n += format_ms_array(buf + n, len - n, s.light_us, CHANNEL_COUNT);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "]");
+  }
+  return n;
+}
+
+static int cmd_airtime(const struct shell *sh, size_t argc, char **argv)
+{
+  struct airtime_snapshot s;
+
+  snapshot(&s);
+  shell_print(sh, "%u of %u ms in the last %d s (%u.%u%% duty)%s",
+              (unsigned int)(s.window_us / 1000U),
+              (unsigned int)(BUDGET_US / 1000U),
+              CONFIG_GETSMART_AIRTIME_WINDOW_S,
+              CONFIG_GETSMART_AIRTIME_DUTY_PERMILLE / 10,
+              CONFIG_GETSMART_AIRTIME_DUTY_PERMILLE % 10,
+              (s.window_us >= LOW_BUDGET_US) ? ", tight" : "");
+  for (int h = 0; h < HOURS; h++)
+  {
+    if (s.hour_us[h] != 0)
+    {
+      shell_print(sh, "  hour -%-2d %10u ms", h,
+                  (unsigned int)(s.hour_us[h] / 1000U));
+    }
+  }
+  for (int r = 0; r < RADIO_COUNT; r++)
+  {
+    shell_print(sh, "  radio %-3d %10u ms", r,
+                (unsigned int)(s.radio_us[r] / 1000U));
+  }
+  for (int ch = 0; ch < CHANNEL_COUNT; ch++)
+  {
+    if (s.light_us[ch] != 0)
+    {
+      shell_print(sh, "  light %-3d %10u ms", ch,
+                  (unsigned int)(s.light_us[ch] / 1000U));
+    }
+  }
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), airtime, NULL, "Time on air against the duty cycle",
+                 cmd_airtime, 1, 0);
+
+static struct stats_provider airtime_stats = {
+    .name = "airtime",
+    .format = airtime_stats_format,
+};
+
+static int airtime_init(void)
+{
+  stats_register(&airtime_stats);
+  return 0;
+}
+
+SYS_INIT(airtime_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
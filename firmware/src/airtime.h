@@ -0,0 +1,39 @@
+#ifndef __GET_AIRTIME__
+#define __GET_AIRTIME__
+#include <stdbool.h>
+#include <stdint.h>
+
+/**
+ * Time on air of every frame the radios send, against the duty cycle
+ * of the 433 MHz SRD band (10% over an hour by default). A sliding
+ * window of GETSMART_AIRTIME_WINDOW_S is kept in buckets, the oldest
+ * bucket counts in full until it drops out so the estimate errs on the
+ * safe side. The last GETSMART_AIRTIME_RESERVE_PERMILLE of the budget
+ * is kept for interactive commands, the other classes wait for it to
+ * free up.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* A frame went out on a radio, called by the radio backends */
+    void airtime_charge(uint8_t radio, uint32_t us);
+    /* Charge a radio's frames to a light from now on, -1 for none */
+    void airtime_attribute(uint8_t radio, int light);
+
+    /**
+     * How long to hold off before sending 'us' worth of frames, 0 if
+     * they fit in the budget now. Low priority work may not use the
+     * reserve.
+     */
+    int32_t airtime_delay_ms(uint32_t us, bool low_priority);
+    /* Only the reserve is left, work should be cut down */
+    bool airtime_tight(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_AIRTIME__*/
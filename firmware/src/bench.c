@@ -0,0 +1,207 @@
+#include <app_version.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/timing/timing.h>
+
+#include "bench.h"
+#include "config_mgr.h"
+#include "controller.h"
+#include "mem_mgr.h"
+#include "mqtt_codec.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+/**
+ * Microbenchmarks of the command hot path. Each result is printed as one
+ * line, "BENCH " followed by a JSON object, so runs on different commits
+ * can be compared with tools/bench_compare.py.
+ */
+#define BENCH_TOPIC "getsmart/device/0f3def/channel/1/cmnd"
+#define BENCH_COMMAND "{\"state\":\"ON\",\"brightness\":42}"
+
+struct bench {
+  const char *name;
+  void (*fn)(uint32_t i);
+};
+
+static volatile uint32_t sink;
+
+static void bench_code_word(uint32_t i)
+{
+  sink += controller_code_word(i & 1, (i >> 1) & 1, 0);
+}
+
+static void bench_radio_msg(uint32_t i)
+{
+  uint8_t *msg = NULL;
+
+  if (get_radio_msg(i & 1, OP_DIM_DOWN, (i >> 1) & 1, &msg) > 0)
+  {
+    sink += msg[9];
+  }
+  mem_frame_free(msg);
+}
+
+static void bench_topic_info(uint32_t i)
+{
+  char device_id[CFG_SIZE_DEVICEID_ID];
+  int channel = 0;
+
+  extract_device_info(BENCH_TOPIC, device_id, sizeof(device_id), &channel);
+  sink += channel;
+}
+
+/* Includes copying the payload, the parser modifies it in place */
+static void bench_parse_command(uint32_t i)
+{
+  char msg[sizeof(BENCH_COMMAND)];
+  struct msg_command command;
+  bool set_brightness;
+
+  memcpy(msg, BENCH_COMMAND, sizeof(msg));
+  if (parse_msg_command(msg, sizeof(msg) - 1, &command, &set_brightness) > 0)
+  {
+    sink += command.brightness;
+  }
+}
+
+static void bench_format_state(uint32_t i)
+{
+  char payload[MQTT_STATE_PAYLOAD_MAXLEN];
+  struct state_update su = {
+      .channel = i & 1, .state = STATE_ON, .brightness = i & 63};
+
+  format_state_payload(&su, payload, sizeof(payload));
+  sink += payload[0];
+}
+
+static const struct bench benches[] = {
+    {"code_word", bench_code_word},
+    {"radio_msg", bench_radio_msg},
+    {"topic_info", bench_topic_info},
+    {"parse_command", bench_parse_command},
+    {"format_state", bench_format_state},
+};
+
+static void bench_print(const struct shell *sh, const char *line)
+{
+  if (sh != NULL)
+  {
+    shell_print(sh, "BENCH %s", line);
+  }
+  else
+  {
+    printk("BENCH %s\n", line);
+  }
+}
+
+int bench_count(void) { return ARRAY_SIZE(benches); }
+
+int bench_measure(int b, uint32_t iters, struct bench_result *result)
+{
+  if (b < 0 || b >= ARRAY_SIZE(benches) || iters == 0)
+  {
+    return -EINVAL;
+  }
+
+  timing_init();
+  timing_start();
+
+  /* Warm up caches and any lazy init before measuring */
+  for (uint32_t i = 0; i < 16; i++)
+  {
+    benches[b].fn(i);
+  }
+
+  size_t heap_before = mem_heap_allocated();
+  mem_heap_reset_max();
+
+  timing_t start = timing_counter_get();
+  for (uint32_t i = 0; i < iters; i++)
+  {
+    benches[b].fn(i);
+  }
+  timing_t end = timing_counter_get();
+
+  /* Other threads allocate and free meanwhile, the peak can end up
+   * below where the run started */
+  size_t heap_max = mem_heap_max_allocated();
+  size_t heap_after = mem_heap_allocated();
+
+  result->name = benches[b].name;
+  result->iters = iters;
+  result->cycles = timing_cycles_get(&start, &end);
+  result->ns = timing_cycles_to_ns(result->cycles);
+  result->heap_peak =
+      (uint32_t)((heap_max > heap_before) ? heap_max - heap_before : 0);
+  result->heap_leak_op =
+      (uint32_t)((heap_after > heap_before) ? (heap_after - heap_before) / iters
+                                            : 0);
+
+  timing_stop();
+  return 0;
+}
+
+void bench_run(const struct shell *sh, const char *only, uint32_t iters)
+{
+  char line[256];
+  struct bench_result r;
+
+  for (int b = 0; b < ARRAY_SIZE(benches); b++)
+  {
+    if (only != NULL && strcmp(only, benches[b].name) != 0)
+    {
+      continue;
+    }
+    bench_measure(b, iters, &r);
+
+    snprintf(line, sizeof(line),
+             "{\"name\":\"%s\",\"board\":\"%s\",\"version\":\"%s\","
+             "\"iters\":%u,\"cycles_op\":%u,\"ns_op\":%u,"
+             "\"heap_peak_bytes\":%u,\"heap_leak_bytes_op\":%u}",
+             r.name, CONFIG_BOARD, APP_VERSION_STRING, r.iters,
+             (uint32_t)(r.cycles / r.iters), (uint32_t)(r.ns / r.iters),
+             r.heap_peak, r.heap_leak_op);
+    bench_print(sh, line);
+  }
+}
+
+static int cmd_bench(const struct shell *sh, size_t argc, char **argv)
+{
+  uint32_t iters = CONFIG_GETSMART_BENCH_ITERATIONS;
+  const char *only = NULL;
+
+  for (int i = 1; i < argc; i++)
+  {
+    if (argv[i][0] >= '0' && argv[i][0] <= '9')
+    {
+      iters = MAX(strtoul(argv[i], NULL, 10), 1);
+    }
+    else
+    {
+      only = argv[i];
+    }
+  }
+
+  bench_run(sh, only, iters);
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), bench, NULL,
+                 "Run the hot path microbenchmarks [name] [iterations]",
+                 cmd_bench, 1, 2);
+
+#if defined(CONFIG_GETSMART_BENCH_AUTORUN)
+static void bench_autorun(void)
+{
+  bench_run(NULL, NULL, CONFIG_GETSMART_BENCH_ITERATIONS);
+  printk("BENCH done\n");
+}
+
+K_THREAD_DEFINE(bench_autorun_id, 4096, bench_autorun, NULL, NULL, NULL, 14,
+                0, 1000);
+#endif
@@ -0,0 +1,38 @@
+#ifndef __GET_BENCH__
+#define __GET_BENCH__
+#include <stdint.h>
+
+#include <zephyr/shell/shell.h>
+
+/**
+ * Microbenchmarks of the command hot path, run by 'gs bench' and by the
+ * ztest app in tests/bench. Heap figures cover every registered heap,
+ * other threads' allocations included.
+ */
+struct bench_result {
+  const char *name;
+  uint32_t iters;
+  uint64_t cycles;
+  uint64_t ns;
+  /* Most allocated above the start, and left allocated per operation */
+  uint32_t heap_peak;
+  uint32_t heap_leak_op;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int bench_count(void);
+    /* Run benchmark 'b' 'iters' times, -EINVAL if there is no such one */
+    int bench_measure(int b, uint32_t iters, struct bench_result *result);
+    /* Every benchmark, or only the one named 'only', printed as "BENCH
+     * {json}" lines to the shell or, without one, the console */
+    void bench_run(const struct shell *sh, const char *only, uint32_t iters);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_BENCH__*/
@@ -0,0 +1,119 @@
+#ifndef __GET_CODEC__
+#define __GET_CODEC__
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/sys/util.h>
+
+#include "codec_get.h"
+#include "controller.h"
+
+/**
+ * The 433 MHz protocols the lights can speak. A codec is a header of
+ * static inline functions and constants named after it, see codec_get.h:
+ * <name>_code_word() turns a house code row into a code word,
+ * <name>_encode() turns a code word into the frame handed to radio_tx(),
+ * and <ID>_FRAME_LEN, <ID>_STEP_GAP_MS and <ID>_SWITCH_REPEATS(_TIGHT)
+ * are its timing and repeat policy. Each light carries the codec of its
+ * house code and the switches below resolve to that codec's own inline
+ * functions, no function pointers and no heap beyond the frame buffer,
+ * so a frame costs what the GET encoder alone did. Every codec shares
+ * the radios, the TX scheduler and the MQTT topics.
+ *
+ * A codec is added with its header and a line in CODEC_LIST, in the
+ * order of the codec enum of the getsmart,get-house binding.
+ */
+#define CODEC_LIST(X) X(GET, get)
+
+enum codec_id
+{
+#define CODEC_ID(id, name) CODEC_##id,
+  CODEC_LIST(CODEC_ID)
+#undef CODEC_ID
+  CODEC_COUNT
+};
+
+/* Frames are allocated from mem_mgr.h, every codec's must fit */
+#define CODEC_FRAME_CHECK(id, name)                                            \
+  BUILD_ASSERT(id##_FRAME_LEN <= TRANSMIT_BUF_SIZE,                            \
+               #name " frames are longer than TRANSMIT_BUF_SIZE");
+CODEC_LIST(CODEC_FRAME_CHECK)
+#undef CODEC_FRAME_CHECK
+
+static inline const char *codec_name(uint8_t codec)
+{
+  switch (codec)
+  {
+#define CODEC_NAME(id, name)                                                   \
+  case CODEC_##id:                                                             \
+    return #name;
+    CODEC_LIST(CODEC_NAME)
+#undef CODEC_NAME
+  default:
+    return "?";
+  }
+}
+
+/* Code word of a house code row, 0 for an unknown codec */
+static inline uint32_t codec_code_word(uint8_t codec, const uint8_t *seq,
+                                       uint8_t len_seq)
+{
+  switch (codec)
+  {
+#define CODEC_CODE_WORD(id, name)                                              \
+  case CODEC_##id:                                                             \
+    return name##_code_word(seq, len_seq);
+    CODEC_LIST(CODEC_CODE_WORD)
+#undef CODEC_CODE_WORD
+  default:
+    return 0;
+  }
+}
+
+/* Write the frame of a code word to a TRANSMIT_BUF_SIZE buffer, returns
+ * its length, 0 for an unknown codec */
+static inline uint8_t codec_encode(uint8_t codec, uint32_t code,
+                                   uint8_t *frame)
+{
+  switch (codec)
+  {
+#define CODEC_ENCODE(id, name)                                                 \
+  case CODEC_##id:                                                             \
+    return name##_encode(code, frame);
+    CODEC_LIST(CODEC_ENCODE)
+#undef CODEC_ENCODE
+  default:
+    return 0;
+  }
+}
+
+/* Gap between dim pairs, in ms */
+static inline uint8_t codec_step_gap_ms(uint8_t codec)
+{
+  switch (codec)
+  {
+#define CODEC_STEP_GAP(id, name)                                               \
+  case CODEC_##id:                                                             \
+    return id##_STEP_GAP_MS;
+    CODEC_LIST(CODEC_STEP_GAP)
+#undef CODEC_STEP_GAP
+  default:
+    return 0;
+  }
+}
+
+/* Times an on or off frame is sent, 'tight' once airtime is short */
+static inline uint8_t codec_switch_repeats(uint8_t codec, bool tight)
+{
+  switch (codec)
+  {
+#define CODEC_REPEATS(id, name)                                                \
+  case CODEC_##id:                                                             \
+    return tight ? id##_SWITCH_REPEATS_TIGHT : id##_SWITCH_REPEATS;
+    CODEC_LIST(CODEC_REPEATS)
+#undef CODEC_REPEATS
+  default:
+    return 1;
+  }
+}
+
+#endif /*__GET_CODEC__*/
@@ -0,0 +1,56 @@
+#ifndef __GET_CODEC_GET__
+#define __GET_CODEC_GET__
+#include <stdint.h>
+
+#include "radio.h"
+
+/**
+ * The GET protocol, the lights this controller was written for. A house
+ * code row is a run count followed by the runs of pulses, see PULSESEQ,
+ * and becomes a 32 bit code word sent after the header the remotes use.
+ */
+#define GET_FRAME_LEN (RADIO_GET_HEADER_LEN + RADIO_CODE_LEN + 1)
+/* Between dim pairs, short enough for the receivers to count one burst */
+#define GET_STEP_GAP_MS 5
+/* On and off frames are repeated for redundancy, fewer once the airtime
+ * budget is down to its reserve */
+#define GET_SWITCH_REPEATS 4
+#define GET_SWITCH_REPEATS_TIGHT 2
+
+/**
+ * Build the 32 bit code word from a pulse sequence, each pulse is a 1
+ * followed by a 0, with an extra 0 between each run of pulses.
+ */
+static inline uint32_t get_code_word(const uint8_t *seq, uint8_t len_seq)
+{
+  uint32_t code = 0x40000000;
+  int bit = 27;
+  for (int i = 0; i < len_seq; i++)
+  {
+    for (int j = seq[i]; j > 0 && bit >= 0; j--)
+    {
+      code |= 1U << bit;
+      bit -= 2;
+    }
+    bit -= 1;
+  }
+  return code;
+}
+
+static inline uint8_t get_encode(uint32_t code, uint8_t *frame)
+{
+  frame[0] = 0x54;
+  frame[1] = 0x2A;
+  frame[2] = 0xAA;
+  frame[3] = 0xA5;
+  frame[4] = 0x55;
+  frame[5] = 0x55;
+  frame[6] = code >> 24;
+  frame[7] = code >> 16;
+  frame[8] = code >> 8;
+  frame[9] = code;
+  frame[10] = 0x00; // TODO: Not part of the message, needs more testing
+  return GET_FRAME_LEN;
+}
+
+#endif /*__GET_CODEC_GET__*/
@@ -6,6 +6,9 @@
 /* Config Keys */
 #define CFG_REBOOTCNT_ID 1
 #define CFG_DEVICEID_ID 2
+#define CFG_HOUSES_ID 3
+#define CFG_LIGHTS_ID 4
+#define CFG_SCENES_ID 5
 
 #define CFG_SIZE_DEVICEID_ID 7
 
@@ -2,179 +2,380 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
 #include <zephyr/zbus/zbus.h>
 
+#include "airtime.h"
+#include "codec.h"
+#include "latency.h"
+#include "lights.h"
+#include "mem_mgr.h"
+#include "pacing.h"
 #include "radio.h"
+#include "trace.h"
+#include "tx_sched.h"
 
 LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
 
-static const uint8_t pulses[] = PULSESEQ;
+/* state_lost is one bit per light */
+BUILD_ASSERT(CHANNEL_COUNT <= 32, "At most 32 lights");
 
-static uint8_t code_to_tx_payload(uint8_t *seq, uint8_t len_seq,
-                                  uint8_t **msg) {
-  LOG_INF("Code to payload, %d", len_seq);
-  LOG_HEXDUMP_INF(seq, len_seq, "Seq: ");
-
-  *msg = (uint8_t *)malloc(TRANSMIT_BUF_SIZE);
-
-  (*msg)[0] = 0x54;
-  (*msg)[1] = 0x2A;
-  (*msg)[2] = 0xAA;
-  (*msg)[3] = 0xA5;
-  (*msg)[4] = 0x55;
-  (*msg)[5] = 0x55;
+/* On and off frames are repeated for redundancy, as often as the light's
+ * codec wants them, see codec.h */
+static uint8_t switch_repeats(int channel) {
+  return codec_switch_repeats(lights_codec(channel), airtime_tight());
+}
 
-  uint32_t code = 0x40000000;
-  uint8_t bit = 27;
-  for (int i = 0; i < len_seq; i++) {
-    for (int j = seq[i]; j > 0; j--) {
-      code |= 1 << bit;
-      bit -= 2;
-    }
-    bit -= 1;
+static uint8_t code_to_tx_payload(uint8_t codec, uint32_t code,
+                                  uint8_t **msg) {
+  *msg = (uint8_t *)mem_frame_alloc();
+  if (*msg == NULL) {
+    return 0;
   }
-  // code |= 1 << (bit - 2);
+  return codec_encode(codec, code, *msg);
+}
 
-  (*msg)[6] = code >> 24;
-  (*msg)[7] = code >> 16;
-  (*msg)[8] = code >> 8;
-  (*msg)[9] = code;
-  (*msg)[10] = 0x00;  // TODO: Not part of the message, needs more testing
-  return TRANSMIT_BUF_SIZE;
+/**
+ * Convert the Channel and OP code combo to the code word transmitted
+ * by the radio. The code words of every light are generated at boot.
+ */
+uint32_t controller_code_word(uint8_t channel, uint8_t op, uint8_t pulse_no) {
+  return lights_code_word(channel, op, pulse_no);
 }
 
 /**
  * Convert the Channel and OP code combo to the bytes to be transmitted
  * by the radio.
  */
-static uint8_t get_radio_msg(uint8_t channel, uint8_t op, uint8_t pulse_no,
-                             uint8_t **msg) {
-  // Get the pattern to be transmitted
-  uint8_t seq[PLUSESEQ_SIZE - 1];
-  uint8_t len_seq;
+uint8_t get_radio_msg(uint8_t channel, uint8_t op, uint8_t pulse_no,
+                      uint8_t **msg) {
+  uint32_t code = controller_code_word(channel, op, pulse_no);
+  if (code == 0) {
+    *msg = NULL;
+    return 0;
+  }
 
-  uint8_t index =
-      ((channel * ROWS_PER_CHANNEL) + pulse_no + op) * PLUSESEQ_SIZE;
+  // Convert it to the actual byte sequence to be transmitted
+  uint8_t len = code_to_tx_payload(lights_codec(channel), code, msg);
+  if (len > 0) {
+    TRACE(TR_RADIO_MSG, (channel << 16) | (op << 8) | pulse_no, code);
+  }
+  return len;
+}
 
-  // First byte of the "row" is length of the pluse sequence
-  memcpy(&len_seq, &pulses, sizeof(uint8_t));
-  LOG_INF("Len of seq is:%d", len_seq);
+/**
+ * Publish the state update message on the zbus. Never blocks, if the
+ * subscriber queue is full the update is flagged as lost and the
+ * subscriber re-delivers the latest state for that channel instead.
+ */
+static void publish_state(struct controller *controller, int channel,
+                          int state, int brightness, uint64_t t_rx) {
+  struct state_update update;
 
-  // remainder of row is the actual sequence for this channel/op combo
-  LOG_INF("Coping from index %d",
-          (channel * PLUSESEQ_SIZE) + op + 1 + pulse_no);
+  k_spinlock_key_t key = k_spin_lock(&controller->state_lock);
+  controller->state[channel].state = state;
+  controller->state[channel].brightness = brightness;
+  update.channel = channel;
+  update.state = state;
+  update.brightness = brightness;
+  update.seq = controller->latest[channel].seq + 1;
+  update.t_rx = t_rx;
+  controller->latest[channel] = update;
+  controller->changed_at[channel] = k_uptime_get();
+  k_spin_unlock(&controller->state_lock, key);
 
-  memcpy(&seq, pulses + index + 1, sizeof(uint8_t) * len_seq);
+  int res = zbus_chan_pub(controller->state_update_channel, &update, K_NO_WAIT);
+  if (res != 0) {
+    key = k_spin_lock(&controller->state_lock);
+    controller->state_lost |= BIT(channel);
+    k_spin_unlock(&controller->state_lock, key);
+    atomic_inc(&controller->state_overflows);
+    TRACE(TR_STATE_OVERFLOW, channel, atomic_get(&controller->state_overflows));
+  }
+  TRACE(TR_STATE_UPDATE, (channel << 16) | (update.seq & 0xFFFF),
+        TRACE_STATE(state, brightness));
+}
 
-  // Convert it to the actual byte sequence to be transmitted
-  return code_to_tx_payload((uint8_t *)&seq, len_seq, msg);
+/* State reached by a command being handled */
+static void update_state(struct controller *controller, int channel, int state,
+                         int brightness) {
+  latency_mark(LAT_STAGE_LAST_TX);
+  publish_state(controller, channel, state, brightness, latency_current());
+  latency_mark(LAT_STAGE_ZBUS);
 }
 
 /**
- * Publish the state update message on the zbus
+ * Record a change made by someone else, i.e. the wall remote. Later
+ * commands dim from the level the light is really at.
  */
-static void update_state(struct controller *controller, int channel, int state,
-                         int brightness) {
-  controller->state[channel].state = state,
-  controller->state[channel].brightness = brightness;
+void controller_track_state(struct controller *controller, int channel,
+                            int state, int brightness) {
+  if (channel < 0 || channel >= controller->num_lights) {
+    return;
+  }
+  if (controller->state[channel].state == state &&
+      controller->state[channel].brightness == brightness) {
+    return;
+  }
+  publish_state(controller, channel, state, brightness, 0);
+}
 
-  struct state_update update = {channel, state, brightness};
-  int res =
-      zbus_chan_pub(controller->state_update_channel, &(update), K_FOREVER);
-  LOG_INF("Updated State: channel %d, status:%d, brightness %d, Published: %d",
-          channel, state, brightness, res);
+/**
+ * Called by the subscriber for every update taken off the zbus queue.
+ * Returns false if a newer update for the channel was already delivered.
+ */
+bool controller_state_claim(struct controller *controller,
+                            const struct state_update *su) {
+  bool fresh = false;
+
+  if (su->channel < 0 || su->channel >= CHANNEL_COUNT) {
+    return false;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&controller->state_lock);
+  if (su->seq > controller->delivered_seq[su->channel]) {
+    controller->delivered_seq[su->channel] = su->seq;
+    fresh = true;
+  }
+  k_spin_unlock(&controller->state_lock, key);
+  return fresh;
 }
 
-static int ctlr_on(struct controller *controller, int channel) {
-  LOG_INF("Radio Send: Channel %d, Code: ON", channel);
+/**
+ * Take the latest state of the next channel whose update was dropped
+ * by the zbus, returns false once there are none left.
+ */
+bool controller_state_next_lost(struct controller *controller,
+                                struct state_update *su) {
+  bool found = false;
+
+  k_spinlock_key_t key = k_spin_lock(&controller->state_lock);
+  if (controller->state_lost != 0) {
+    int channel = find_lsb_set(controller->state_lost) - 1;
+
+    controller->state_lost &= ~BIT(channel);
+    *su = controller->latest[channel];
+    controller->delivered_seq[channel] = su->seq;
+    found = true;
+  }
+  k_spin_unlock(&controller->state_lock, key);
+  return found;
+}
+
+/**
+ * The current state of a light, for publishing every light's again.
+ * Updates for it still queued are older and are no longer delivered.
+ */
+void controller_state_current(struct controller *controller, int channel,
+                              struct state_update *su) {
+  k_spinlock_key_t key = k_spin_lock(&controller->state_lock);
+  su->channel = channel;
+  su->state = controller->state[channel].state;
+  su->brightness = controller->state[channel].brightness;
+  su->seq = controller->latest[channel].seq;
+  su->t_rx = 0;
+  controller->delivered_seq[channel] = su->seq;
+  controller->state_lost &= ~BIT(channel);
+  k_spin_unlock(&controller->state_lock, key);
+}
+
+/* An on or off frame, repeated */
+static int send_switch(uint8_t radio, int channel, uint8_t op) {
   uint8_t *msg = NULL;
-  uint8_t len = get_radio_msg(channel, OP_ON, 0, &msg);
-  LOG_HEXDUMP_INF(msg, TRANSMIT_BUF_SIZE, "Msg: ");
-  radio_tx_repeat(msg, len, 4);
-  free(msg);
+  uint8_t len = get_radio_msg(channel, op, 0, &msg);
+  if (len == 0) {
+    return -ENOMEM;
+  }
+  int err = radio_tx_repeat(radio, msg, len, switch_repeats(channel));
+  mem_frame_free(msg);
+  return err;
+}
+
+static int ctlr_on(struct controller *controller, uint8_t radio, int channel) {
+  int err = send_switch(radio, channel, OP_ON);
+  if (err != 0) {
+    return err;
+  }
   update_state(controller, channel, STATE_ON, DIM_LEVELS);
   return 0;
 }
 
-static int ctlr_off(struct controller *controller, int channel) {
-  LOG_INF("Radio Send: Channel %d, Code: OFF", channel);
-  uint8_t *msg = NULL;
-  uint8_t len = get_radio_msg(channel, OP_OFF, 0, &msg);
-  radio_tx_repeat(msg, len, 4);
-  free(msg);
+static int ctlr_off(struct controller *controller, uint8_t radio,
+                    int channel) {
+  int err = send_switch(radio, channel, OP_OFF);
+  if (err != 0) {
+    return err;
+  }
   update_state(controller, channel, STATE_OFF, 0);
   return 0;
 }
 
-static int ctlr_dim_up(struct controller *controller, int channel, int steps) {
-  LOG_INF("Radio Send: Channel %d, Dim Up: %d", channel, steps);
+/* Long enough for the receivers to start a new dim burst, going up, see
+ * get_model.c */
+#define DIM_BURST_GAP_MS 600
+
+/* When each light's last ramp down ended, in ms of uptime, under its
+ * light_lock */
+static int64_t down_end_ms[CHANNEL_COUNT];
+
+/**
+ * Pairs within the burst gap of a ramp down carry on in that burst, a
+ * ramp up would go down and the direction pair of another ramp down
+ * would turn it round. A ramp down given up for another command runs
+ * again straight after it, so wait for a new burst first.
+ */
+static void dim_new_burst(int channel) {
+  int64_t left = down_end_ms[channel] + DIM_BURST_GAP_MS - k_uptime_get();
+
+  if (down_end_ms[channel] != 0 && left > 0) {
+    k_sleep(K_MSEC(left));
+  }
+}
+
+/**
+ * Send the dim pulse pairs, one pair per step. Stops at the first frame
+ * that failed to go out, a lone pulse 1 would still step the receivers,
+ * or before a pair once 'preempt' says the radio is wanted, and returns
+ * the number of steps taken.
+ */
+static int dim_steps(uint8_t radio, int channel, uint8_t *msg0, uint8_t len0,
+                     uint8_t *msg1, uint8_t len1, int steps,
+                     controller_preempt_t preempt) {
+  k_timeout_t gap = K_MSEC(codec_step_gap_ms(lights_codec(channel)));
+  int i;
+
+  for (i = 0; i < steps; i++) {
+    if (preempt != NULL && preempt(radio)) {
+      break;
+    }
+    pacing_pair(radio);
+    if (radio_tx(radio, msg0, len0) != 0 || radio_tx(radio, msg1, len1) != 0) {
+      break;
+    }
+    k_sleep(gap);
+  }
+  pacing_end(radio);
+  return i;
+}
+
+/* A ramp that stopped after 'done' of its steps, maybe for 'preempt' */
+static int dim_result(uint8_t radio, int done, int steps,
+                      controller_preempt_t preempt) {
+  if (done == steps) {
+    return 0;
+  }
+  return (preempt != NULL && preempt(radio)) ? -EINTR : -EIO;
+}
+
+static int ctlr_dim_up(struct controller *controller, uint8_t radio,
+                       int channel, int steps, controller_preempt_t preempt) {
   uint8_t *msg0 = NULL;
   uint8_t *msg1 = NULL;
 
   uint8_t len0 = get_radio_msg(channel, OP_DIM_DOWN, 0, &msg0);
   uint8_t len1 = get_radio_msg(channel, OP_DIM_DOWN, 1, &msg1);
-
-  for (int i = 0; i < steps; i++) {
-    radio_tx(msg0, len0);
-    radio_tx(msg1, len1);
-    k_sleep(K_MSEC(5));
+  if (len0 == 0 || len1 == 0) {
+    mem_frame_free(msg0);
+    mem_frame_free(msg1);
+    return -ENOMEM;
   }
 
-  free(msg0);
-  free(msg1);
+  dim_new_burst(channel);
+  int done = dim_steps(radio, channel, msg0, len0, msg1, len1, steps, preempt);
 
-  update_state(controller, channel, STATE_ON,
-               controller->state[channel].brightness + steps);
-  return 0;
+  mem_frame_free(msg0);
+  mem_frame_free(msg1);
+
+  if (done > 0) {
+    update_state(controller, channel, STATE_ON,
+                 controller->state[channel].brightness + done);
+  }
+  return dim_result(radio, done, steps, preempt);
 }
 
-static int ctlr_dim_down(struct controller *controller, int channel,
-                         int steps) {
-  LOG_INF("Radio Send: Channel %d, Dim Down: %d", channel, steps);
+static int ctlr_dim_down(struct controller *controller, uint8_t radio,
+                         int channel, int steps,
+                         controller_preempt_t preempt) {
   uint8_t *msg0 = NULL;
   uint8_t *msg1 = NULL;
   uint8_t len0 = get_radio_msg(channel, OP_DIM_DOWN, 0, &msg0);
   uint8_t len1 = get_radio_msg(channel, OP_DIM_DOWN, 1, &msg1);
+  if (len0 == 0 || len1 == 0) {
+    mem_frame_free(msg0);
+    mem_frame_free(msg1);
+    return -ENOMEM;
+  }
 
-  radio_tx(msg0, len0);
-  radio_tx(msg1, len1);
+  int done = -1;
+  dim_new_burst(channel);
+  if (radio_tx(radio, msg0, len0) == 0 &&
+      radio_tx(radio, msg1, len1) == 0) {
+    done = dim_steps(radio, channel, msg0, len0, msg1, len1, steps, preempt);
+    down_end_ms[channel] = k_uptime_get();
+  }
+  mem_frame_free(msg0);
+  mem_frame_free(msg1);
 
-  for (int i = 0; i < steps; i++) {
-    radio_tx(msg0, len0);
-    radio_tx(msg1, len1);
-    k_sleep(K_MSEC(5));
+  if (done < 0) {
+    return -EIO;
   }
-  free(msg0);
-  free(msg1);
-  update_state(controller, channel, STATE_ON,
-               controller->state[channel].brightness - steps);
-  return 0;
+  if (done > 0) {
+    update_state(controller, channel, STATE_ON,
+                 controller->state[channel].brightness - done);
+  }
+  return dim_result(radio, done, steps, preempt);
 }
 
 /**
- * Transmit the required radio signals to transition the lights
- * from current state to the requested, and if successful publish
- * the new state on the zbus.
+ * Time on air a command would take from the light's current state, the
+ * same frames request_state_locked() sends.
  */
-int request_state(struct controller *controller, int channel, int state,
-                  bool set_brightness, int brightness) {
-  LOG_INF("Current State: status:%d, brightness %d",
-          controller->state[channel].state,
-          controller->state[channel].brightness);
-  LOG_INF("Request State: status:%d, brightness %d", state, brightness);
+uint32_t controller_airtime_us(struct controller *controller, int channel,
+                               int state, bool set_brightness,
+                               int brightness) {
+  uint32_t frames = 0;
 
-  if (channel >= controller->num_lights) {
-    LOG_ERR("Light for channel %d not configured.", channel);
-    return -EINVAL;
+  if (channel < 0 || channel >= controller->num_lights) {
+    return 0;
   }
 
+  int current = controller->state[channel].brightness;
+  if (controller->state[channel].state != state) {
+    frames += switch_repeats(channel);
+    current = (state == STATE_ON) ? DIM_LEVELS : 0;
+  }
+  if (set_brightness && current != brightness && brightness > 1 &&
+      brightness <= DIM_LEVELS) {
+    int diff = brightness - current;
+
+    /* A pulse pair per step, dimming down takes an extra pair */
+    frames += (diff > 0) ? diff * 2 : (abs(diff) + 1) * 2;
+  }
+  return frames * radio_airtime_us(TRANSMIT_BUF_SIZE);
+}
+
+static int request_state_locked(struct controller *controller, uint8_t radio,
+                                int channel, int state, bool set_brightness,
+                                int brightness, controller_preempt_t preempt) {
+  TRACE(TR_CMD_REQUEST, channel, TRACE_STATE(state, brightness));
+  TRACE(TR_CMD_CURRENT, channel,
+        TRACE_STATE(controller->state[channel].state,
+                    controller->state[channel].brightness));
+
+  int err = 0;
   if (controller->state[channel].state != state) {
     if (state == STATE_ON) {
-      ctlr_on(controller, channel);
+      err = ctlr_on(controller, radio, channel);
     } else {
-      ctlr_off(controller, channel);
+      err = ctlr_off(controller, radio, channel);
+    }
+    if (err != 0) {
+      LOG_ERR("Channel %d: failed to switch %s: %d", channel,
+              (state == STATE_ON) ? "on" : "off", err);
+      return err;
     }
   }
   if (set_brightness && controller->state[channel].brightness != brightness) {
@@ -185,12 +386,501 @@ int request_state(struct controller *controller, int channel, int state,
     } else {
       int diff = brightness - controller->state[channel].brightness;
       if (diff > 0) {
-        ctlr_dim_up(controller, channel, diff);
+        err = ctlr_dim_up(controller, radio, channel, diff, preempt);
       } else {
-        ctlr_dim_down(controller, channel, abs(diff));
+        err = ctlr_dim_down(controller, radio, channel, abs(diff), preempt);
+      }
+      if (err == -EINTR) {
+        LOG_DBG("Channel %d: dim to %d gave the radio up at %d", channel,
+                brightness, controller->state[channel].brightness);
+      } else if (err != 0) {
+        LOG_ERR("Channel %d: dim to %d incomplete: %d", channel, brightness,
+                err);
+      }
+    }
+  }
+
+  return err;
+}
+
+/**
+ * Transmit the required radio signals to transition the lights
+ * from current state to the requested, and if successful publish
+ * the new state on the zbus. Runs on the radio's TX thread. A dim ramp
+ * gives the radio up between pairs once 'preempt' returns true, then
+ * returns -EINTR with the level reached published; running the same
+ * command again starts a new ramp from there, once the receivers have
+ * let the old burst go.
+ */
+int controller_execute(struct controller *controller, uint8_t radio,
+                       int channel, int state, bool set_brightness,
+                       int brightness, controller_preempt_t preempt) {
+  if (channel < 0 || channel >= controller->num_lights) {
+    LOG_ERR("Light for channel %d not configured.", channel);
+    return -EINVAL;
+  }
+
+  k_mutex_lock(&controller->light_lock[channel], K_FOREVER);
+  int err = request_state_locked(controller, radio, channel, state,
+                                 set_brightness, brightness, preempt);
+  k_mutex_unlock(&controller->light_lock[channel]);
+  return err;
+}
+
+#if defined(CONFIG_GETSMART_REHOME)
+/* How far a light may have drifted between re-homes, in dim steps */
+#define REHOME_DRIFT CONFIG_GETSMART_REHOME_MAX_DRIFT
+
+enum rehome_plan {
+  REHOME_OFF,     /* Repeat the off frames */
+  REHOME_CEILING, /* On, which is full brightness, then dim down */
+  REHOME_FLOOR,   /* Dim down past the bottom, then back up */
+};
+
+/* Cheapest way to re-home a light, returns its length in frames */
+static int rehome_plan(int channel, const struct light_state *s,
+                       enum rehome_plan *plan) {
+  if (s->state != STATE_ON) {
+    *plan = REHOME_OFF;
+    return switch_repeats(channel);
+  }
+
+  int b = CLAMP(s->brightness, 1, DIM_LEVELS);
+  int ceiling = switch_repeats(channel) +
+                ((b < DIM_LEVELS) ? (DIM_LEVELS - b + 1) * 2 : 0);
+  /* A direction pair, enough steps to reach 1 from anywhere within the
+   * drift, then b - 1 steps back up */
+  int floor = (b + REHOME_DRIFT) * 2 + (b - 1) * 2;
+
+  *plan = (floor < ceiling) ? REHOME_FLOOR : REHOME_CEILING;
+  return MIN(floor, ceiling);
+}
+
+uint32_t controller_rehome_airtime_us(struct controller *controller,
+                                      int channel) {
+  enum rehome_plan plan;
+
+  if (channel < 0 || channel >= controller->num_lights) {
+    return 0;
+  }
+  struct light_state s = controller->state[channel];
+  return rehome_plan(channel, &s, &plan) * radio_airtime_us(TRANSMIT_BUF_SIZE);
+}
+
+static int rehome_locked(struct controller *controller, uint8_t radio,
+                         int channel, enum rehome_plan plan,
+                         controller_preempt_t preempt) {
+  if (plan == REHOME_OFF) {
+    return send_switch(radio, channel, OP_OFF);
+  }
+
+  uint8_t *msg0 = NULL;
+  uint8_t *msg1 = NULL;
+  uint8_t len0 = get_radio_msg(channel, OP_DIM_DOWN, 0, &msg0);
+  uint8_t len1 = get_radio_msg(channel, OP_DIM_DOWN, 1, &msg1);
+  if (len0 == 0 || len1 == 0) {
+    mem_frame_free(msg0);
+    mem_frame_free(msg1);
+    return -ENOMEM;
+  }
+
+  int target = controller->state[channel].brightness;
+  int level = target;
+  int err = 0;
+  bool cut = false;
+
+  dim_new_burst(channel);
+  if (plan == REHOME_FLOOR) {
+    int down = target - 1 + REHOME_DRIFT;
+    int done = -1;
+
+    if (radio_tx(radio, msg0, len0) == 0 &&
+        radio_tx(radio, msg1, len1) == 0) {
+      done =
+          dim_steps(radio, channel, msg0, len0, msg1, len1, down, preempt);
+    }
+    if (done >= 0 && preempt != NULL && preempt(radio)) {
+      /* Give the radio up at once, the live command comes first */
+      level = MAX(target - done, 1);
+      cut = true;
+      if (done > 0) {
+        down_end_ms[channel] = k_uptime_get();
       }
+    } else if (done == down) {
+      k_sleep(K_MSEC(DIM_BURST_GAP_MS));
+      level = 1;
+      if (preempt == NULL || !preempt(radio)) {
+        level += dim_steps(radio, channel, msg0, len0, msg1, len1,
+                           target - 1, preempt);
+      }
+    } else {
+      /* A frame failed on the way down, on is the only known level */
+      plan = REHOME_CEILING;
+    }
+  }
+  if (plan == REHOME_CEILING) {
+    err = send_switch(radio, channel, OP_ON);
+    level = DIM_LEVELS;
+    if (err == 0 && target < DIM_LEVELS &&
+        (preempt == NULL || !preempt(radio)) &&
+        radio_tx(radio, msg0, len0) == 0 &&
+        radio_tx(radio, msg1, len1) == 0) {
+      level -= dim_steps(radio, channel, msg0, len0, msg1, len1,
+                         DIM_LEVELS - target, preempt);
+      down_end_ms[channel] = k_uptime_get();
     }
   }
+  mem_frame_free(msg0);
+  mem_frame_free(msg1);
 
+  if (err != 0) {
+    return err;
+  }
+  if (cut || level != target) {
+    /* Cut short, report where the light really is */
+    publish_state(controller, channel, STATE_ON, level, 0);
+    return -EINTR;
+  }
   return 0;
 }
+
+/**
+ * Drive a light to a level it is known to be at and back to its state,
+ * by the plan with the least airtime. Gives up the radio between dim
+ * pairs once 'preempt' returns true, then returns -EINTR with the level
+ * reached published and the state it was meant to be in in 'before'.
+ */
+int controller_rehome(struct controller *controller, uint8_t radio,
+                      int channel, controller_preempt_t preempt,
+                      struct light_state *before) {
+  enum rehome_plan plan;
+
+  if (channel < 0 || channel >= controller->num_lights) {
+    return -EINVAL;
+  }
+
+  k_mutex_lock(&controller->light_lock[channel], K_FOREVER);
+  *before = controller->state[channel];
+  rehome_plan(channel, before, &plan);
+  int err = rehome_locked(controller, radio, channel, plan, preempt);
+  k_mutex_unlock(&controller->light_lock[channel]);
+
+  TRACE(TR_REHOME, (channel << 16) | plan, err);
+  return err;
+}
+#endif
+
+#if defined(CONFIG_GETSMART_SCENES)
+/**
+ * A scene is sent as one program: the on and off frames first, then the
+ * dim ramps of each house code together. The pulse 0 frame arms every
+ * light of a house code, so a round of one pulse 0 followed by the pulse
+ * 1 of each light still stepping moves all of them one step. A light
+ * dimming down needs its pair followed at once by another to reverse,
+ * only the last light of a round can do that, so they join one a round.
+ * A round is at most HOUSE_CHANNEL_MAX + 2 frames, well inside the
+ * receivers' burst gap, see get_model.c.
+ */
+struct scene_light {
+  int channel;
+  /* Switch frames sent first, OP_COUNT for none */
+  uint8_t op;
+  int state;
+  /* Level as the frames go out */
+  int level;
+  /* Dim steps left, negative going down */
+  int steps;
+  /* Codec and pulse 0 code word, the same for every light of a house
+   * code */
+  uint8_t codec;
+  uint32_t group;
+  /* Going down and reversed */
+  bool joined;
+  /* Something was sent that changed the light */
+  bool moved;
+  bool published;
+};
+
+struct scene_program {
+  uint8_t radio;
+  /* Only count the frames */
+  bool send;
+  uint32_t frames;
+};
+
+static int program_tx(struct scene_program *p, int channel, uint8_t op,
+                      uint8_t pulse_no, uint8_t repeats) {
+  p->frames += repeats;
+  if (!p->send) {
+    return 0;
+  }
+
+  uint8_t *msg = NULL;
+  uint8_t len = get_radio_msg(channel, op, pulse_no, &msg);
+  if (len == 0) {
+    return -ENOMEM;
+  }
+  int err = radio_tx_repeat(p->radio, msg, len, repeats);
+  mem_frame_free(msg);
+  return err;
+}
+
+/* What a light needs to get from its current state to the target */
+static void scene_plan(struct controller *controller,
+                       const struct scene_target *t, struct scene_light *l) {
+  const struct light_state *s = &controller->state[t->light];
+
+  memset(l, 0, sizeof(*l));
+  l->channel = t->light;
+  l->op = OP_COUNT;
+  l->state = t->state;
+  l->level = s->brightness;
+  l->codec = lights_codec(t->light);
+  l->group = controller_code_word(t->light, OP_DIM_DOWN, 0);
+
+  if (t->state != STATE_ON) {
+    if (s->state != t->state) {
+      l->op = OP_OFF;
+      l->level = 0;
+    }
+    return;
+  }
+  if (s->state != STATE_ON) {
+    l->op = OP_ON;
+    l->level = DIM_LEVELS;
+  }
+  if (t->brightness <= 1 || t->brightness > DIM_LEVELS) {
+    return;
+  }
+
+  int up = t->brightness - l->level;
+  int down = DIM_LEVELS - t->brightness;
+
+  /* Far below the target, switching on and coming down is shorter */
+  if (l->op == OP_COUNT && up > 0 &&
+      switch_repeats(t->light) + ((down > 0) ? (down + 1) * 2 : 0) < up * 2) {
+    l->op = OP_ON;
+    l->level = DIM_LEVELS;
+  }
+  l->steps = t->brightness - l->level;
+}
+
+/* Run the rounds of the house code whose pulse 0 'lead' sends */
+static int scene_dim_group(struct scene_program *p, struct scene_light *lights,
+                           int count, int lead) {
+  uint8_t codec = lights[lead].codec;
+  uint32_t group = lights[lead].group;
+  int err = 0;
+
+  for (int round = 0; err == 0; round++) {
+    int stepping = 0;
+    int pick = -1;
+
+    for (int i = 0; i < count; i++) {
+      struct scene_light *l = &lights[i];
+
+      if (l->codec != codec || l->group != group || l->steps == 0) {
+        continue;
+      }
+      if (l->steps > 0 || l->joined) {
+        stepping++;
+      } else if (pick < 0 || l->steps < lights[pick].steps) {
+        /* Longest ramp down joins first */
+        pick = i;
+      }
+    }
+    if (stepping == 0 && pick < 0) {
+      break;
+    }
+    if (p->send && round > 0) {
+      k_sleep(K_MSEC(codec_step_gap_ms(codec)));
+    }
+
+    err = program_tx(p, lights[lead].channel, OP_DIM_DOWN, 0, 1);
+    for (int i = 0; i < count && err == 0; i++) {
+      struct scene_light *l = &lights[i];
+
+      if (l->codec != codec || l->group != group || l->steps == 0 ||
+          (l->steps < 0 && !l->joined)) {
+        continue;
+      }
+      err = program_tx(p, l->channel, OP_DIM_DOWN, 1, 1);
+      if (err == 0) {
+        int step = (l->steps > 0) ? 1 : -1;
+
+        l->level += step;
+        l->steps -= step;
+        l->moved = true;
+      }
+    }
+    if (pick >= 0 && err == 0) {
+      struct scene_light *l = &lights[pick];
+      int before = l->level;
+
+      /* Steps up, the pair straight after takes it back and goes down */
+      err = program_tx(p, l->channel, OP_DIM_DOWN, 1, 1);
+      if (err == 0) {
+        l->level = MIN(before + 1, DIM_LEVELS);
+        l->moved = true;
+        err = program_tx(p, lights[lead].channel, OP_DIM_DOWN, 0, 1);
+      }
+      if (err == 0) {
+        err = program_tx(p, l->channel, OP_DIM_DOWN, 1, 1);
+      }
+      if (err == 0) {
+        l->level = before - 1;
+        l->steps++;
+        l->joined = true;
+      }
+    }
+  }
+  return err;
+}
+
+static int scene_run(struct controller *controller, struct scene_program *p,
+                     struct scene_light *lights, int count) {
+  int err = 0;
+
+  for (int i = 0; i < count && err == 0; i++) {
+    struct scene_light *l = &lights[i];
+
+    if (l->op == OP_COUNT) {
+      continue;
+    }
+    err = program_tx(p, l->channel, l->op, 0, switch_repeats(l->channel));
+    if (err == 0) {
+      l->moved = true;
+    }
+    if (err == 0 && l->steps == 0 && p->send) {
+      update_state(controller, l->channel, l->state, l->level);
+      l->published = true;
+    }
+  }
+
+  while (err == 0) {
+    int lead = -1;
+
+    for (int i = 0; i < count && lead < 0; i++) {
+      lead = (lights[i].steps != 0) ? i : -1;
+    }
+    if (lead < 0) {
+      break;
+    }
+    err = scene_dim_group(p, lights, count, lead);
+  }
+
+  /* Where the dimmed lights got to, all the way or not */
+  for (int i = 0; i < count && p->send; i++) {
+    struct scene_light *l = &lights[i];
+
+    if (l->moved && !l->published) {
+      update_state(controller, l->channel, l->state, l->level);
+    }
+  }
+  return err;
+}
+
+/* Scenes are kept in ascending light order, which is the locking order */
+static bool scene_valid(struct controller *controller,
+                        const struct scene_target *targets, int count) {
+  if (count < 0 || count > CHANNEL_COUNT) {
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    if (targets[i].light >= controller->num_lights ||
+        (i > 0 && targets[i].light <= targets[i - 1].light)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/**
+ * Frames a scene would take from the lights' current states, and in
+ * 'individual' the frames of sending each light's command on its own.
+ */
+uint32_t controller_scene_frames(struct controller *controller,
+                                 const struct scene_target *targets, int count,
+                                 uint32_t *individual) {
+  struct scene_light lights[CHANNEL_COUNT];
+  struct scene_program p = {.send = false};
+  uint32_t frame_us = radio_airtime_us(TRANSMIT_BUF_SIZE);
+
+  *individual = 0;
+  if (!scene_valid(controller, targets, count)) {
+    return 0;
+  }
+
+  for (int i = 0; i < count; i++) {
+    const struct scene_target *t = &targets[i];
+
+    scene_plan(controller, t, &lights[i]);
+    *individual += controller_airtime_us(controller, t->light, t->state,
+                                         t->brightness != 0, t->brightness) /
+                   frame_us;
+  }
+  scene_run(controller, &p, lights, count);
+  return p.frames;
+}
+
+/**
+ * Send a scene as one program and publish the state each light reached.
+ * Runs on the radio's TX thread, holding the lock of every light in it.
+ */
+int controller_scene(struct controller *controller, uint8_t radio,
+                     const struct scene_target *targets, int count,
+                     uint32_t *frames) {
+  struct scene_light lights[CHANNEL_COUNT];
+  struct scene_program p = {.radio = radio, .send = true};
+
+  *frames = 0;
+  if (!scene_valid(controller, targets, count)) {
+    LOG_ERR("Scene with lights not configured or out of order");
+    return -EINVAL;
+  }
+
+  for (int i = 0; i < count; i++) {
+    k_mutex_lock(&controller->light_lock[targets[i].light], K_FOREVER);
+  }
+  for (int i = 0; i < count; i++) {
+    TRACE(TR_CMD_REQUEST, targets[i].light,
+          TRACE_STATE(targets[i].state, targets[i].brightness));
+    scene_plan(controller, &targets[i], &lights[i]);
+  }
+
+  int err = scene_run(controller, &p, lights, count);
+
+  for (int i = count - 1; i >= 0; i--) {
+    k_mutex_unlock(&controller->light_lock[targets[i].light]);
+  }
+  if (err != 0) {
+    LOG_ERR("Scene incomplete after %u frames: %d", p.frames, err);
+  }
+  *frames = p.frames;
+  return err;
+}
+#endif
+
+/**
+ * Queue a state change for a light on one of the radios, see
+ * tx_sched.h. Never blocks on the radio.
+ */
+int request_state(struct controller *controller, int channel, int state,
+                  bool set_brightness, int brightness, uint8_t prio) {
+  if (channel < 0 || channel >= controller->num_lights) {
+    LOG_ERR("Light for channel %d not configured.", channel);
+    return -EINVAL;
+  }
+
+  struct tx_cmd cmd = {
+      .prio = prio,
+      .channel = channel,
+      .state = state,
+      .set_brightness = set_brightness,
+      .brightness = brightness,
+  };
+
+  latency_mark(LAT_STAGE_QUEUED);
+  latency_handoff(&cmd.trace);
+  return tx_sched_submit(&cmd);
+}
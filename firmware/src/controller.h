@@ -2,6 +2,7 @@
 #define __CONTROLLER__
 #include <stdbool.h>
 #include <stdint.h>
+#include <zephyr/devicetree.h>
 #include <zephyr/kernel.h>
 #include <zephyr/zbus/zbus.h>
 
@@ -11,7 +12,22 @@
 #define CHANNEL_1 1
 #define CHANNEL_2 2
 #define CHANNEL_3 3
-#define CHANNEL_COUNT 4  // I only have 2 lights
+
+/**
+ * Logical lights, each one is a channel of one of the house codes, see
+ * lights.h. The MQTT topics number the lights, not the house channels.
+ * Lights in the devicetree size everything to exactly their number.
+ */
+#define GET_DT_LIGHT(node) +1
+#define GET_DT_HOUSE_LIGHTS(node)                                              \
+  DT_FOREACH_CHILD_STATUS_OKAY(node, GET_DT_LIGHT)
+
+#if DT_HAS_COMPAT_STATUS_OKAY(getsmart_get_house)
+#define CHANNEL_COUNT                                                          \
+  (0 DT_FOREACH_STATUS_OKAY(getsmart_get_house, GET_DT_HOUSE_LIGHTS))
+#else
+#define CHANNEL_COUNT CONFIG_GETSMART_MAX_LIGHTS
+#endif
 
 /** Controller Operations (as transmitted by the remote switch) */
 #define OP_ON 0
@@ -32,7 +48,8 @@
  * of 1s that get transmitted before another 0 gets transmitted.
  *
  * Lists all the Controller Operations for each channel beginning
- * at OP_ON for CHANNEL_0
+ * at OP_ON for CHANNEL_0. This is house code 0, the one used when no
+ * house codes have been configured.
  */
 // clang-format off
 #define PULSESEQ {4, 4, 3, 1, 2, 0, 0, \
@@ -60,18 +77,46 @@ struct light_state {
   int brightness;
 };
 
+/* A light's part in a scene, brightness 0 leaves its level as it is */
+struct scene_target {
+  uint8_t light;
+  uint8_t state;
+  uint8_t brightness;
+};
+
+struct state_update {
+  int channel;
+  int state;
+  int brightness;
+  /* Per channel sequence number, increases with every update */
+  uint32_t seq;
+  /* When the command that caused it was received, 0 if not from MQTT */
+  uint64_t t_rx;
+};
+
 typedef struct controller {
   struct zbus_channel *state_update_channel;
   char* device_id;
   uint8_t num_lights;
   struct light_state state[CHANNEL_COUNT];
+  /* Serialise changes to a light's state[], from the radio TX threads
+   * and from the wall remote */
+  struct k_mutex light_lock[CHANNEL_COUNT];
+
+  /* Latest update per channel, so it can be re-delivered if the zbus
+   * queue overflows. Guarded by state_lock. */
+  struct k_spinlock state_lock;
+  struct state_update latest[CHANNEL_COUNT];
+  uint32_t delivered_seq[CHANNEL_COUNT];
+  uint32_t state_lost;
+  /* Uptime of each light's last change, in ms, 0 while its state is
+   * unknown: nothing has been sent to it or heard from its remote */
+  int64_t changed_at[CHANNEL_COUNT];
+  atomic_t state_overflows;
 } controller_t;
 
-struct state_update {
-  int channel;
-  int state;
-  int brightness;
-};
+/* Whether a radio is wanted for something more important */
+typedef bool (*controller_preempt_t)(uint8_t radio);
 
 typedef struct f_sum {
   sys_snode_t snode;
@@ -82,8 +127,42 @@ typedef struct f_sum {
 extern "C" {
 #endif
 
+/* 'prio' is a tx_prio, see tx_sched.h */
 int request_state(struct controller *controller, int channel, int state,
-                  bool set_brightness, int brightness);
+                  bool set_brightness, int brightness, uint8_t prio);
+int controller_execute(struct controller *controller, uint8_t radio,
+                       int channel, int state, bool set_brightness,
+                       int brightness, controller_preempt_t preempt);
+int controller_rehome(struct controller *controller, uint8_t radio,
+                      int channel, controller_preempt_t preempt,
+                      struct light_state *before);
+uint32_t controller_rehome_airtime_us(struct controller *controller,
+                                      int channel);
+uint32_t controller_airtime_us(struct controller *controller, int channel,
+                               int state, bool set_brightness,
+                               int brightness);
+int controller_scene(struct controller *controller, uint8_t radio,
+                     const struct scene_target *targets, int count,
+                     uint32_t *frames);
+uint32_t controller_scene_frames(struct controller *controller,
+                                 const struct scene_target *targets, int count,
+                                 uint32_t *individual);
+
+uint32_t controller_code_word(uint8_t channel, uint8_t op, uint8_t pulse_no);
+/* Frame for a channel/op, free it with mem_frame_free() */
+uint8_t get_radio_msg(uint8_t channel, uint8_t op, uint8_t pulse_no,
+                      uint8_t **msg);
+
+/* A change made by the wall remote, call with the light's lock held */
+void controller_track_state(struct controller *controller, int channel,
+                            int state, int brightness);
+
+bool controller_state_claim(struct controller *controller,
+                            const struct state_update *su);
+bool controller_state_next_lost(struct controller *controller,
+                                struct state_update *su);
+void controller_state_current(struct controller *controller, int channel,
+                              struct state_update *su);
 
 #ifdef __cplusplus
 }
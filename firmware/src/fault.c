@@ -0,0 +1,95 @@
+#include "fault.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/random.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/atomic.h>
+
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+static const char *const fault_names[FAULT_POINT_COUNT] = {
+    [FAULT_RADIO_TX] = "radio_tx",
+    [FAULT_MQTT_DROP] = "mqtt_drop",
+};
+
+static uint32_t fault_permille[FAULT_POINT_COUNT] = {
+    [FAULT_RADIO_TX] = CONFIG_GETSMART_FAULT_RADIO_TX_PERMILLE,
+    [FAULT_MQTT_DROP] = CONFIG_GETSMART_FAULT_MQTT_DROP_PERMILLE,
+};
+
+static atomic_t fault_hits[FAULT_POINT_COUNT];
+
+bool fault_inject(enum fault_point point)
+{
+  uint32_t permille = fault_permille[point];
+
+  if (permille == 0 || (sys_rand32_get() % 1000U) >= permille)
+  {
+    return false;
+  }
+  atomic_inc(&fault_hits[point]);
+  return true;
+}
+
+static int fault_stats_format(char *buf, size_t len)
+{
+  int n = 0;
+
+  for (int i = 0; i < FAULT_POINT_COUNT && n < len; i++)
+  {
+    n += snprintf(buf + n, len - n, "%s\"%s\":{\"permille\":%u,\"hits\":%u}",
+                  (i > 0) ? "," : "", fault_names[i], fault_permille[i],
+                  (unsigned int)atomic_get(&fault_hits[i]));
+  }
+  return n;
+}
+
+static int cmd_fault(const struct shell *sh, size_t argc, char **argv)
+{
+  if (argc == 3)
+  {
+    for (int i = 0; i < FAULT_POINT_COUNT; i++)
+    {
+      if (strcmp(argv[1], fault_names[i]) == 0)
+      {
+        fault_permille[i] = MIN(strtoul(argv[2], NULL, 10), 1000U);
+        return 0;
+      }
+    }
+    shell_error(sh, "Unknown fault point %s", argv[1]);
+    return -EINVAL;
+  }
+
+  shell_print(sh, "%-10s %8s %8s", "fault", "permille", "hits");
+  for (int i = 0; i < FAULT_POINT_COUNT; i++)
+  {
+    shell_print(sh, "%-10s %8u %8u", fault_names[i], fault_permille[i],
+                (unsigned int)atomic_get(&fault_hits[i]));
+  }
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), fault, NULL,
+                 "Fault injection rates [radio_tx|mqtt_drop <permille>]",
+                 cmd_fault, 1, 2);
+
+static struct stats_provider fault_stats = {
+    .name = "fault",
+    .format = fault_stats_format,
+};
+
+static int fault_init(void)
+{
+  LOG_WRN("Fault injection enabled");
+  stats_register(&fault_stats);
+  return 0;
+}
+
+SYS_INIT(fault_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
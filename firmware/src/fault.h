@@ -0,0 +1,39 @@
+#ifndef __GET_FAULT__
+#define __GET_FAULT__
+#include <stdbool.h>
+
+/**
+ * Points where CONFIG_GETSMART_FAULT_INJECTION can force a failure, each
+ * fires at random with its own rate in parts per thousand. Without the
+ * option fault_inject() is always false and compiles away.
+ */
+enum fault_point {
+  FAULT_RADIO_TX,   /* A frame is not put on air */
+  FAULT_MQTT_DROP,  /* The broker connection is aborted after a PUBLISH */
+  FAULT_POINT_COUNT
+};
+
+#if defined(CONFIG_GETSMART_FAULT_INJECTION)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    bool fault_inject(enum fault_point point);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline bool fault_inject(enum fault_point point)
+{
+  (void)point;
+  return false;
+}
+
+#endif
+
+#endif /*__GET_FAULT__*/
@@ -0,0 +1,246 @@
+#include "get_model.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+#include "lights.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+/**
+ * A dim step is a pair of frames, the pulse 0 frame (shared by every
+ * channel of a house code) followed by the channel's pulse 1 frame.
+ * Steps go up, unless a pair follows the previous one without the
+ * inter-step pause, which the receiver takes as "reverse": the earlier
+ * pair only selected the direction. This is the behaviour ctlr_dim_down() relies on.
+ */
+#define MODEL_REVERSE_GAP_US 2000
+#define MODEL_BURST_GAP_US 500000
+
+struct model_code {
+  uint32_t code;
+  uint8_t channel;
+  uint8_t op;
+  uint8_t pulse_no;
+};
+
+/* Every code word the controller can send, sorted by code word. Lights
+ * of one house code share the pulse 0 code, those entries are adjacent. */
+static struct model_code codes[CHANNEL_COUNT * 4];
+static size_t num_codes;
+
+static void model_add_code(uint8_t channel, uint8_t op, uint8_t pulse_no)
+{
+  codes[num_codes].code = controller_code_word(channel, op, pulse_no);
+  codes[num_codes].channel = channel;
+  codes[num_codes].op = op;
+  codes[num_codes].pulse_no = pulse_no;
+  num_codes++;
+}
+
+static int model_code_cmp(const void *a, const void *b)
+{
+  uint32_t ca = ((const struct model_code *)a)->code;
+  uint32_t cb = ((const struct model_code *)b)->code;
+
+  return (ca > cb) - (ca < cb);
+}
+
+/* First entry for the code word, num_codes if there is none */
+static size_t model_find(uint32_t code)
+{
+  size_t lo = 0;
+  size_t hi = num_codes;
+
+  while (lo < hi)
+  {
+    size_t mid = lo + (hi - lo) / 2;
+
+    if (codes[mid].code < code)
+    {
+      lo = mid + 1;
+    }
+    else
+    {
+      hi = mid;
+    }
+  }
+  return (lo < num_codes && codes[lo].code == code) ? lo : num_codes;
+}
+
+void get_model_reset(struct get_model *model)
+{
+  k_spinlock_key_t key = k_spin_lock(&model->lock);
+
+  /* The lights are fixed from boot, built once for every model */
+  if (num_codes == 0)
+  {
+    for (int ch = 0; ch < lights_count(); ch++)
+    {
+      model_add_code(ch, OP_ON, 0);
+      model_add_code(ch, OP_OFF, 0);
+      model_add_code(ch, OP_DIM_DOWN, 0);
+      model_add_code(ch, OP_DIM_DOWN, 1);
+    }
+    qsort(codes, num_codes, sizeof(codes[0]), model_code_cmp);
+  }
+  memset(model->lights, 0, sizeof(model->lights));
+  memset(&model->stats, 0, sizeof(model->stats));
+  k_spin_unlock(&model->lock, key);
+}
+
+/**
+ * The light a code word is for, -EAGAIN for a dim pulse 0 (which is for
+ * every light of its house code) and -ENOENT if it is not one of ours.
+ */
+int get_model_lookup(uint32_t code)
+{
+  size_t i = model_find(code);
+
+  if (i == num_codes)
+  {
+    return -ENOENT;
+  }
+  if (codes[i].op == OP_DIM_DOWN && codes[i].pulse_no == 0)
+  {
+    return -EAGAIN;
+  }
+  return codes[i].channel;
+}
+
+/* Pair gap is from the end of the last pair to the start of this one */
+static void model_dim_pair(struct get_model *model, struct model_light *l,
+                           uint64_t t_end)
+{
+  uint64_t gap = l->armed_at - l->last_pair_end;
+
+  if (!l->state.state)
+  {
+    return;
+  }
+
+  if (l->last_pair_end != 0 && gap < MODEL_REVERSE_GAP_US)
+  {
+    /* The previous pair selected the direction, it was not a step */
+    l->state.brightness -= l->last_step;
+    l->dir = -l->dir;
+    model->stats.reversals++;
+  }
+  else if (l->last_pair_end == 0 || gap > MODEL_BURST_GAP_US)
+  {
+    l->dir = 1;
+  }
+
+  int level = CLAMP(l->state.brightness + l->dir, 1, DIM_LEVELS);
+
+  l->last_step = level - l->state.brightness;
+  l->state.brightness = level;
+  l->last_pair_end = t_end;
+  model->stats.dim_steps++;
+}
+
+/**
+ * Apply a frame to the receivers. Returns the channel whose light
+ * changed, -EAGAIN if the frame changed no light (i.e. it only armed a
+ * dim step) and -ENOENT if it is not one of our codes.
+ */
+int get_model_rx(struct get_model *model, const uint8_t *msg, uint8_t len,
+                 uint64_t t_start_us, uint64_t t_end_us)
+{
+  if (len < 10)
+  {
+    return -EINVAL;
+  }
+
+  uint32_t code = ((uint32_t)msg[6] << 24) | ((uint32_t)msg[7] << 16) |
+                  ((uint32_t)msg[8] << 8) | msg[9];
+  int ret = -ENOENT;
+  k_spinlock_key_t key = k_spin_lock(&model->lock);
+
+  model->stats.frames++;
+  for (size_t i = model_find(code); i < num_codes && codes[i].code == code;
+       i++)
+  {
+    const struct model_code *c = &codes[i];
+    struct model_light *l = &model->lights[c->channel];
+    struct light_state before = l->state;
+
+    ret = -EAGAIN;
+
+    if (c->op == OP_ON)
+    {
+      l->state.state = STATE_ON;
+      l->state.brightness = DIM_LEVELS;
+    }
+    else if (c->op == OP_OFF)
+    {
+      l->state.state = STATE_OFF;
+      l->state.brightness = 0;
+    }
+    else if (c->pulse_no == 0)
+    {
+      /* Shared by every channel of the house code, arms them all */
+      l->armed = true;
+      l->armed_at = t_start_us;
+      continue;
+    }
+    else if (l->armed)
+    {
+      l->armed = false;
+      model_dim_pair(model, l, t_end_us);
+    }
+    if (l->state.state != before.state ||
+        l->state.brightness != before.brightness)
+    {
+      ret = c->channel;
+    }
+    /* ON/OFF and pulse 1 frames are unique to a channel */
+    break;
+  }
+
+  if (ret == -ENOENT)
+  {
+    model->stats.unknown++;
+  }
+  k_spin_unlock(&model->lock, key);
+  return ret;
+}
+
+int get_model_state(struct get_model *model, int channel,
+                    struct light_state *state)
+{
+  if (channel < 0 || channel >= CHANNEL_COUNT)
+  {
+    return -EINVAL;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&model->lock);
+  *state = model->lights[channel].state;
+  k_spin_unlock(&model->lock, key);
+  return 0;
+}
+
+/* Bring a light in line with what is known from elsewhere */
+int get_model_set_state(struct get_model *model, int channel,
+                        const struct light_state *state)
+{
+  if (channel < 0 || channel >= CHANNEL_COUNT)
+  {
+    return -EINVAL;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&model->lock);
+  model->lights[channel].state = *state;
+  k_spin_unlock(&model->lock, key);
+  return 0;
+}
+
+void get_model_get_stats(struct get_model *model, struct get_model_stats *out)
+{
+  k_spinlock_key_t key = k_spin_lock(&model->lock);
+  *out = model->stats;
+  k_spin_unlock(&model->lock, key);
+}
@@ -0,0 +1,62 @@
+#ifndef __GET_MODEL__
+#define __GET_MODEL__
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+#include "controller.h"
+
+/**
+ * Software model of the GET receivers, fed every frame the mock radio
+ * puts on air. Frames are decoded back to channel/op and the on/off
+ * state and dim level of each receiver is tracked, so the result of a
+ * command can be checked without the real lights.
+ */
+struct get_model_stats {
+  uint32_t frames;
+  uint32_t unknown;
+  uint32_t dim_steps;
+  uint32_t reversals;
+};
+
+struct model_light {
+  struct light_state state;
+  int dir;
+  bool armed;
+  uint64_t armed_at;
+  uint64_t last_pair_end;
+  int last_step;
+};
+
+/**
+ * One set of receivers. The mock radio models the lights it talks to,
+ * the remote RX decoder models the same lights from what the wall
+ * remote sends.
+ */
+struct get_model {
+  struct model_light lights[CHANNEL_COUNT];
+  struct get_model_stats stats;
+  struct k_spinlock lock;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void get_model_reset(struct get_model *model);
+    int get_model_rx(struct get_model *model, const uint8_t *msg, uint8_t len,
+                     uint64_t t_start_us, uint64_t t_end_us);
+    int get_model_lookup(uint32_t code);
+    int get_model_state(struct get_model *model, int channel,
+                        struct light_state *state);
+    int get_model_set_state(struct get_model *model, int channel,
+                            const struct light_state *state);
+    void get_model_get_stats(struct get_model *model,
+                             struct get_model_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_MODEL__*/
@@ -0,0 +1,274 @@
+#include "latency.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+/**
+ * Log-linear buckets: values below 2^LAT_MIN_SHIFT us share bucket 0,
+ * then every power of two is split into 2^LAT_SUB_BITS buckets, so a
+ * percentile is at most 25% above the real value. The last bucket
+ * (~268 s) catches everything larger.
+ */
+#define LAT_MIN_SHIFT 4
+#define LAT_SUB_BITS 2
+#define LAT_SUB_COUNT BIT(LAT_SUB_BITS)
+#define LAT_BUCKETS 96
+
+struct lat_hist {
+  uint32_t buckets[LAT_BUCKETS];
+  uint32_t count;
+  uint32_t max;
+};
+
+static const char *const stage_names[LAT_STAGE_COUNT] = {
+    "rx", "parsed", "queued", "first_tx", "last_tx", "zbus", "state_sent",
+};
+
+static struct lat_hist hists[LAT_STAGE_COUNT];
+static struct k_spinlock hists_lock;
+
+/* The trace of the calling thread, NULL if it is not traced */
+static inline struct lat_trace *current_trace(void)
+{
+  return (struct lat_trace *)k_thread_custom_data_get();
+}
+
+static uint32_t bucket_of(uint64_t us)
+{
+  if (us < BIT(LAT_MIN_SHIFT))
+  {
+    return 0;
+  }
+
+  uint32_t msb = 63 - __builtin_clzll(us);
+  uint32_t sub = (us >> (msb - LAT_SUB_BITS)) & (LAT_SUB_COUNT - 1);
+  uint32_t idx = ((msb - LAT_MIN_SHIFT) << LAT_SUB_BITS) + sub + 1;
+
+  return MIN(idx, LAT_BUCKETS - 1);
+}
+
+/* Upper bound of a bucket in microseconds */
+static uint32_t bucket_upper(uint32_t idx)
+{
+  if (idx == 0)
+  {
+    return BIT(LAT_MIN_SHIFT);
+  }
+
+  uint32_t msb = ((idx - 1) >> LAT_SUB_BITS) + LAT_MIN_SHIFT;
+  uint32_t sub = (idx - 1) & (LAT_SUB_COUNT - 1);
+
+  return (LAT_SUB_COUNT + sub + 1) << (msb - LAT_SUB_BITS);
+}
+
+void latency_record(enum lat_stage stage, uint64_t start)
+{
+  if (start == 0 || stage >= LAT_STAGE_COUNT)
+  {
+    return;
+  }
+
+  uint64_t us = latency_now() - start;
+  k_spinlock_key_t key = k_spin_lock(&hists_lock);
+  struct lat_hist *h = &hists[stage];
+
+  h->buckets[bucket_of(us)]++;
+  h->count++;
+  h->max = MAX(h->max, (uint32_t)MIN(us, UINT32_MAX));
+  k_spin_unlock(&hists_lock, key);
+}
+
+void latency_attach(struct lat_trace *trace)
+{
+  memset(trace, 0, sizeof(*trace));
+  k_thread_custom_data_set(trace);
+}
+
+void latency_begin(void)
+{
+  struct lat_trace *trace = current_trace();
+
+  if (trace == NULL)
+  {
+    return;
+  }
+  memset(trace, 0, sizeof(*trace));
+  trace->t[LAT_STAGE_RX] = latency_now();
+}
+
+void latency_mark(enum lat_stage stage)
+{
+  struct lat_trace *trace = current_trace();
+
+  if (trace == NULL || trace->t[LAT_STAGE_RX] == 0 || stage >= LAT_STAGE_COUNT)
+  {
+    return;
+  }
+  /* The first frame only counts once, later stages keep the last mark */
+  if (stage == LAT_STAGE_FIRST_TX && trace->t[stage] != 0)
+  {
+    return;
+  }
+  trace->t[stage] = latency_now();
+}
+
+uint64_t latency_current(void)
+{
+  struct lat_trace *trace = current_trace();
+
+  return (trace == NULL) ? 0 : trace->t[LAT_STAGE_RX];
+}
+
+void latency_end(void)
+{
+  struct lat_trace *trace = current_trace();
+
+  if (trace == NULL || trace->t[LAT_STAGE_RX] == 0)
+  {
+    return;
+  }
+
+  uint64_t start = trace->t[LAT_STAGE_RX];
+  k_spinlock_key_t key = k_spin_lock(&hists_lock);
+  for (int stage = LAT_STAGE_PARSED; stage < LAT_STAGE_STATE_SENT; stage++)
+  {
+    if (trace->t[stage] == 0)
+    {
+      continue;
+    }
+
+    uint64_t us = trace->t[stage] - start;
+    struct lat_hist *h = &hists[stage];
+
+    h->buckets[bucket_of(us)]++;
+    h->count++;
+    h->max = MAX(h->max, (uint32_t)MIN(us, UINT32_MAX));
+  }
+  k_spin_unlock(&hists_lock, key);
+
+  trace->t[LAT_STAGE_RX] = 0;
+}
+
+/* Move the command to another thread, this one stops tracing it */
+void latency_handoff(struct lat_trace *out)
+{
+  struct lat_trace *trace = current_trace();
+
+  if (trace == NULL)
+  {
+    memset(out, 0, sizeof(*out));
+    return;
+  }
+  *out = *trace;
+  trace->t[LAT_STAGE_RX] = 0;
+}
+
+void latency_resume(const struct lat_trace *in)
+{
+  struct lat_trace *trace = current_trace();
+
+  if (trace != NULL)
+  {
+    *trace = *in;
+  }
+}
+
+uint32_t latency_percentile(enum lat_stage stage, uint32_t pct)
+{
+  uint32_t result = 0;
+  k_spinlock_key_t key = k_spin_lock(&hists_lock);
+  struct lat_hist *h = &hists[stage];
+
+  if (h->count > 0)
+  {
+    uint32_t target = DIV_ROUND_UP(h->count * (uint64_t)pct, 100U);
+    uint32_t seen = 0;
+
+    for (uint32_t i = 0; i < LAT_BUCKETS; i++)
+    {
+      seen += h->buckets[i];
+      if (seen >= target)
+      {
+        result = MIN(bucket_upper(i), h->max);
+        break;
+      }
+    }
+  }
+  k_spin_unlock(&hists_lock, key);
+  return result;
+}
+
+void latency_reset(void)
+{
+  k_spinlock_key_t key = k_spin_lock(&hists_lock);
+  memset(hists, 0, sizeof(hists));
+  k_spin_unlock(&hists_lock, key);
+}
+
+static int latency_stats_format(char *buf, size_t len)
+{
+  int n = snprintf(buf, len, "\"unit\":\"us\",\"stages\":{");
+
+  for (int stage = LAT_STAGE_PARSED; stage < LAT_STAGE_COUNT && n < len;
+       stage++)
+  {
+    n += snprintf(buf + n, len - n,
+                  "%s\"%s\":{\"n\":%u,\"p50\":%u,\"p95\":%u,\"p99\":%u,"
+                  "\"max\":%u}",
+                  (stage > LAT_STAGE_PARSED) ? "," : "", stage_names[stage],
+                  hists[stage].count, latency_percentile(stage, 50),
+                  latency_percentile(stage, 95), latency_percentile(stage, 99),
+                  hists[stage].max);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "}");
+  }
+  return n;
+}
+
+static int cmd_latency(const struct shell *sh, size_t argc, char **argv)
+{
+  if (argc > 1 && strcmp(argv[1], "reset") == 0)
+  {
+    latency_reset();
+    shell_print(sh, "Latency histograms reset");
+    return 0;
+  }
+
+  shell_print(sh, "%-10s %8s %10s %10s %10s %10s", "stage (us)", "count",
+              "p50", "p95", "p99", "max");
+  for (int stage = LAT_STAGE_PARSED; stage < LAT_STAGE_COUNT; stage++)
+  {
+    shell_print(sh, "%-10s %8u %10u %10u %10u %10u", stage_names[stage],
+                hists[stage].count, latency_percentile(stage, 50),
+                latency_percentile(stage, 95), latency_percentile(stage, 99),
+                hists[stage].max);
+  }
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), latency, NULL,
+                 "Command latency percentiles since receipt [reset]",
+                 cmd_latency, 1, 1);
+
+static struct stats_provider latency_stats = {
+    .name = "latency",
+    .format = latency_stats_format,
+};
+
+static int latency_init(void)
+{
+  stats_register(&latency_stats);
+  return 0;
+}
+
+SYS_INIT(latency_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
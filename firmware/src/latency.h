@@ -0,0 +1,64 @@
+#ifndef __GET_LATENCY__
+#define __GET_LATENCY__
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+/**
+ * Stages of a command, each is measured from the time the MQTT PUBLISH
+ * was received (LAT_STAGE_RX).
+ */
+enum lat_stage {
+  LAT_STAGE_RX,         /* PUBLISH received by mqtt_input() */
+  LAT_STAGE_PARSED,     /* JSON payload parsed */
+  LAT_STAGE_QUEUED,     /* Handed to the controller / radio */
+  LAT_STAGE_FIRST_TX,   /* First frame on air */
+  LAT_STAGE_LAST_TX,    /* Last frame done */
+  LAT_STAGE_ZBUS,       /* State update published on the zbus */
+  LAT_STAGE_STATE_SENT, /* MQTT state PUBLISH sent */
+  LAT_STAGE_COUNT
+};
+
+/* Stage timestamps of one command, 0 for stages not reached */
+struct lat_trace {
+  uint64_t t[LAT_STAGE_COUNT];
+};
+
+/* Monotonic timestamp in microseconds */
+static inline uint64_t latency_now(void)
+{
+#if defined(CONFIG_TIMER_HAS_64BIT_CYCLE_COUNTER)
+  return k_cyc_to_us_floor64(k_cycle_get_64());
+#else
+  return k_ticks_to_us_floor64(k_uptime_ticks());
+#endif
+}
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /**
+     * Trace of the command being handled by the calling thread. Only
+     * threads with a trace attached are traced, a command moves between
+     * threads with latency_handoff() and latency_resume().
+     */
+    void latency_attach(struct lat_trace *trace);
+    void latency_begin(void);
+    void latency_mark(enum lat_stage stage);
+    uint64_t latency_current(void);
+    void latency_end(void);
+    void latency_handoff(struct lat_trace *out);
+    void latency_resume(const struct lat_trace *in);
+
+    /* Record a stage of a command that started at 'start' */
+    void latency_record(enum lat_stage stage, uint64_t start);
+
+    uint32_t latency_percentile(enum lat_stage stage, uint32_t pct);
+    void latency_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_LATENCY__*/
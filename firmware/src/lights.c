@@ -0,0 +1,455 @@
+#include "lights.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "codec.h"
+#include "config_mgr.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define DEFAULT_LIGHT_NAME "Get Smart Light  - Channel %d"
+
+static const uint8_t default_pulses[] = PULSESEQ;
+
+#define DT_DRV_COMPAT getsmart_get_house
+#define LIGHTS_FROM_DT DT_HAS_COMPAT_STATUS_OKAY(DT_DRV_COMPAT)
+
+#if LIGHTS_FROM_DT
+BUILD_ASSERT(DT_NUM_INST_STATUS_OKAY(DT_DRV_COMPAT) <= HOUSE_COUNT,
+             "More house codes in DT than CONFIG_GETSMART_MAX_HOUSES");
+BUILD_ASSERT(CHANNEL_COUNT > 0, "No lights under the DT house codes");
+
+#define HOUSE_ROW_BYTES (ROWS_PER_CHANNEL * PLUSESEQ_SIZE)
+
+/* The rows of each house code that has them */
+#define DT_HOUSE_ROWS(inst)                                                    \
+  IF_ENABLED(DT_INST_NODE_HAS_PROP(inst, rows),                                \
+             (static const uint8_t house_rows_##inst[] =                       \
+                  DT_INST_PROP(inst, rows);                                    \
+              BUILD_ASSERT(sizeof(house_rows_##inst) % HOUSE_ROW_BYTES == 0 && \
+                               sizeof(house_rows_##inst) <=                    \
+                                   HOUSE_ROWS * PLUSESEQ_SIZE,                 \
+                           "House code rows are 6 rows of 7 per channel");))
+DT_INST_FOREACH_STATUS_OKAY(DT_HOUSE_ROWS)
+
+struct dt_house {
+  const uint8_t *rows;
+  uint8_t len;
+  bool legacy;
+  uint8_t codec;
+};
+
+/* The binding's codec enum is in CODEC_LIST order */
+#define DT_HOUSE(inst)                                                         \
+  [inst] = COND_CODE_1(                                                        \
+      DT_INST_NODE_HAS_PROP(inst, rows),                                       \
+      ({house_rows_##inst, sizeof(house_rows_##inst),                          \
+        DT_INST_PROP(inst, legacy_rows), DT_INST_ENUM_IDX(inst, codec)}),      \
+      ({NULL, 0, true, DT_INST_ENUM_IDX(inst, codec)})),
+
+static const struct dt_house dt_houses[] = {
+    DT_INST_FOREACH_STATUS_OKAY(DT_HOUSE)};
+
+#define DT_LIGHT_NAME(node) DT_PROP_OR(node, light_name, "")
+#define DT_LIGHT(node, inst)                                                   \
+  {.house = inst,                                                              \
+   .channel = DT_PROP(node, channel),                                          \
+   .name = DT_LIGHT_NAME(node)},
+#define DT_HOUSE_LIGHTS(inst)                                                  \
+  DT_INST_FOREACH_CHILD_STATUS_OKAY_VARGS(inst, DT_LIGHT, inst)
+
+static const struct light_cfg dt_lights[] = {
+    DT_INST_FOREACH_STATUS_OKAY(DT_HOUSE_LIGHTS)};
+
+#define DT_LIGHT_CHECK(node)                                                   \
+  BUILD_ASSERT(sizeof(DT_LIGHT_NAME(node)) <= LIGHT_NAME_MAXLEN,               \
+               "light-name too long");                                         \
+  BUILD_ASSERT(DT_PROP(node, channel) < HOUSE_CHANNEL_MAX,                     \
+               "A house code has 4 channels");
+#define DT_HOUSE_CHECK(inst) DT_INST_FOREACH_CHILD_STATUS_OKAY(inst, DT_LIGHT_CHECK)
+DT_INST_FOREACH_STATUS_OKAY(DT_HOUSE_CHECK)
+#endif
+
+/* The config, as loaded and as edited from the shell */
+static struct house_cfg houses[HOUSE_COUNT];
+/* Not kept in config, house codes there are all GET ones */
+static uint8_t house_codecs[HOUSE_COUNT];
+static int num_houses;
+static struct light_cfg light_cfgs[CHANNEL_COUNT];
+static int num_light_cfgs;
+
+/* The lights in use, fixed from boot */
+static struct light lights[CHANNEL_COUNT];
+static int num_lights;
+
+static uint32_t house_code_word(int h, int row)
+{
+  const struct house_cfg *house = &houses[h];
+  uint8_t len_seq = (house->mode == HOUSE_MODE_LEGACY) ? house->rows[0][0]
+                                                       : house->rows[row][0];
+
+  return codec_code_word(house_codecs[h], &house->rows[row][1],
+                         MIN(len_seq, PLUSESEQ_SIZE - 1));
+}
+
+/* House code 0 is the compiled in table */
+static void house_default(struct house_cfg *house)
+{
+  memset(house, 0, sizeof(*house));
+  house->mode = HOUSE_MODE_LEGACY;
+  house->channels = sizeof(default_pulses) / (ROWS_PER_CHANNEL * PLUSESEQ_SIZE);
+  memcpy(house->rows, default_pulses, sizeof(default_pulses));
+}
+
+#if LIGHTS_FROM_DT
+/* The house codes and lights in the devicetree, fixed at build time */
+static void config_load(void)
+{
+  for (int h = 0; h < ARRAY_SIZE(dt_houses); h++)
+  {
+    const struct dt_house *dh = &dt_houses[h];
+
+    house_codecs[h] = dh->codec;
+    if (dh->rows == NULL)
+    {
+      house_default(&houses[h]);
+      continue;
+    }
+    memset(&houses[h], 0, sizeof(houses[h]));
+    houses[h].mode = dh->legacy ? HOUSE_MODE_LEGACY : HOUSE_MODE_ROWS;
+    houses[h].channels = dh->len / HOUSE_ROW_BYTES;
+    memcpy(houses[h].rows, dh->rows, dh->len);
+  }
+  num_houses = ARRAY_SIZE(dt_houses);
+  memcpy(light_cfgs, dt_lights, sizeof(dt_lights));
+  num_light_cfgs = ARRAY_SIZE(dt_lights);
+}
+#else
+static void config_load(void)
+{
+  ssize_t rc = cfg_get_value(CFG_HOUSES_ID, houses, sizeof(houses));
+  if (rc > 0 && rc <= sizeof(houses) && (rc % sizeof(houses[0])) == 0)
+  {
+    num_houses = rc / sizeof(houses[0]);
+  }
+  else
+  {
+    house_default(&houses[0]);
+    num_houses = 1;
+  }
+
+  rc = cfg_get_value(CFG_LIGHTS_ID, light_cfgs, sizeof(light_cfgs));
+  if (rc > 0 && rc <= sizeof(light_cfgs) && (rc % sizeof(light_cfgs[0])) == 0)
+  {
+    num_light_cfgs = rc / sizeof(light_cfgs[0]);
+  }
+  else
+  {
+    /* The two lights the controller always drove */
+    memset(light_cfgs, 0, sizeof(light_cfgs));
+    light_cfgs[0].channel = 0;
+    light_cfgs[1].channel = 1;
+    num_light_cfgs = 2;
+  }
+}
+#endif
+
+/**
+ * Load the house codes and lights and generate every code word. Returns
+ * the number of lights, ones that refer to a missing house code or
+ * channel are left out.
+ */
+int lights_init(void)
+{
+  config_load();
+
+  num_lights = 0;
+  for (int i = 0; i < num_light_cfgs; i++)
+  {
+    const struct light_cfg *lc = &light_cfgs[i];
+    struct light *l = &lights[num_lights];
+
+    if (lc->house >= num_houses ||
+        lc->channel >= MIN(houses[lc->house].channels, HOUSE_CHANNEL_MAX))
+    {
+      LOG_ERR("Light %d: no channel %d in house code %d, skipped", i,
+              lc->channel, lc->house);
+      continue;
+    }
+
+    l->cfg = *lc;
+    l->cfg.name[LIGHT_NAME_MAXLEN - 1] = '\0';
+    l->codec = house_codecs[lc->house];
+    for (int row = 0; row < ROWS_PER_CHANNEL; row++)
+    {
+      l->code[row] =
+          house_code_word(lc->house, lc->channel * ROWS_PER_CHANNEL + row);
+    }
+    num_lights++;
+  }
+
+  LOG_INF("%d lights on %d house codes", num_lights, num_houses);
+  return num_lights;
+}
+
+int lights_count(void) { return num_lights; }
+
+const struct light *lights_get(int id)
+{
+  if (id < 0 || id >= num_lights)
+  {
+    return NULL;
+  }
+  return &lights[id];
+}
+
+/* Display name, the HA entity name */
+int lights_name(int id, char *buf, size_t len)
+{
+  const struct light *l = lights_get(id);
+
+  if (l != NULL && l->cfg.name[0] != '\0')
+  {
+    return snprintf(buf, len, "%s", l->cfg.name);
+  }
+  return snprintf(buf, len, DEFAULT_LIGHT_NAME, id);
+}
+
+/* Code word for an op of a light, 0 if there is no such light or op */
+uint32_t lights_code_word(int id, uint8_t op, uint8_t pulse_no)
+{
+  const struct light *l = lights_get(id);
+
+  if (l == NULL || op + pulse_no >= ROWS_PER_CHANNEL)
+  {
+    return 0;
+  }
+  return l->code[op + pulse_no];
+}
+
+/* Codec of a light, GET for no such light */
+uint8_t lights_codec(int id)
+{
+  const struct light *l = lights_get(id);
+
+  return (l != NULL) ? l->codec : CODEC_GET;
+}
+
+static int cmd_light_list(const struct shell *sh, size_t argc, char **argv)
+{
+  char name[LIGHT_NAME_MAXLEN + 32];
+
+  for (int i = 0; i < num_lights; i++)
+  {
+    const struct light *l = &lights[i];
+
+    lights_name(i, name, sizeof(name));
+    shell_print(sh, "%2d: house %d channel %d %s on 0x%08x off 0x%08x  %s", i,
+                l->cfg.house, l->cfg.channel, codec_name(l->codec),
+                l->code[OP_ON], l->code[OP_OFF], name);
+  }
+  if (num_light_cfgs != num_lights)
+  {
+    shell_print(sh, "%d configured, takes effect after a reboot",
+                num_light_cfgs);
+  }
+  return 0;
+}
+
+/* Lights in the devicetree can't be changed at runtime */
+static bool lights_fixed(const struct shell *sh)
+{
+  if (LIGHTS_FROM_DT)
+  {
+    shell_error(sh, "Lights and house codes are set in the devicetree");
+  }
+  return LIGHTS_FROM_DT;
+}
+
+static int cmd_light_add(const struct shell *sh, size_t argc, char **argv)
+{
+  struct light_cfg lc = {0};
+
+  if (lights_fixed(sh))
+  {
+    return -EPERM;
+  }
+
+  if (num_light_cfgs >= CHANNEL_COUNT)
+  {
+    shell_error(sh, "No room, CONFIG_GETSMART_MAX_LIGHTS is %d", CHANNEL_COUNT);
+    return -ENOMEM;
+  }
+
+  lc.house = atoi(argv[1]);
+  lc.channel = atoi(argv[2]);
+  if (argc > 3)
+  {
+    strncpy(lc.name, argv[3], sizeof(lc.name) - 1);
+  }
+  if (lc.house >= num_houses || lc.channel >= houses[lc.house].channels)
+  {
+    shell_error(sh, "No channel %d in house code %d", lc.channel, lc.house);
+    return -EINVAL;
+  }
+
+  light_cfgs[num_light_cfgs++] = lc;
+  int rc = cfg_set_value(CFG_LIGHTS_ID, light_cfgs,
+                         num_light_cfgs * sizeof(light_cfgs[0]));
+  if (rc < 0)
+  {
+    num_light_cfgs--;
+    shell_error(sh, "Failed to save: %d", rc);
+    return rc;
+  }
+  shell_print(sh, "Light %d added, takes effect after a reboot",
+              num_light_cfgs - 1);
+  return 0;
+}
+
+static int cmd_light_clear(const struct shell *sh, size_t argc, char **argv)
+{
+  if (lights_fixed(sh))
+  {
+    return -EPERM;
+  }
+  /* A zero length write deletes the entry, the defaults apply again */
+  cfg_set_value(CFG_LIGHTS_ID, NULL, 0);
+  cfg_set_value(CFG_HOUSES_ID, NULL, 0);
+  shell_print(sh, "Lights and house codes back to the defaults after a reboot");
+  return 0;
+}
+
+static int cmd_house_list(const struct shell *sh, size_t argc, char **argv)
+{
+  for (int h = 0; h < num_houses; h++)
+  {
+    const struct house_cfg *house = &houses[h];
+
+    shell_print(sh, "house %d: %s, %d channels, %s rows", h,
+                codec_name(house_codecs[h]), house->channels,
+                (house->mode == HOUSE_MODE_LEGACY) ? "legacy" : "own length");
+    for (int row = 0; row < house->channels * ROWS_PER_CHANNEL; row++)
+    {
+      const uint8_t *r = house->rows[row];
+
+      shell_print(sh, "  %2d: %d, %d, %d, %d, %d, %d, %d  0x%08x", row, r[0],
+                  r[1], r[2], r[3], r[4], r[5], r[6],
+                  house_code_word(h, row));
+    }
+  }
+  return 0;
+}
+
+static int houses_save(const struct shell *sh)
+{
+  int rc = cfg_set_value(CFG_HOUSES_ID, houses, num_houses * sizeof(houses[0]));
+  if (rc < 0)
+  {
+    shell_error(sh, "Failed to save: %d", rc);
+    return rc;
+  }
+  shell_print(sh, "Saved, takes effect after a reboot");
+  return 0;
+}
+
+/* Set a row, a house code one past the last is added */
+static int cmd_house_row(const struct shell *sh, size_t argc, char **argv)
+{
+  int h = atoi(argv[1]);
+  int row = atoi(argv[2]);
+  int len = argc - 3;
+
+  if (lights_fixed(sh))
+  {
+    return -EPERM;
+  }
+  if (h < 0 || h > num_houses || h >= HOUSE_COUNT)
+  {
+    shell_error(sh, "House code %d can't be set, there are %d", h, num_houses);
+    return -EINVAL;
+  }
+  if (row < 0 || row >= HOUSE_ROWS || len > PLUSESEQ_SIZE - 1)
+  {
+    shell_error(sh, "Rows are 0 to %d, with up to %d runs", HOUSE_ROWS - 1,
+                PLUSESEQ_SIZE - 1);
+    return -EINVAL;
+  }
+
+  struct house_cfg *house = &houses[h];
+  if (h == num_houses)
+  {
+    memset(house, 0, sizeof(*house));
+    house->mode = HOUSE_MODE_ROWS;
+    num_houses++;
+  }
+
+  memset(house->rows[row], 0, PLUSESEQ_SIZE);
+  house->rows[row][0] = len;
+  for (int i = 0; i < len; i++)
+  {
+    house->rows[row][i + 1] = atoi(argv[i + 3]);
+  }
+  house->channels = MAX(house->channels, row / ROWS_PER_CHANNEL + 1);
+  return houses_save(sh);
+}
+
+static int cmd_house_mode(const struct shell *sh, size_t argc, char **argv)
+{
+  int h = atoi(argv[1]);
+
+  if (lights_fixed(sh))
+  {
+    return -EPERM;
+  }
+  if (h < 0 || h >= num_houses)
+  {
+    shell_error(sh, "No house code %d", h);
+    return -EINVAL;
+  }
+  if (strcmp(argv[2], "legacy") == 0)
+  {
+    houses[h].mode = HOUSE_MODE_LEGACY;
+  }
+  else if (strcmp(argv[2], "rows") == 0)
+  {
+    houses[h].mode = HOUSE_MODE_ROWS;
+  }
+  else
+  {
+    shell_error(sh, "Mode is legacy or rows");
+    return -EINVAL;
+  }
+  return houses_save(sh);
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    light_cmds,
+    SHELL_CMD(list, NULL, "Lights and their code words", cmd_light_list),
+    SHELL_CMD_ARG(add, NULL, "Add a light <house> <channel> [name]",
+                  cmd_light_add, 3, 1),
+    SHELL_CMD(clear, NULL, "Back to the default lights and house codes",
+              cmd_light_clear),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), light, &light_cmds, "Configured lights", cmd_light_list,
+                 1, 0);
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    house_cmds,
+    SHELL_CMD(list, NULL, "House code pulse tables", cmd_house_list),
+    SHELL_CMD_ARG(row, NULL, "Set a pulse row <house> <row> <runs...>",
+                  cmd_house_row, 4, PLUSESEQ_SIZE - 2),
+    SHELL_CMD_ARG(mode, NULL, "Row length mode <house> <legacy|rows>",
+                  cmd_house_mode, 3, 0),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), house, &house_cmds, "GET house codes", cmd_house_list,
+                 1, 0);
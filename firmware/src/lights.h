@@ -0,0 +1,71 @@
+#ifndef __GET_LIGHTS__
+#define __GET_LIGHTS__
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "controller.h"
+
+/**
+ * The lights driven by this controller. Each light is a channel of a
+ * GET house code, a house code being the pulse table of one remote
+ * (the PULSESEQ rows, as printed by tools/capture_decode). House codes
+ * and lights are loaded from config at boot, or come from the
+ * getsmart,get-house nodes of the devicetree when there are any. The
+ * code words of every light are generated at boot so a command only
+ * indexes the light table.
+ */
+#define HOUSE_CHANNEL_MAX 4
+#define HOUSE_ROWS (HOUSE_CHANNEL_MAX * ROWS_PER_CHANNEL)
+#define HOUSE_COUNT CONFIG_GETSMART_MAX_HOUSES
+
+#define LIGHT_NAME_MAXLEN 24
+
+/* How a house code's rows become code words */
+enum house_mode {
+  /* Every row takes the length of the first row, as the original
+   * controller did. Works for house code 0. */
+  HOUSE_MODE_LEGACY,
+  /* Each row has its own length, i.e. rows from capture_decode */
+  HOUSE_MODE_ROWS,
+};
+
+/* A house code as stored in config */
+struct house_cfg {
+  uint8_t mode;
+  uint8_t channels;
+  uint8_t rows[HOUSE_ROWS][PLUSESEQ_SIZE];
+};
+
+/* A light as stored in config, an empty name gets the default one */
+struct light_cfg {
+  uint8_t house;
+  uint8_t channel;
+  char name[LIGHT_NAME_MAXLEN];
+};
+
+struct light {
+  struct light_cfg cfg;
+  /* Protocol of the light's house code, a codec_id, see codec.h */
+  uint8_t codec;
+  /* Code word of each row of the light's channel */
+  uint32_t code[ROWS_PER_CHANNEL];
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int lights_init(void);
+    int lights_count(void);
+    const struct light *lights_get(int id);
+    int lights_name(int id, char *buf, size_t len);
+    uint32_t lights_code_word(int id, uint8_t op, uint8_t pulse_no);
+    uint8_t lights_codec(int id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_LIGHTS__*/
@@ -10,24 +10,79 @@
 
 #include "config_mgr.h"
 #include "controller.h"
+#include "lights.h"
 #include "mqtt_thread.h"
 #include "radio.h"
+#include "remote_rx.h"
+#include "scene.h"
+#include "tx_sched.h"
 #include "wifi.h"
 
-controller_t *controller;
+static controller_t controller_data;
+controller_t *controller = &controller_data;
 
 ZBUS_CHAN_DEFINE(chan_state_updates,   /* Name */
                  struct state_update,  /* Message type */
                  NULL,                 /* Validator */
                  NULL,                 /* User data */
                  ZBUS_OBSERVERS_EMPTY, /* observers */
-                 ZBUS_MSG_INIT(.channel = -1, .state = -1, .brightness = -1));
+                 ZBUS_MSG_INIT(.channel = -1, .state = -1, .brightness = -1,
+                               .seq = 0, .t_rx = 0));
 
 /* 1000 msec = 1 sec */
 #define WDT_FEED_INTERVAL_MS 1000
 
+/* Boards without a watchdog (i.e. native_sim) run without one */
+#define HAS_WATCHDOG DT_NODE_EXISTS(DT_ALIAS(watchdog0))
+
 LOG_MODULE_REGISTER(gs, CONFIG_GETSMART_LOG_LEVEL);
 
+#if HAS_WATCHDOG
+static const struct device *wdt = DEVICE_DT_GET(DT_ALIAS(watchdog0));
+static int wdt_channel_id;
+#endif
+
+static int watchdog_init(void)
+{
+#if HAS_WATCHDOG
+  struct wdt_timeout_cfg wdt_config = {
+      .window = {
+          .min = 0,
+          .max = 10000, // 10 seconds timeout
+      },
+      .callback = NULL, // NULL means system reset on timeout
+      .flags = WDT_FLAG_RESET_SOC,
+  };
+
+  if (!device_is_ready(wdt))
+  {
+    LOG_ERR("Watchdog device not ready");
+    return -1;
+  }
+
+  wdt_channel_id = wdt_install_timeout(wdt, &wdt_config);
+  if (wdt_channel_id < 0)
+  {
+    LOG_ERR("Watchdog install error");
+    return -1;
+  }
+
+  if (wdt_setup(wdt, 0) < 0)
+  {
+    LOG_ERR("Watchdog setup error");
+    return -1;
+  }
+#endif
+  return 0;
+}
+
+static void watchdog_feed(void)
+{
+#if HAS_WATCHDOG
+  wdt_feed(wdt, wdt_channel_id);
+#endif
+}
+
 extern "C"
 {
   int main(void)
@@ -35,43 +90,19 @@ extern "C"
     LOG_INF("GET Smart Wireless Lighting System Controller (%s) \n",
             APP_VERSION_STRING);
 
-    const struct device *wdt;
-    int wdt_channel_id;
-    struct wdt_timeout_cfg wdt_config = {
-        .window = {
-            .min = 0,
-            .max = 10000, // 10 seconds timeout
-        },
-        .callback = NULL, // NULL means system reset on timeout
-        .flags = WDT_FLAG_RESET_SOC,
-    };
-
-    wdt = DEVICE_DT_GET(DT_ALIAS(watchdog0));
-    if (!device_is_ready(wdt))
-    {
-      LOG_ERR("Watchdog device not ready");
-      return -1;
-    }
-
-    wdt_channel_id = wdt_install_timeout(wdt, &wdt_config);
-    if (wdt_channel_id < 0)
-    {
-      LOG_ERR("Watchdog install error");
-      return -1;
-    }
-
-    if (wdt_setup(wdt, 0) < 0)
+    if (watchdog_init() < 0)
     {
-      LOG_ERR("Watchdog setup error");
       return -1;
     }
 
+#if defined(CONFIG_WIFI)
     wifi_init();
 
     LOG_INF("Sleeping so wifi can connect");
     k_sleep(K_MSEC(5000));
-    wdt_feed(wdt, wdt_channel_id);
+    watchdog_feed();
     k_sleep(K_MSEC(5000));
+#endif
 
     /* Setup the device config */
     /* TODO Move to board? */
@@ -89,21 +120,30 @@ extern "C"
 
     cfg_get_value(CFG_DEVICEID_ID, &device_id, CFG_SIZE_DEVICEID_ID);
 
-    controller = (controller_t *)malloc(sizeof(controller_t));
-    controller->num_lights = 2; // TODO
+    controller->num_lights = lights_init();
+    scene_init();
     controller->device_id = device_id;
+    for (int i = 0; i < CHANNEL_COUNT; i++)
+    {
+      k_mutex_init(&controller->light_lock[i]);
+    }
     controller->state_update_channel = (struct zbus_channel *)&chan_state_updates;
 
     // LOG_INF("radio pointer (main): %p", (void *)&controller->radio);
 
+    radio_init();
+    tx_sched_init(controller);
+
     mqtt_thread_init(controller);
 
-    radio_init();
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+    remote_rx_init(controller);
+#endif
 
     while (1)
     {
       k_sleep(K_SECONDS(1));
-      wdt_feed(wdt, wdt_channel_id);
+      watchdog_feed();
     }
 
     return 0;
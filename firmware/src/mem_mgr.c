@@ -0,0 +1,213 @@
+#include "mem_mgr.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/sys_heap.h>
+#include <zephyr/sys/util.h>
+
+#include "controller.h"
+#include "radio.h"
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#if defined(CONFIG_GETSMART_STATIC_MEMORY)
+
+/* Bump arena for objects created once at boot (i.e. the radio HAL) */
+static uint8_t __aligned(8) arena[CONFIG_GETSMART_ARENA_SIZE];
+static size_t arena_used;
+static struct k_spinlock arena_lock;
+
+/* Radio frames, rounded up so each block stays word aligned. A dim ramp
+ * holds its pulse 0 and pulse 1 frames on every radio at once */
+#define FRAME_BLOCK_SIZE ROUND_UP(TRANSMIT_BUF_SIZE, 4)
+#define FRAME_SLAB_COUNT (2 * RADIO_COUNT + CONFIG_GETSMART_FRAME_SLAB_SPARE)
+K_MEM_SLAB_DEFINE_STATIC(frame_slab, FRAME_BLOCK_SIZE, FRAME_SLAB_COUNT, 4);
+
+void *mem_arena_alloc(size_t size, size_t align)
+{
+  void *ptr = NULL;
+  k_spinlock_key_t key = k_spin_lock(&arena_lock);
+  size_t start = ROUND_UP(arena_used, align);
+
+  if (start + size <= sizeof(arena))
+  {
+    ptr = &arena[start];
+    arena_used = start + size;
+  }
+  k_spin_unlock(&arena_lock, key);
+
+  if (ptr == NULL)
+  {
+    LOG_ERR("Arena exhausted, %u bytes requested", (unsigned int)size);
+  }
+  return ptr;
+}
+
+void *mem_frame_alloc(void)
+{
+  void *frame = NULL;
+
+  if (k_mem_slab_alloc(&frame_slab, &frame, K_NO_WAIT) != 0)
+  {
+    LOG_ERR("Frame slab exhausted");
+    return NULL;
+  }
+  return frame;
+}
+
+void mem_frame_free(void *frame)
+{
+  if (frame != NULL)
+  {
+    k_mem_slab_free(&frame_slab, frame);
+  }
+}
+
+#else
+
+void *mem_arena_alloc(size_t size, size_t align)
+{
+  ARG_UNUSED(align);
+  return malloc(size);
+}
+
+void *mem_frame_alloc(void) { return malloc(TRANSMIT_BUF_SIZE); }
+
+void mem_frame_free(void *frame) { free(frame); }
+
+#endif /* CONFIG_GETSMART_STATIC_MEMORY */
+
+/* Heaps registered with the kernel, i.e. the malloc and k_malloc heaps */
+static int heaps_get(struct sys_heap ***heaps)
+{
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS) && (CONFIG_SYS_HEAP_ARRAY_SIZE > 0)
+  return sys_heap_array_get(heaps);
+#else
+  *heaps = NULL;
+  return 0;
+#endif
+}
+
+static size_t heaps_sum(bool max)
+{
+  size_t total = 0;
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS)
+  struct sys_heap **heaps;
+  int count = heaps_get(&heaps);
+
+  for (int i = 0; i < count; i++)
+  {
+    struct sys_memory_stats st;
+
+    sys_heap_runtime_stats_get(heaps[i], &st);
+    total += max ? st.max_allocated_bytes : st.allocated_bytes;
+  }
+#endif
+  return total;
+}
+
+size_t mem_heap_allocated(void) { return heaps_sum(false); }
+
+size_t mem_heap_max_allocated(void) { return heaps_sum(true); }
+
+void mem_heap_reset_max(void)
+{
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS)
+  struct sys_heap **heaps;
+  int count = heaps_get(&heaps);
+
+  for (int i = 0; i < count; i++)
+  {
+    sys_heap_runtime_stats_reset_max(heaps[i]);
+  }
+#endif
+}
+
+int mem_stats_format(char *buf, size_t len)
+{
+  struct sys_heap **heaps;
+  int count = heaps_get(&heaps);
+  int n = snprintf(buf, len, "\"heap\":[");
+
+  for (int i = 0; i < count && n < len; i++)
+  {
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS)
+    struct sys_memory_stats st;
+
+    sys_heap_runtime_stats_get(heaps[i], &st);
+    n += snprintf(buf + n, len - n, "%s{\"free\":%u,\"used\":%u,\"max\":%u}",
+                  (i > 0) ? "," : "", (unsigned int)st.free_bytes,
+                  (unsigned int)st.allocated_bytes,
+                  (unsigned int)st.max_allocated_bytes);
+#endif
+  }
+
+#if defined(CONFIG_GETSMART_STATIC_MEMORY)
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n,
+                  "],\"arena\":{\"size\":%u,\"used\":%u},"
+                  "\"frames\":{\"count\":%u,\"used\":%u,\"max\":%u}",
+                  (unsigned int)sizeof(arena), (unsigned int)arena_used,
+                  (unsigned int)FRAME_SLAB_COUNT,
+                  k_mem_slab_num_used_get(&frame_slab),
+                  k_mem_slab_max_used_get(&frame_slab));
+  }
+#else
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "]");
+  }
+#endif
+  return n;
+}
+
+static int cmd_mem(const struct shell *sh, size_t argc, char **argv)
+{
+  struct sys_heap **heaps;
+  int count = heaps_get(&heaps);
+
+  for (int i = 0; i < count; i++)
+  {
+#if defined(CONFIG_SYS_HEAP_RUNTIME_STATS)
+    struct sys_memory_stats st;
+
+    sys_heap_runtime_stats_get(heaps[i], &st);
+    shell_print(sh, "heap %d (%p): free %u, used %u, max used %u", i,
+                (void *)heaps[i], (unsigned int)st.free_bytes,
+                (unsigned int)st.allocated_bytes,
+                (unsigned int)st.max_allocated_bytes);
+#endif
+  }
+
+#if defined(CONFIG_GETSMART_STATIC_MEMORY)
+  shell_print(sh, "arena: %u of %u bytes used", (unsigned int)arena_used,
+              (unsigned int)sizeof(arena));
+  shell_print(sh, "frames: %u of %u used, max used %u",
+              k_mem_slab_num_used_get(&frame_slab),
+              FRAME_SLAB_COUNT,
+              k_mem_slab_max_used_get(&frame_slab));
+#endif
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), mem, NULL, "Heap, arena and slab usage", cmd_mem, 1, 0);
+
+static struct stats_provider mem_stats = {
+    .name = "mem",
+    .format = mem_stats_format,
+};
+
+static int mem_mgr_init(void)
+{
+  stats_register(&mem_stats);
+  return 0;
+}
+
+SYS_INIT(mem_mgr_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
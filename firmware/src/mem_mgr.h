@@ -0,0 +1,28 @@
+#ifndef __GET_MEM_MGR__
+#define __GET_MEM_MGR__
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* Boot time allocations, never freed */
+    void *mem_arena_alloc(size_t size, size_t align);
+
+    /* Radio frame buffers of TRANSMIT_BUF_SIZE bytes */
+    void *mem_frame_alloc(void);
+    void mem_frame_free(void *frame);
+
+    int mem_stats_format(char *buf, size_t len);
+
+    /* Totals over every registered heap */
+    size_t mem_heap_allocated(void);
+    size_t mem_heap_max_allocated(void);
+    void mem_heap_reset_max(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_MEM_MGR__*/
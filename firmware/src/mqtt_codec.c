@@ -0,0 +1,253 @@
+#include "mqtt_codec.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/data/json.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/util.h>
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define MQTT_UPDATE_STATE_PAYLOAD "{\"state\":\"%s\", \"brightness\":%d}"
+
+static const struct json_obj_descr msg_command_descr[] = {
+    JSON_OBJ_DESCR_PRIM(struct msg_command, state, JSON_TOK_STRING),
+    JSON_OBJ_DESCR_PRIM(struct msg_command, brightness, JSON_TOK_NUMBER),
+    JSON_OBJ_DESCR_PRIM(struct msg_command, priority, JSON_TOK_STRING),
+};
+
+static const struct json_obj_descr msg_scene_light_descr[] = {
+    JSON_OBJ_DESCR_PRIM(struct msg_scene_light, light, JSON_TOK_NUMBER),
+    JSON_OBJ_DESCR_PRIM(struct msg_scene_light, state, JSON_TOK_STRING),
+    JSON_OBJ_DESCR_PRIM(struct msg_scene_light, brightness, JSON_TOK_NUMBER),
+};
+
+static const struct json_obj_descr msg_scene_descr[] = {
+    JSON_OBJ_DESCR_OBJ_ARRAY(struct msg_scene, lights, CHANNEL_COUNT, count,
+                             msg_scene_light_descr,
+                             ARRAY_SIZE(msg_scene_light_descr)),
+};
+
+void extract_device_info(const char *topic_name, char *device_id,
+                         size_t device_id_len, int *channel)
+{
+  // getsmart/device/0f3def/channel/0/cmnd
+
+  char temp_str[MQTT_TOPIC_MAXLEN];
+  char *token, *save;
+  int count = 0;
+
+  // Ensure the input string is not NULL
+  if (topic_name == NULL)
+  {
+    return;
+  }
+
+  // Copy the string since strtok modifies the string
+  if (strlen(topic_name) >= sizeof(temp_str))
+  {
+    LOG_INF("Topic too long.");
+    return;
+  }
+  strcpy(temp_str, topic_name);
+
+  token = strtok_r(temp_str, "/", &save);
+
+  while (token != NULL)
+  {
+    count++;
+    if (count == 3)
+    { // Assuming device_id is always the 4 token
+      strncpy(device_id, token, device_id_len - 1);
+      device_id[device_id_len - 1] = '\0';
+    }
+    if (count == 5)
+    { // Assuming the channel is always the 5
+      char *end;
+      long ch = strtol(token, &end, 10);
+      /* Anything else matched the wildcard subscription */
+      *channel = (*end == '\0' && end != token && ch >= 0 && ch < CHANNEL_COUNT)
+                     ? (int)ch
+                     : -1;
+      break;
+    }
+    token = strtok_r(NULL, "/", &save);
+  }
+}
+
+/**
+ * Parse a JSON command, the buffer is modified in place. The state is
+ * required, the brightness and the priority class are optional.
+ */
+int parse_msg_command(char *msg, size_t len, struct msg_command *command,
+                      bool *set_brightness)
+{
+  memset(command, 0, sizeof(*command));
+
+  int ret = json_obj_parse(msg, len, msg_command_descr,
+                           ARRAY_SIZE(msg_command_descr), command);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  if (!(ret & BIT(0)) || command->state == NULL)
+  {
+    return -EINVAL;
+  }
+
+  *set_brightness = (ret & BIT(1)) != 0;
+  if (!*set_brightness)
+  {
+    LOG_DBG("No brightness in MQTT state message");
+  }
+  return ret;
+}
+
+/* Format a topic into one of the table's entries */
+#define TOPIC_SET(entry, fmt, ...)                                             \
+  (snprintf(entry, sizeof(entry), fmt, __VA_ARGS__) < sizeof(entry))
+
+/**
+ * Build every topic once the device id is known, so publishing and
+ * subscribing never format one. Returns -ENAMETOOLONG if the device id
+ * doesn't fit.
+ */
+int mqtt_topics_init(struct mqtt_topics *topics, const char *device_id,
+                     int num_lights)
+{
+  bool ok = TOPIC_SET(topics->cmnd_sub, MQTT_COMMAND_SUB_TOPIC, device_id) &&
+            TOPIC_SET(topics->cmnd_prio_sub, MQTT_COMMAND_PRIO_SUB_TOPIC,
+                      device_id) &&
+            TOPIC_SET(topics->scene_sub, MQTT_SCENE_SUB_TOPIC, device_id) &&
+            TOPIC_SET(topics->stats, MQTT_STATS_TOPIC, device_id) &&
+            TOPIC_SET(topics->telemetry, MQTT_TELEMETRY_TOPIC, device_id) &&
+            TOPIC_SET(topics->availability, MQTT_AVAILABILITY_TOPIC,
+                      device_id);
+
+  for (int i = 0; i < MIN(num_lights, CHANNEL_COUNT) && ok; i++)
+  {
+    ok = TOPIC_SET(topics->lights[i].discover, MQTT_HA_DISCOVER_TOPIC,
+                   device_id, i) &&
+         TOPIC_SET(topics->lights[i].cmnd, MQTT_COMMAND_TOPIC, device_id, i) &&
+         TOPIC_SET(topics->lights[i].state, MQTT_STATE_TOPIC, device_id, i);
+  }
+  if (!ok)
+  {
+    LOG_ERR("Device id %s is too long for the topics", device_id);
+    return -ENAMETOOLONG;
+  }
+  return 0;
+}
+
+int format_state_payload(const struct state_update *su, char *payload,
+                         size_t payload_len)
+{
+  int n = snprintf(payload, payload_len, MQTT_UPDATE_STATE_PAYLOAD,
+                   (su->state == STATE_ON) ? "ON" : "OFF", su->brightness);
+  if (n < 0 || n >= payload_len)
+  {
+    return -ENOMEM;
+  }
+  return 0;
+}
+
+/**
+ * The priority class level of getsmart/device/0f3def/channel/0/cmnd/<class>,
+ * NULL if the topic has none. Points into the topic.
+ */
+const char *extract_priority(const char *topic_name)
+{
+  const char *level = strstr(topic_name, "/cmnd/");
+
+  return (level == NULL) ? NULL : level + strlen("/cmnd/");
+}
+
+/**
+ * Whether the topic is a scene's, getsmart/device/0f3def/scene/<name>/set
+ * to define it or .../cmnd to recall it.
+ */
+bool extract_scene_info(const char *topic_name, char *name, size_t name_len,
+                        bool *define)
+{
+  char temp_str[MQTT_TOPIC_MAXLEN];
+  char *token, *save;
+  char *level[6];
+  int count = 0;
+
+  if (topic_name == NULL || strlen(topic_name) >= sizeof(temp_str))
+  {
+    return false;
+  }
+  strcpy(temp_str, topic_name);
+
+  for (token = strtok_r(temp_str, "/", &save); token != NULL;
+       token = strtok_r(NULL, "/", &save))
+  {
+    if (count == ARRAY_SIZE(level))
+    {
+      return false;
+    }
+    level[count++] = token;
+  }
+  if (count != ARRAY_SIZE(level) || strcmp(level[3], "scene") != 0 ||
+      strlen(level[4]) >= name_len)
+  {
+    return false;
+  }
+
+  if (strcmp(level[5], MQTT_SCENE_SET) == 0)
+  {
+    *define = true;
+  }
+  else if (strcmp(level[5], MQTT_SCENE_RECALL) == 0)
+  {
+    *define = false;
+  }
+  else
+  {
+    return false;
+  }
+  strcpy(name, level[4]);
+  return true;
+}
+
+/**
+ * Parse a scene definition, {"lights":[{"light":0,"state":"ON",
+ * "brightness":20},...]}, the buffer is modified in place. Returns the
+ * number of lights, an empty list deletes the scene.
+ */
+int parse_msg_scene(char *msg, size_t len, struct scene_target *targets)
+{
+  struct msg_scene scene;
+
+  memset(&scene, 0, sizeof(scene));
+
+  int ret = json_obj_parse(msg, len, msg_scene_descr,
+                           ARRAY_SIZE(msg_scene_descr), &scene);
+  if (ret < 0)
+  {
+    return ret;
+  }
+  if (!(ret & BIT(0)))
+  {
+    return -EINVAL;
+  }
+
+  for (size_t i = 0; i < scene.count; i++)
+  {
+    const struct msg_scene_light *l = &scene.lights[i];
+
+    if (l->state == NULL || l->light < 0 || l->light >= CHANNEL_COUNT ||
+        l->brightness < 0 || l->brightness > DIM_LEVELS)
+    {
+      return -EINVAL;
+    }
+    targets[i].light = l->light;
+    targets[i].state =
+        (strcmp(l->state, MQTT_STATE_ON) == 0) ? STATE_ON : STATE_OFF;
+    targets[i].brightness = l->brightness;
+  }
+  return scene.count;
+}
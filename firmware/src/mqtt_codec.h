@@ -0,0 +1,101 @@
+#ifndef __GET_MQTT_CODEC__
+#define __GET_MQTT_CODEC__
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "controller.h"
+
+#define MQTT_HA_DISCOVER_TOPIC "homeassistant/light/getsmart/%s-%d/config"
+/* Home Assistant's birth and last will messages */
+#define MQTT_HA_STATUS_TOPIC "homeassistant/status"
+#define MQTT_HA_ONLINE "online"
+/* Ours, retained, "offline" is the last will */
+#define MQTT_AVAILABILITY_TOPIC "getsmart/device/%s/availability"
+#define MQTT_AVAILABILITY_ONLINE "online"
+#define MQTT_AVAILABILITY_OFFLINE "offline"
+#define MQTT_STATE_TOPIC "getsmart/device/%s/channel/%d/state"
+#define MQTT_COMMAND_TOPIC "getsmart/device/%s/channel/%d/cmnd"
+/* One subscription covers the command topics of every light */
+#define MQTT_COMMAND_SUB_TOPIC "getsmart/device/%s/channel/+/cmnd"
+/* And another those with a priority class, .../cmnd/<class> */
+#define MQTT_COMMAND_PRIO_SUB_TOPIC "getsmart/device/%s/channel/+/cmnd/+"
+#define MQTT_STATS_TOPIC "getsmart/device/%s/stats"
+#define MQTT_TELEMETRY_TOPIC "getsmart/device/%s/telemetry"
+/* Scenes are defined on .../scene/<name>/set and recalled on .../cmnd */
+#define MQTT_SCENE_SUB_TOPIC "getsmart/device/%s/scene/+/+"
+#define MQTT_SCENE_SET "set"
+#define MQTT_SCENE_RECALL "cmnd"
+
+/* Longest topic, including the terminator */
+#define MQTT_TOPIC_MAXLEN 128
+
+/* Longest of our own topics, with a 6 character device id */
+#define MQTT_TOPIC_ENTRY_MAXLEN 48
+
+/* Longest state update payload, including the terminator */
+#define MQTT_STATE_PAYLOAD_MAXLEN 64
+
+#define MQTT_STATE_ON "ON"
+
+/* Every topic we publish or subscribe to, see mqtt_topics_init() */
+struct mqtt_topics
+{
+  char cmnd_sub[MQTT_TOPIC_ENTRY_MAXLEN];
+  char cmnd_prio_sub[MQTT_TOPIC_ENTRY_MAXLEN];
+  char scene_sub[MQTT_TOPIC_ENTRY_MAXLEN];
+  char stats[MQTT_TOPIC_ENTRY_MAXLEN];
+  char telemetry[MQTT_TOPIC_ENTRY_MAXLEN];
+  char availability[MQTT_TOPIC_ENTRY_MAXLEN];
+  struct
+  {
+    char discover[MQTT_TOPIC_ENTRY_MAXLEN];
+    char cmnd[MQTT_TOPIC_ENTRY_MAXLEN];
+    char state[MQTT_TOPIC_ENTRY_MAXLEN];
+  } lights[CHANNEL_COUNT];
+};
+
+typedef struct msg_command
+{
+  char *state;
+  int brightness;
+  /* Priority class name, NULL if not given */
+  char *priority;
+} msg_command_t;
+
+/* A light of a scene definition, brightness 0 leaves the level */
+struct msg_scene_light
+{
+  int light;
+  char *state;
+  int brightness;
+};
+
+struct msg_scene
+{
+  struct msg_scene_light lights[CHANNEL_COUNT];
+  size_t count;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void extract_device_info(const char *topic_name, char *device_id,
+                             size_t device_id_len, int *channel);
+    int parse_msg_command(char *msg, size_t len, struct msg_command *command,
+                          bool *set_brightness);
+    bool extract_scene_info(const char *topic_name, char *name,
+                            size_t name_len, bool *define);
+    const char *extract_priority(const char *topic_name);
+    int parse_msg_scene(char *msg, size_t len, struct scene_target *targets);
+    int mqtt_topics_init(struct mqtt_topics *topics, const char *device_id,
+                         int num_lights);
+    int format_state_payload(const struct state_update *su, char *payload,
+                             size_t payload_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_MQTT_CODEC__*/
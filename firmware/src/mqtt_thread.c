@@ -14,36 +14,29 @@
 #include <zephyr/sys/printk.h>
 #include <zephyr/zbus/zbus.h>
 
+#include "config_mgr.h"
 #include "controller.h"
+#include "fault.h"
+#include "latency.h"
+#include "lights.h"
+#include "mqtt_codec.h"
+#include "mqtt_thread.h"
+#include "net_telemetry.h"
+#include "scene.h"
+#include "stats.h"
+#include "trace.h"
+#include "tx_sched.h"
 
 LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
 
-#define MQTT_HA_DISCOVER_TOPIC "homeassistant/light/getsmart/%s-%d/config"
-#define MQTT_STATE_TOPIC "getsmart/device/%s/channel/%d/state"
-#define MQTT_COMMAND_TOPIC "getsmart/device/%s/channel/%d/cmnd"
-
-#define MQTT_UPDATE_STATE_PAYLOAD "{\"state\":\"%s\", \"brightness\":%d}"
-
 #define MQTT_HA_DISCOVER_PAYLOAD                                              \
   "{\"name\":\"%s\",\"unique_id\":\"%s\", "                                   \
   "\"command_topic\":\"%s\",\"state_topic\":\"%s\","                          \
+  "\"availability_topic\":\"%s\","                                            \
   "\"schema\":\"json\",\"brightness\":true,\"brightness_scale\":64,"          \
   "\"device\": {\"identifiers\": \"[%s]\",\"name\":\"Get Smart Controller\" " \
   "} }"
 
-#define MQTT_STATE_ON "ON"
-
-typedef struct msg_command
-{
-  char *state;
-  int brightness;
-} msg_command_t;
-
-static const struct json_obj_descr msg_command_descr[] = {
-    JSON_OBJ_DESCR_PRIM(struct msg_command, state, JSON_TOK_STRING),
-    JSON_OBJ_DESCR_PRIM(struct msg_command, brightness, JSON_TOK_NUMBER),
-};
-
 /* Thread Stack */
 #define STACKSIZE 4096
 #define APP_MQTT_BUFFER_SIZE 128
@@ -67,21 +60,26 @@ static bool is_cmnd_subscribed = false;
 /* pointer to the controller */
 static controller_t *controller;
 
+/* Built once the device id is known */
+static struct mqtt_topics topics;
+
 /* MQTT Broker details. */
 static struct sockaddr_storage broker;
 
 /* MQTT Broker Details */
-static const char server_addr[] = "192.168.0.10";
+static const char server_addr[] = CONFIG_GETSMART_MQTT_BROKER_ADDR;
 // static const char server_addr[] = "192.168.1.71";
-static uint16_t server_port = 1883;
+static uint16_t server_port = CONFIG_GETSMART_MQTT_BROKER_PORT;
 static const char *username = "demonday";
 static const char *password = "armad1ll0";
 
 static struct mqtt_utf8 username_utf8;
 static struct mqtt_utf8 password_utf8;
 
-/* Client Identifer TODO: Based on MAC*/
-static const char *client_id = "get-smart-MAC";
+/* Client identifier, one persistent session per device id so the broker
+ * redelivers unacknowledged commands after a reconnect */
+#define CLIENT_ID_PREFIX "get-smart-"
+static char client_id[sizeof(CLIENT_ID_PREFIX) + CFG_SIZE_DEVICEID_ID];
 
 /* Buffers for MQTT client. */
 static uint8_t rx_buffer[APP_MQTT_BUFFER_SIZE];
@@ -90,6 +88,79 @@ static uint8_t payload_buf[CONFIG_MQTT_PAYLOAD_BUFFER_SIZE];
 
 #define SOCKET_TIMEOUT_MS 2000
 
+/* Reconnect backoff, doubled after each failed attempt */
+#define RECONNECT_MIN_MS 500
+#define RECONNECT_MAX_MS 8000
+
+/* Abort a connection that got no CONNACK in this time */
+#define CONNACK_TIMEOUT_MS 5000
+
+/* Home Assistant resync, births closer together than this share one */
+#define HA_RESYNC_INTERVAL_MS (CONFIG_GETSMART_HA_RESYNC_INTERVAL_S * 1000LL)
+#define HA_RESYNC_SPREAD_MS CONFIG_GETSMART_HA_RESYNC_SPREAD_MS
+
+/* Connection counters and thread heartbeats, see the "mqtt" stats */
+static struct
+{
+  uint32_t connects;
+  uint32_t disconnects;
+  uint32_t rx;
+  uint32_t failed;
+  uint32_t oversize;
+  /* QoS 1 redeliveries acknowledged without running them again */
+  uint32_t dups;
+  int64_t loop_beat;
+  int64_t sub_beat;
+} mqtt_stats;
+
+/**
+ * QoS 1 commands recently handled. After a lost PUBACK the broker sends
+ * the same PUBLISH again with the DUP flag set, it gets its PUBACK at
+ * once without the radio sending the frames again. Packet ids are
+ * reused once acknowledged, so a hash of the topic and payload has to
+ * match as well. Only touched from the MQTT thread.
+ */
+#define DEDUP_SLOTS CONFIG_GETSMART_MQTT_DEDUP_SLOTS
+
+struct dedup_entry
+{
+  uint16_t message_id;
+  uint32_t hash;
+};
+
+static struct dedup_entry dedup[DEDUP_SLOTS];
+static uint8_t dedup_count;
+static uint8_t dedup_next;
+
+/**
+ * Home Assistant forgets every light's state when it restarts, states
+ * are only published when they change. Its birth message has the
+ * discovery and state of every light published again in one burst, by
+ * the state subscriber so the burst can't overtake a newer update. The
+ * controllers that hear the same birth message spread their bursts
+ * over HA_RESYNC_SPREAD_MS, see the "ha" stats for how long the UI took
+ * to be right again.
+ */
+static struct
+{
+  struct k_spinlock lock;
+  /* The birth message not answered yet, 0 for none */
+  int64_t birth;
+  int64_t due;
+  /* The last burst */
+  int64_t done;
+  uint32_t births;
+  uint32_t resyncs;
+  uint32_t failed;
+  /* Birth message to the last state published */
+  uint32_t last_ms;
+  uint32_t max_ms;
+} ha_sync;
+
+/* Last will, retained, so Home Assistant shows the lights unavailable */
+static struct mqtt_topic will_topic;
+static struct mqtt_utf8 will_message;
+
 /* File descriptor for socket */
 static struct pollfd fds;
 
@@ -109,33 +180,26 @@ int fds_init(struct pollfd *fds)
   return 0;
 }
 
-static void data_print(uint8_t *prefix, uint8_t *data, size_t len)
-{
-  char buf[len + 1];
-
-  memcpy(buf, data, len);
-  buf[len] = 0;
-  LOG_INF("%s%s", (char *)prefix, (char *)buf);
-}
-
 static int get_received_payload(size_t length)
 {
   int ret;
   int err = 0;
+  /* Leave room for the terminator, the payload is parsed as a string */
+  const size_t max_len = sizeof(payload_buf) - 1;
 
   /* Return an error if the payload is larger than the payload buffer.
    * Note: To allow new messages, we have to read the payload before returning.
    */
-  if (length > sizeof(payload_buf))
+  if (length > max_len)
   {
     err = -EMSGSIZE;
   }
 
   /* Truncate payload until it fits in the payload buffer. */
-  while (length > sizeof(payload_buf))
+  while (length > max_len)
   {
     ret = mqtt_read_publish_payload_blocking(&client, payload_buf,
-                                             (length - sizeof(payload_buf)));
+                                             MIN(length - max_len, max_len));
     if (ret == 0)
     {
       return -EIO;
@@ -153,132 +217,209 @@ static int get_received_payload(size_t length)
   {
     return ret;
   }
+  payload_buf[length] = '\0';
 
   return err;
 }
 
-static void extract_device_info(const char *topic_name, char **device_id,
-                                int *channel)
+/* FNV-1a */
+static uint32_t msg_hash(uint32_t hash, const void *data, size_t len)
 {
-  // getsmart/device/0f3def/channel/0/cmnd
+  const uint8_t *b = data;
 
-  char *token, *temp_str;
-  int count = 0;
+  for (size_t i = 0; i < len; i++)
+  {
+    hash = (hash ^ b[i]) * 16777619U;
+  }
+  return hash;
+}
 
-  // Ensure the input string is not NULL
-  if (topic_name == NULL)
+static bool dedup_seen(uint16_t message_id, uint32_t hash)
+{
+  for (int i = 0; i < dedup_count; i++)
   {
-    return;
+    if (dedup[i].message_id == message_id && dedup[i].hash == hash)
+    {
+      return true;
+    }
   }
+  return false;
+}
 
-  // Duplicate the string since strtok modifies the string
-  // temp_str =  strdup(topic_name);
+/* The oldest entry makes room */
+static void dedup_add(uint16_t message_id, uint32_t hash)
+{
+  dedup[dedup_next].message_id = message_id;
+  dedup[dedup_next].hash = hash;
+  dedup_next = (dedup_next + 1) % DEDUP_SLOTS;
+  dedup_count = MIN(dedup_count + 1, DEDUP_SLOTS);
+}
 
-  temp_str = malloc(strlen(topic_name));
-  strcpy(temp_str, topic_name);
-  if (temp_str == NULL)
+/* Define a scene, or recall it */
+static int handle_msg_scene(const char *name, bool define, char *msg)
+{
+  if (!define)
   {
-    LOG_INF("strcpy failed.");
-    return;
+    latency_mark(LAT_STAGE_PARSED);
+    return scene_recall(name);
   }
 
-  token = strtok(temp_str, "/");
+  struct scene_target targets[CHANNEL_COUNT];
+  int count = parse_msg_scene(msg, strlen(msg), targets);
+  latency_mark(LAT_STAGE_PARSED);
 
-  while (token != NULL)
+  if (count < 0)
   {
-    count++;
-    if (count == 3)
-    { // Assuming device_id is always the 4 token
-      *device_id = malloc(strlen(topic_name));
-      strcpy(*device_id, token);
-      //*device_id = strdup(token);
-      if (*device_id == NULL)
-      {
-        // Handle memory allocation failure
-        free(temp_str);
-        return;
-      }
-    }
-    if (count == 5)
-    { // Assuming the channel is always the 5
-      *channel = atoi(token);
-      break;
-    }
-    token = strtok(NULL, "/");
+    LOG_ERR("Invalid scene %s: %d", name, count);
+    return count;
   }
+  return scene_define(name, targets, count);
+}
+
+/* Home Assistant came up, schedule the resync */
+static void ha_birth(void)
+{
+  int64_t now = k_uptime_get();
+  k_spinlock_key_t key = k_spin_lock(&ha_sync.lock);
+
+  ha_sync.births++;
+  if (ha_sync.birth == 0)
+  {
+    int64_t earliest =
+        (ha_sync.resyncs > 0) ? ha_sync.done + HA_RESYNC_INTERVAL_MS : 0;
 
-  free(temp_str); // Free the temporary string
+    ha_sync.birth = now;
+    ha_sync.due =
+        MAX(now + sys_rand32_get() % (HA_RESYNC_SPREAD_MS + 1U), earliest);
+  }
+  k_spin_unlock(&ha_sync.lock, key);
 }
 
-static void handle_msg_command(char *topic_name, char *msg)
+static int handle_msg_command(char *topic_name, char *msg)
 {
-  char *device_id = NULL;
-  int channel = 0;
+  char device_id[CFG_SIZE_DEVICEID_ID] = {0};
+  char scene[SCENE_NAME_MAXLEN];
+  bool define;
+  int channel = -1;
 
-  extract_device_info(topic_name, &device_id, &channel);
+  if (strcmp(topic_name, MQTT_HA_STATUS_TOPIC) == 0)
+  {
+    if (strcmp(msg, MQTT_HA_ONLINE) == 0)
+    {
+      ha_birth();
+    }
+    return 0;
+  }
 
-  if (device_id == NULL)
+  if (IS_ENABLED(CONFIG_GETSMART_SCENES) &&
+      extract_scene_info(topic_name, scene, sizeof(scene), &define))
+  {
+    return handle_msg_scene(scene, define, msg);
+  }
+
+  extract_device_info(topic_name, device_id, sizeof(device_id), &channel);
+
+  if (device_id[0] == '\0')
   {
     LOG_ERR("Unable to obtain deviceid from message. Skipping");
-    return;
+    return -EINVAL;
+  }
+  if (channel < 0)
+  {
+    LOG_ERR("No light in topic %s", topic_name);
+    return -EINVAL;
   }
 
   struct msg_command command;
-  int ret = json_obj_parse(msg, strlen(msg), msg_command_descr,
-                           sizeof(msg_command_descr), &command);
+  bool set_brightness;
+  int ret = parse_msg_command(msg, strlen(msg), &command, &set_brightness);
+  latency_mark(LAT_STAGE_PARSED);
 
-  bool set_brightness = (ret == 3);
-  if (ret != 3)
+  if (ret < 0)
   {
-    LOG_DBG("No brightness in MQTT state message");
+    LOG_ERR("Invalid command on channel %d: %d", channel, ret);
+    return ret;
   }
 
-  LOG_INF("Device:%s, Channel:%d, State: %s, Brightness: %d", device_id,
-          channel, command.state, command.brightness);
+  /* The payload's priority wins over the topic's */
+  const char *prio_name = (command.priority != NULL)
+                              ? command.priority
+                              : extract_priority(topic_name);
+  int prio = (prio_name == NULL) ? TX_PRIO_INTERACTIVE
+                                 : tx_prio_parse(prio_name);
+  if (prio < 0)
+  {
+    LOG_ERR("Unknown priority %s on channel %d", prio_name, channel);
+    return prio;
+  }
 
   int state =
       (strcmp(command.state, MQTT_STATE_ON) == 0) ? STATE_ON : STATE_OFF;
-  request_state(controller, channel, state, set_brightness, command.brightness);
-
-  if (device_id != NULL)
-  {
-    free(device_id); // Free the device_id string
-  }
+  TRACE(TR_MQTT_CMD, channel, TRACE_STATE(state, command.brightness));
+  return request_state(controller, channel, state, set_brightness,
+                       command.brightness, prio);
 }
 
-/* Subscribe to the MQTT Topic(s) to control the device */
+/**
+ * Subscribe to the MQTT Topic(s) to control the device. A single
+ * wildcard covers every light, another their commands with a priority
+ * class and another every scene, so the SUBSCRIBE fits the tx buffer
+ * however many there are.
+ */
 static int subscribe_cmnds()
 {
-  struct mqtt_topic topic_list[4];
+  struct mqtt_topic topic_list[] = {
+      {.topic = {.utf8 = topics.cmnd_sub, .size = strlen(topics.cmnd_sub)},
+       .qos = MQTT_QOS_1_AT_LEAST_ONCE},
+      {.topic = {.utf8 = topics.cmnd_prio_sub,
+                 .size = strlen(topics.cmnd_prio_sub)},
+       .qos = MQTT_QOS_1_AT_LEAST_ONCE},
+#if defined(CONFIG_GETSMART_SCENES)
+      {.topic = {.utf8 = topics.scene_sub, .size = strlen(topics.scene_sub)},
+       .qos = MQTT_QOS_1_AT_LEAST_ONCE},
+#endif
+  };
+  LOG_INF("Subscribing to: %s len %u", topics.cmnd_sub,
+          (unsigned int)strlen(topics.cmnd_sub));
 
-  for (int i = 0; i < controller->num_lights; i++)
-  {
-    char buf[256];
-    sprintf(buf, MQTT_COMMAND_TOPIC, controller->device_id, i);
-    char *topic_name = malloc(strlen(buf) + 1);
-    strcpy(topic_name, buf);
-    LOG_INF("Created Topic %s", topic_name);
-
-    struct mqtt_topic subscribe_topic = {
-        .topic = {.utf8 = topic_name, .size = strlen(topic_name)},
-        .qos = MQTT_QOS_1_AT_LEAST_ONCE};
+  const struct mqtt_subscription_list subscription_list = {
+      .list = topic_list,
+      .list_count = ARRAY_SIZE(topic_list),
+      .message_id = 1234};
 
-    topic_list[i] = subscribe_topic;
-    LOG_INF("Subscribing to: %s len %u", topic_name,
-            (unsigned int)strlen(topic_name));
-  }
+  return mqtt_subscribe(&client, &subscription_list);
+}
 
+/* On its own, the command SUBSCRIBE already fills most of the tx buffer */
+static int subscribe_ha_status()
+{
+  struct mqtt_topic topic = {
+      .topic = {.utf8 = (const uint8_t *)MQTT_HA_STATUS_TOPIC,
+                .size = strlen(MQTT_HA_STATUS_TOPIC)},
+      .qos = MQTT_QOS_0_AT_MOST_ONCE};
   const struct mqtt_subscription_list subscription_list = {
-      .list = (struct mqtt_topic *)&topic_list,
-      .list_count = controller->num_lights,
-      .message_id = 1234};
+      .list = &topic, .list_count = 1, .message_id = 1235};
 
-  int res = mqtt_subscribe(&client, &subscription_list);
+  return mqtt_subscribe(&client, &subscription_list);
+}
 
-  // for (int i = 0; i < controller->num_lights; i++) {
-  //   free((void *)topic_list[i].topic.utf8);
-  // }
+/* Retained, the last will replaces it when the connection is lost */
+static int publish_availability()
+{
+  struct mqtt_publish_param param;
+
+  param.message.topic.qos = MQTT_QOS_0_AT_MOST_ONCE;
+  param.message.topic.topic.utf8 = (const uint8_t *)topics.availability;
+  param.message.topic.topic.size = strlen(topics.availability);
+  param.message.payload.data = (uint8_t *)MQTT_AVAILABILITY_ONLINE;
+  param.message.payload.len = strlen(MQTT_AVAILABILITY_ONLINE);
+  param.message_id = sys_rand32_get();
+  param.dup_flag = 0U;
+  param.retain_flag = 1U;
 
+  k_mutex_lock(&sock_lock, K_FOREVER);
+  int res = mqtt_publish(&client, &param);
+  k_mutex_unlock(&sock_lock);
   return res;
 }
 
@@ -288,77 +429,72 @@ static int subscribe_cmnds()
 
 int publish_hadiscover()
 {
+  /* Kept off the stack, sock_lock is held while it is in use */
+  static char payload[512];
   struct mqtt_publish_param param;
   int res = 0;
+
+  k_mutex_lock(&sock_lock, K_FOREVER);
   for (int i = 0; i < controller->num_lights; i++)
   {
-    char buf[512];
-
-    sprintf(buf, MQTT_HA_DISCOVER_TOPIC, controller->device_id, i);
-    char *topic_name = malloc(strlen(buf));
-    strcpy(topic_name, buf);
-
-    sprintf(buf, MQTT_COMMAND_TOPIC, controller->device_id, i);
-    char *tn_cmnd = malloc(strlen(buf));
-    strcpy(tn_cmnd, buf);
-
-    sprintf(buf, MQTT_STATE_TOPIC, controller->device_id, i);
-    char *tn_state = malloc(strlen(buf));
-    strcpy(tn_state, buf);
-
+    const char *topic_name = topics.lights[i].discover;
     char device_id[20];
     sprintf(device_id, "%s-%d", controller->device_id, i);
 
-    char device_name[40];
-    sprintf(device_name, "Get Smart Light  - Channel %d", i);
+    char device_name[LIGHT_NAME_MAXLEN + 32];
+    lights_name(i, device_name, sizeof(device_name));
 
-    sprintf(buf, MQTT_HA_DISCOVER_PAYLOAD, device_name, device_id, tn_cmnd,
-            tn_state, controller->device_id);
-    char *payload = malloc(strlen(buf));
-    strcpy(payload, buf);
+    snprintf(payload, sizeof(payload), MQTT_HA_DISCOVER_PAYLOAD, device_name,
+             device_id, topics.lights[i].cmnd, topics.lights[i].state,
+             topics.availability, controller->device_id);
 
     param.message.topic.qos = MQTT_QOS_0_AT_MOST_ONCE;
-    param.message.topic.topic.utf8 = (uint8_t *)topic_name;
-    param.message.topic.topic.size = strlen(param.message.topic.topic.utf8);
+    param.message.topic.topic.utf8 = (const uint8_t *)topic_name;
+    param.message.topic.topic.size = strlen(topic_name);
     param.message.payload.data = (uint8_t *)payload;
     param.message.payload.len = strlen(param.message.payload.data);
     param.message_id = sys_rand32_get();
     param.dup_flag = 0U;
     param.retain_flag = 0U;
 
-    k_mutex_lock(&sock_lock, K_FOREVER);
     LOG_INF("Publishing to %s", topic_name);
     res = mqtt_publish(&client, &param);
-    k_mutex_unlock(&sock_lock);
-
-    free(topic_name);
-    free(tn_cmnd);
-    free(tn_state);
-    free(payload);
-
     if (res != 0)
     {
       LOG_ERR("Error - Publish HA Discover: %d", res);
-      return res;
+      break;
     }
   }
-  return 0;
+  k_mutex_unlock(&sock_lock);
+  return res;
 }
 
 int publish_state_update(struct state_update *su)
 {
   struct mqtt_publish_param param;
 
-  char topic_name[256];
-  sprintf(topic_name, MQTT_STATE_TOPIC, controller->device_id, su->channel);
+  char payload[MQTT_STATE_PAYLOAD_MAXLEN];
 
-  char payload[256];
-  sprintf(payload, MQTT_UPDATE_STATE_PAYLOAD,
-          (su->state == STATE_ON) ? "ON" : "OFF", su->brightness);
+  if (!is_connected)
+  {
+    return -ENOTCONN;
+  }
+  if (su->channel < 0 || su->channel >= controller->num_lights)
+  {
+    return -EINVAL;
+  }
+
+  int err = format_state_payload(su, payload, sizeof(payload));
+  if (err < 0)
+  {
+    return err;
+  }
+
+  const char *topic_name = topics.lights[su->channel].state;
 
   param.message.topic.qos = MQTT_QOS_0_AT_MOST_ONCE;
-  param.message.topic.topic.utf8 = (uint8_t *)&topic_name;
-  param.message.topic.topic.size = strlen(param.message.topic.topic.utf8);
+  param.message.topic.topic.utf8 = (const uint8_t *)topic_name;
+  param.message.topic.topic.size = strlen(topic_name);
   param.message.payload.data = (uint8_t *)&payload;
   param.message.payload.len = strlen(param.message.payload.data);
   param.message_id = sys_rand32_get();
@@ -368,10 +504,10 @@ int publish_state_update(struct state_update *su)
   // LOG_INF("Calling publish");
   k_mutex_lock(&sock_lock, K_FOREVER);
   // LOG_INF("Mutex - P - L");
-  LOG_INF("Publishing state update to %s", topic_name);
   int res = mqtt_publish(&client, &param);
   k_mutex_unlock(&sock_lock);
   // LOG_INF("Mutex - P - U");
+  TRACE(TR_STATE_PUBLISH, (su->channel << 16) | (su->seq & 0xFFFF), res);
   if (res != 0)
   {
     LOG_ERR("Error - Publish Result: %d", res);
@@ -380,25 +516,183 @@ int publish_state_update(struct state_update *su)
   return res;
 }
 
-ZBUS_SUBSCRIBER_DEFINE(state_update_subscriber, 4);
+int mqtt_publish_stats(const char *payload)
+{
+  struct mqtt_publish_param param;
+
+  if (!is_connected || controller == NULL)
+  {
+    return -ENOTCONN;
+  }
+
+  param.message.topic.qos = MQTT_QOS_0_AT_MOST_ONCE;
+  param.message.topic.topic.utf8 = (const uint8_t *)topics.stats;
+  param.message.topic.topic.size = strlen(topics.stats);
+  param.message.payload.data = (uint8_t *)payload;
+  param.message.payload.len = strlen(payload);
+  param.message_id = sys_rand32_get();
+  param.dup_flag = 0U;
+  param.retain_flag = 0U;
+
+  k_mutex_lock(&sock_lock, K_FOREVER);
+  int res = mqtt_publish(&client, &param);
+  k_mutex_unlock(&sock_lock);
+  if (res != 0)
+  {
+    LOG_ERR("Error - Publish Stats: %d", res);
+  }
+
+  return res;
+}
+
+/**
+ * Publish the network telemetry at QoS 1 so its PUBACK times the broker,
+ * after a PINGREQ for the other round trip. Only called from the MQTT
+ * thread, mqtt_live() pings only when the connection is otherwise idle.
+ */
+static void publish_telemetry(void)
+{
+  static char payload[NET_TELEMETRY_MAXLEN];
+  static uint16_t message_id;
+  struct mqtt_publish_param param;
+
+  if (net_telemetry_format(payload, sizeof(payload)) < 0)
+  {
+    LOG_WRN("Telemetry truncated, not published");
+    return;
+  }
+
+  /* Clear of 0 and of the SUBSCRIBE's 1234 */
+  message_id = (message_id % 1000U) + 1U;
+  param.message.topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+  param.message.topic.topic.utf8 = (const uint8_t *)topics.telemetry;
+  param.message.topic.topic.size = strlen(topics.telemetry);
+  param.message.payload.data = (uint8_t *)payload;
+  param.message.payload.len = strlen(payload);
+  param.message_id = message_id;
+  param.dup_flag = 0U;
+  param.retain_flag = 0U;
+
+  k_mutex_lock(&sock_lock, K_FOREVER);
+  int res = mqtt_ping(&client);
+  if (res == 0)
+  {
+    net_telemetry_ping_sent();
+  }
+  res = mqtt_publish(&client, &param);
+  if (res == 0)
+  {
+    net_telemetry_publish_sent(message_id);
+  }
+  k_mutex_unlock(&sock_lock);
+  if (res != 0)
+  {
+    LOG_ERR("Error - Publish Telemetry: %d", res);
+  }
+}
+
+/* The birth message to answer now, 0 if there is none or not yet */
+static int64_t ha_resync_due(void)
+{
+  int64_t birth = 0;
+  k_spinlock_key_t key = k_spin_lock(&ha_sync.lock);
+
+  if (ha_sync.birth != 0 && k_uptime_get() >= ha_sync.due)
+  {
+    birth = ha_sync.birth;
+    ha_sync.birth = 0;
+  }
+  k_spin_unlock(&ha_sync.lock, key);
+  return birth;
+}
+
+/**
+ * Discovery and state of every light in one burst, holding the socket
+ * so nothing else goes out in between. Runs on the state subscriber.
+ */
+static void ha_resync(int64_t birth)
+{
+  struct state_update su;
+
+  k_mutex_lock(&sock_lock, K_FOREVER);
+  int err = publish_hadiscover();
+  for (int i = 0; i < controller->num_lights && err == 0; i++)
+  {
+    controller_state_current(controller, i, &su);
+    err = publish_state_update(&su);
+  }
+  k_mutex_unlock(&sock_lock);
+
+  int64_t now = k_uptime_get();
+  uint32_t ms = (uint32_t)(now - birth);
+  k_spinlock_key_t key = k_spin_lock(&ha_sync.lock);
+
+  if (err == 0)
+  {
+    ha_sync.resyncs++;
+    ha_sync.done = now;
+    ha_sync.last_ms = ms;
+    ha_sync.max_ms = MAX(ha_sync.max_ms, ms);
+  }
+  else
+  {
+    ha_sync.failed++;
+  }
+  k_spin_unlock(&ha_sync.lock, key);
+
+  if (err == 0)
+  {
+    LOG_INF("Home Assistant resync, %d lights %u ms after its birth",
+            controller->num_lights, ms);
+  }
+  else
+  {
+    LOG_ERR("Home Assistant resync failed: %d", err);
+  }
+}
+
+/* Queue depth is CONFIG_ZBUS_MSG_SUBSCRIBER_NET_BUF_POOL_SIZE */
+ZBUS_MSG_SUBSCRIBER_DEFINE(state_update_subscriber);
 
 static void mqtt_subscriber_task(void)
 {
   const struct zbus_channel *chan;
+  struct state_update update;
 
-  while (!zbus_sub_wait(&state_update_subscriber, &chan, K_FOREVER))
+  while (1)
   {
-    struct state_update update;
+    int err = zbus_sub_wait_msg(&state_update_subscriber, &chan, &update,
+                                K_MSEC(CONFIG_GETSMART_STATE_SWEEP_MS));
+    mqtt_stats.sub_beat = k_uptime_get();
+
+    if (controller == NULL)
+    {
+      continue;
+    }
 
-    if (controller->state_update_channel == chan)
+    if (err == 0 && controller->state_update_channel == chan &&
+        controller_state_claim(controller, &update))
     {
-      zbus_chan_read(controller->state_update_channel, &update, K_FOREVER);
+      if (publish_state_update(&update) == 0)
+      {
+        latency_record(LAT_STAGE_STATE_SENT, update.t_rx);
+      }
+    }
 
-      LOG_INF("From subscriber -> %d,%d,%d", update.channel, update.state,
-              update.brightness);
+    /* Updates dropped on overflow, deliver the latest state instead */
+    while (controller_state_next_lost(controller, &update))
+    {
+      LOG_INF("Re-delivering lost state -> %d,%d,%d", update.channel,
+              update.state, update.brightness);
 
       publish_state_update(&update);
     }
+
+    int64_t birth = is_connected ? ha_resync_due() : 0;
+    if (birth != 0)
+    {
+      ha_resync(birth);
+    }
   }
 }
 
@@ -409,7 +703,7 @@ K_THREAD_DEFINE(subscriber_task_id, CONFIG_MAIN_STACK_SIZE,
 void mqtt_message_handler(struct mqtt_client *, const struct mqtt_evt *evt)
 {
   int err;
-  LOG_INF("Started processing event type %d\n", evt->type);
+  TRACE(TR_MQTT_EVT, evt->type, evt->result);
 
   switch (evt->type)
   {
@@ -422,11 +716,22 @@ void mqtt_message_handler(struct mqtt_client *, const struct mqtt_evt *evt)
     {
       LOG_INF("MQTT client connected!\n");
       is_connected = true;
+      mqtt_stats.connects++;
       err = subscribe_cmnds();
       if (err)
       {
         LOG_INF("State TOPIC Subscription request failed %d\n", err);
       }
+      err = subscribe_ha_status();
+      if (err)
+      {
+        LOG_INF("HA status Subscription request failed %d\n", err);
+      }
+      err = publish_availability();
+      if (err)
+      {
+        LOG_INF("Availability Publish failed %d\n", err);
+      }
       err = publish_hadiscover();
       if (err)
       {
@@ -436,22 +741,59 @@ void mqtt_message_handler(struct mqtt_client *, const struct mqtt_evt *evt)
     break;
 
   case MQTT_EVT_PUBLISH:
+    latency_begin();
     const struct mqtt_publish_param *p = &evt->param.publish;
-    LOG_INF("Received message on TOPIC: %s, result=%d len=%d",
-            p->message.topic.topic.utf8, evt->result, p->message.payload.len);
+    /* The topic points into the rx buffer and is not terminated */
+    static char topic[MQTT_TOPIC_MAXLEN];
+
+    TRACE(TR_MQTT_RX, p->message.payload.len, p->message_id);
+    mqtt_stats.rx++;
+
+    topic[0] = '\0';
+    if (p->message.topic.topic.size < sizeof(topic))
+    {
+      memcpy(topic, p->message.topic.topic.utf8, p->message.topic.topic.size);
+      topic[p->message.topic.topic.size] = '\0';
+    }
 
     // Extract the data of the recived message
     err = get_received_payload(p->message.payload.len);
     //  On successful extraction of data
     if (err >= 0)
     {
-      data_print("Received: ", payload_buf, p->message.payload.len);
-      handle_msg_command((char *)p->message.topic.topic.utf8, payload_buf);
+      bool qos1 = (p->message.topic.qos == MQTT_QOS_1_AT_LEAST_ONCE);
+      uint32_t hash = 0;
+
+      if (qos1)
+      {
+        hash = msg_hash(2166136261U, topic, strlen(topic));
+        hash = msg_hash(hash, payload_buf, p->message.payload.len);
+      }
+      if (qos1 && p->dup_flag && dedup_seen(p->message_id, hash))
+      {
+        mqtt_stats.dups++;
+        TRACE(TR_MQTT_DUP, p->message_id, hash);
+        LOG_DBG("Duplicate of %u acknowledged", p->message_id);
+      }
+      else
+      {
+        if (handle_msg_command(topic, (char *)payload_buf) < 0)
+        {
+          mqtt_stats.failed++;
+        }
+        else if (qos1)
+        {
+          /* A command that failed runs again if it is redelivered */
+          dedup_add(p->message_id, hash);
+        }
+      }
+      latency_end();
       // On failed extraction of data - Payload buffer is smaller than the
       // recived data . Increase
     }
     else if (err == -EMSGSIZE)
     {
+      mqtt_stats.oversize++;
       LOG_ERR(
           "Received payload (%d bytes) is larger than the payload buffer "
           "size (%d bytes).",
@@ -524,55 +866,33 @@ void mqtt_message_handler(struct mqtt_client *, const struct mqtt_evt *evt)
     break;
 
   case MQTT_EVT_PINGRESP:
-    LOG_INF("PINGRESP packet");
+    net_telemetry_pingresp();
+    LOG_DBG("PINGRESP packet");
+    break;
+
+  case MQTT_EVT_PUBACK:
+    net_telemetry_puback(evt->param.puback.message_id);
     break;
 
   default:
     LOG_INF("Unhandled MQTT event %d\n", evt->type);
     break;
   }
-  LOG_INF("Done with event type %d\n", evt->type);
 }
 
-/* MQTT Thread Function */
-void mqtt_thread(void *arg1, void *arg2, void *arg3)
+/* MQTT client configuration, redone before every connection attempt */
+static void client_setup(void)
 {
-  // controller_t *controller = arg2;
-  int err;
-  LOG_INF("Starting thread...");
-  /* Broker Details */
-  struct sockaddr_in *broker4 = (struct sockaddr_in *)&broker;
-  broker4->sin_family = AF_INET;
-  broker4->sin_port = htons(server_port);
-  zsock_inet_pton(AF_INET, server_addr, &broker4->sin_addr);
-
-  LOG_INF("Broker Config set");
+  mqtt_client_init(&client);
 
   /* MQTT client configuration */
   client.broker = &broker;
-  LOG_INF("Broker Configured in client...");
+  client.evt_cb = mqtt_message_handler;
 
   client.client_id.utf8 = (uint8_t *)client_id;
   client.client_id.size = strlen(client_id);
-  LOG_INF("ClientId configured...");
-
-  client.user_name = &username_utf8;
-  client.password = &password_utf8;
-
-  // client.user_name->utf8 = username;
-  // client.user_name->size = strlen(username);
-  // client.password->utf8 = password;
-  // client.password->size = strlen(password);
-  // client->client_id.utf8 = (uint8_t *)MQTT_CLIENTID;
-  // client->client_id.size = strlen(MQTT_CLIENTID);
-  // client->password->utf8 = (uint8_t *)MQTT_PASSWORD;
-  // client->password->size = strlen(MQTT_PASSWORD);
-  // client->user_name->utf8 = (uint8_t *)MQTT_USERNAME;
-  // client->user_name->size = strlen(MQTT_USERNAME);
-  client.protocol_version = MQTT_VERSION_3_1_1;
-  client.transport.type = MQTT_TRANSPORT_NON_SECURE;
-
-  LOG_INF("Client stings configured...");
+  /* Keep the session, QoS 1 commands missing a PUBACK come back with DUP */
+  client.clean_session = 0U;
 
   username_utf8.utf8 = (uint8_t *)username;
   username_utf8.size = strlen(username);
@@ -583,107 +903,227 @@ void mqtt_thread(void *arg1, void *arg2, void *arg3)
   client.user_name = &username_utf8;
   client.password = &password_utf8;
 
+  will_topic.topic.utf8 = (uint8_t *)topics.availability;
+  will_topic.topic.size = strlen(topics.availability);
+  will_topic.qos = MQTT_QOS_1_AT_LEAST_ONCE;
+  will_message.utf8 = (uint8_t *)MQTT_AVAILABILITY_OFFLINE;
+  will_message.size = strlen(MQTT_AVAILABILITY_OFFLINE);
+  client.will_topic = &will_topic;
+  client.will_message = &will_message;
+  client.will_retain = 1U;
+
+  client.protocol_version = MQTT_VERSION_3_1_1;
+  client.transport.type = MQTT_TRANSPORT_NON_SECURE;
+
   /* MQTT buffers configuration */
   client.rx_buf = rx_buffer;
-  LOG_INF("rxbuffer.");
   client.rx_buf_size = sizeof(rx_buffer);
   client.tx_buf = tx_buffer;
-  LOG_INF("txbuffer.");
   client.tx_buf_size = sizeof(tx_buffer);
+}
 
-  LOG_INF("Attempting to connect...");
-
-  /* Connect to MQTT broker */
-  err = mqtt_connect(&client);
-  if (err)
-  {
-    LOG_INF("Unable to connect to MQTT broker\n");
-    return;
-  }
-  LOG_INF("Connected...");
-
-  // err = subscribe_cmnds();
-  // if (err) {
-  //   LOG_INF("State TOPIC Subscription request failed %d\n", err);
-  //   return;
-  // }
-
-  // err = publish_hadiscover();
-  // if (err) {
-  //   LOG_INF("Publish HA Discover request failed %d\n", err);
-  //   return;
-  // }
-
-  err = fds_init(&fds);
-  if (err)
-  {
-    LOG_ERR("Error in fds_init: %d", err);
-    return;
-  }
+/**
+ * Poll the connection until it fails or is closed, always returns with
+ * sock_lock released.
+ */
+static int mqtt_poll_loop(void)
+{
+  int64_t started = k_uptime_get();
+  int err;
 
-  /* Polling and event loop */
   while (1)
   {
+    mqtt_stats.loop_beat = k_uptime_get();
+
     k_mutex_lock(&sock_lock, K_FOREVER);
-    // LOG_INF("Mutex - L - L");
     err = poll(&fds, 1, 500);
-    // LOG_INF("Poll Done: %d", 500);
     if (err < 0)
     {
-      LOG_ERR("Error in poll(): %d", errno);
-      k_mutex_unlock(&sock_lock);
+      err = -errno;
+      LOG_ERR("Error in poll(): %d", err);
       break;
     }
 
+    /* 0 when it sent a PINGREQ */
     err = mqtt_live(&client);
+    if (err == 0)
+    {
+      net_telemetry_ping_sent();
+    }
     if ((err != 0) && (err != -EAGAIN))
     {
       LOG_ERR("Error in mqtt_live: %d", err);
-      k_mutex_unlock(&sock_lock);
       break;
     }
+    err = 0;
 
     if ((fds.revents & POLLIN) == POLLIN)
     {
-      LOG_INF("Input");
+      uint32_t rx = mqtt_stats.rx;
+
       err = mqtt_input(&client);
       if (err != 0)
       {
         LOG_ERR("Error in mqtt_input: %d", err);
         break;
-        k_mutex_unlock(&sock_lock);
+      }
+      if (mqtt_stats.rx != rx && fault_inject(FAULT_MQTT_DROP))
+      {
+        LOG_WRN("Fault injection: dropping the MQTT connection");
+        err = -ECONNABORTED;
+        break;
       }
     }
 
     if ((fds.revents & POLLERR) == POLLERR)
     {
       LOG_ERR("POLLERR");
-      k_mutex_unlock(&sock_lock);
+      err = -EIO;
       break;
     }
 
     if ((fds.revents & POLLNVAL) == POLLNVAL)
     {
       LOG_ERR("POLLNVAL");
-      k_mutex_unlock(&sock_lock);
+      err = -EBADF;
       break;
     }
     k_mutex_unlock(&sock_lock);
 
-    if (!is_connected)
+    if (is_connected && net_telemetry_due())
     {
-      mqtt_abort(&client);
+      publish_telemetry();
+    }
+
+    /* Closed by the broker, or never acknowledged */
+    if (!is_connected && k_uptime_get() - started > CONNACK_TIMEOUT_MS)
+    {
+      return -ENOTCONN;
     }
   }
+
+  k_mutex_unlock(&sock_lock);
+  return err;
 }
 
+/* MQTT Thread Function */
+void mqtt_thread(void *arg1, void *arg2, void *arg3)
+{
+  static struct lat_trace trace;
+  int backoff_ms = RECONNECT_MIN_MS;
+  int err;
+
+  LOG_INF("Starting thread...");
+  latency_attach(&trace);
+  /* Broker Details */
+  struct sockaddr_in *broker4 = (struct sockaddr_in *)&broker;
+  broker4->sin_family = AF_INET;
+  broker4->sin_port = htons(server_port);
+  zsock_inet_pton(AF_INET, server_addr, &broker4->sin_addr);
+
+  /* Connect, and reconnect whenever the connection is lost */
+  while (1)
+  {
+    mqtt_stats.loop_beat = k_uptime_get();
+
+    LOG_INF("Attempting to connect...");
+    k_mutex_lock(&sock_lock, K_FOREVER);
+    client_setup();
+    err = mqtt_connect(&client);
+    if (err == 0)
+    {
+      err = fds_init(&fds);
+    }
+    k_mutex_unlock(&sock_lock);
+
+    if (err == 0)
+    {
+      uint32_t connects = mqtt_stats.connects;
+
+      err = mqtt_poll_loop();
+      LOG_WRN("MQTT connection lost: %d", err);
+
+      /* Backoff restarts once a session was established */
+      if (mqtt_stats.connects != connects)
+      {
+        backoff_ms = RECONNECT_MIN_MS;
+      }
+      is_connected = false;
+      mqtt_stats.disconnects++;
+      net_telemetry_disconnected();
+    }
+    else
+    {
+      LOG_ERR("Unable to connect to MQTT broker: %d", err);
+    }
+
+    k_mutex_lock(&sock_lock, K_FOREVER);
+    mqtt_abort(&client);
+    k_mutex_unlock(&sock_lock);
+
+    LOG_INF("Reconnecting in %d ms", backoff_ms);
+    k_sleep(K_MSEC(backoff_ms));
+    backoff_ms = MIN(backoff_ms * 2, RECONNECT_MAX_MS);
+  }
+}
+
+static int mqtt_stats_format(char *buf, size_t len)
+{
+  int64_t now = k_uptime_get();
+
+  return snprintf(buf, len,
+                  "\"connected\":%s,\"connects\":%u,\"disconnects\":%u,"
+                  "\"rx\":%u,\"failed\":%u,\"oversize\":%u,\"dups\":%u,"
+                  "\"loop_age_ms\":%u,\"sub_age_ms\":%u",
+                  is_connected ? "true" : "false", mqtt_stats.connects,
+                  mqtt_stats.disconnects, mqtt_stats.rx, mqtt_stats.failed,
+                  mqtt_stats.oversize, mqtt_stats.dups,
+                  (unsigned int)(now - mqtt_stats.loop_beat),
+                  (unsigned int)(now - mqtt_stats.sub_beat));
+}
+
+static struct stats_provider mqtt_stats_provider = {
+    .name = "mqtt",
+    .format = mqtt_stats_format,
+};
+
+static int ha_stats_format(char *buf, size_t len)
+{
+  k_spinlock_key_t key = k_spin_lock(&ha_sync.lock);
+  uint32_t births = ha_sync.births;
+  uint32_t resyncs = ha_sync.resyncs;
+  uint32_t failed = ha_sync.failed;
+  uint32_t last_ms = ha_sync.last_ms;
+  uint32_t max_ms = ha_sync.max_ms;
+  bool pending = ha_sync.birth != 0;
+  k_spin_unlock(&ha_sync.lock, key);
+
+  return snprintf(buf, len,
+                  "\"births\":%u,\"resyncs\":%u,\"failed\":%u,"
+                  "\"pending\":%s,\"sync_ms\":%u,\"sync_max_ms\":%u",
+                  births, resyncs, failed, pending ? "true" : "false",
+                  last_ms, max_ms);
+}
+
+static struct stats_provider ha_stats_provider = {
+    .name = "ha",
+    .format = ha_stats_format,
+};
+
 int mqtt_thread_init(controller_t *ctrl)
 {
   controller = ctrl;
-  mqtt_client_init(&client);
-  /* Initialize MQTT client */
+  snprintf(client_id, sizeof(client_id), CLIENT_ID_PREFIX "%s",
+           controller->device_id);
+  int err = mqtt_topics_init(&topics, controller->device_id,
+                             controller->num_lights);
+  if (err != 0)
+  {
+    return err;
+  }
   k_mutex_init(&sock_lock);
-  client.evt_cb = mqtt_message_handler;
+  stats_register(&mqtt_stats_provider);
+  stats_register(&ha_stats_provider);
 
   // subscribe for controller state update messages so they can be
   // published to Home Assistant via MQTT.
@@ -693,6 +1133,7 @@ int mqtt_thread_init(controller_t *ctrl)
   k_thread_create(&mqtt_thread_data, mqtt_thread_stack,
                   K_THREAD_STACK_SIZEOF(mqtt_thread_stack), mqtt_thread, NULL,
                   NULL, NULL, K_PRIO_PREEMPT(7), 0, K_NO_WAIT);
+  k_thread_name_set(&mqtt_thread_data, "mqtt");
 
   return 0;
 }
@@ -4,6 +4,7 @@
 extern "C" {
 #endif
 int mqtt_thread_init(controller_t *ctrl);
+int mqtt_publish_stats(const char *payload);
 #ifdef __cplusplus
 }
 #endif
\ No newline at end of file
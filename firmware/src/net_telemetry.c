@@ -0,0 +1,204 @@
+#include "net_telemetry.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/net_mgmt.h>
+#include <zephyr/net/net_stats.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "latency.h"
+#if defined(CONFIG_WIFI)
+#include "wifi.h"
+#endif
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+/* One kind of broker round trip, at most one in flight */
+struct rtt
+{
+  uint64_t sent_us;
+  uint16_t message_id;
+  uint32_t count;
+  /* Sent again before the answer came, or never answered */
+  uint32_t lost;
+  uint32_t last_us;
+  uint32_t max_us;
+  uint64_t sum_us;
+};
+
+static struct k_spinlock rtt_lock;
+static struct rtt ping;
+static struct rtt puback;
+static int64_t next_publish;
+
+/* Call with rtt_lock held */
+static void rtt_sent(struct rtt *r, uint16_t message_id)
+{
+  r->lost += (r->sent_us != 0);
+  r->sent_us = latency_now();
+  r->message_id = message_id;
+}
+
+/* Call with rtt_lock held */
+static void rtt_answered(struct rtt *r, uint16_t message_id)
+{
+  if (r->sent_us == 0 || r->message_id != message_id)
+  {
+    return;
+  }
+
+  uint32_t us = (uint32_t)MIN(latency_now() - r->sent_us, UINT32_MAX);
+
+  r->sent_us = 0;
+  r->count++;
+  r->last_us = us;
+  r->max_us = MAX(r->max_us, us);
+  r->sum_us += us;
+}
+
+void net_telemetry_ping_sent(void)
+{
+  k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+  rtt_sent(&ping, 0);
+  k_spin_unlock(&rtt_lock, key);
+}
+
+void net_telemetry_pingresp(void)
+{
+  k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+  rtt_answered(&ping, 0);
+  k_spin_unlock(&rtt_lock, key);
+}
+
+void net_telemetry_publish_sent(uint16_t message_id)
+{
+  k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+  rtt_sent(&puback, message_id);
+  k_spin_unlock(&rtt_lock, key);
+}
+
+void net_telemetry_puback(uint16_t message_id)
+{
+  k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+  rtt_answered(&puback, message_id);
+  k_spin_unlock(&rtt_lock, key);
+}
+
+void net_telemetry_disconnected(void)
+{
+  k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+  ping.sent_us = 0;
+  puback.sent_us = 0;
+  k_spin_unlock(&rtt_lock, key);
+}
+
+bool net_telemetry_due(void)
+{
+  int64_t now = k_uptime_get();
+
+  if (now < next_publish)
+  {
+    return false;
+  }
+  next_publish = now + CONFIG_GETSMART_NET_TELEMETRY_INTERVAL_S * 1000LL;
+  return true;
+}
+
+static int rtt_format(char *buf, size_t len, const char *name,
+                      const struct rtt *r)
+{
+  return snprintf(buf, len,
+                  "\"%s\":{\"n\":%u,\"lost\":%u,\"last_us\":%u,"
+                  "\"avg_us\":%u,\"max_us\":%u},",
+                  name, r->count, r->lost, r->last_us,
+                  (unsigned int)(r->sum_us / MAX(r->count, 1U)), r->max_us);
+}
+
+/* Totals since boot from the net stack, all of its interfaces */
+static int counters_format(char *buf, size_t len)
+{
+  struct net_stats s;
+
+  if (net_mgmt(NET_REQUEST_STATS_GET_ALL, NULL, &s, sizeof(s)) != 0)
+  {
+    return snprintf(buf, len, "\"net\":null");
+  }
+
+  return snprintf(buf, len,
+                  "\"net\":{\"rx_bytes\":%u,\"tx_bytes\":%u,"
+                  "\"rx_pkts\":%u,\"tx_pkts\":%u,\"ip_drop\":%u,"
+                  "\"tcp_retx\":%u,\"tcp_drop\":%u}",
+                  (unsigned int)s.bytes.received, (unsigned int)s.bytes.sent,
+#if defined(CONFIG_NET_STATISTICS_IPV4)
+                  (unsigned int)s.ipv4.recv, (unsigned int)s.ipv4.sent,
+                  (unsigned int)s.ipv4.drop,
+#else
+                  0U, 0U, 0U,
+#endif
+#if defined(CONFIG_NET_STATISTICS_TCP)
+                  (unsigned int)s.tcp.rexmit, (unsigned int)s.tcp.drop
+#else
+                  0U, 0U
+#endif
+  );
+}
+
+int net_telemetry_format(char *buf, size_t len)
+{
+  struct rtt p, a;
+  int n;
+
+  k_spinlock_key_t key = k_spin_lock(&rtt_lock);
+  p = ping;
+  a = puback;
+  k_spin_unlock(&rtt_lock, key);
+
+#if defined(CONFIG_WIFI)
+  int rssi;
+
+  if (wifi_rssi(&rssi) == 0)
+  {
+    n = snprintf(buf, len, "{\"rssi\":%d,", rssi);
+  }
+  else
+#endif
+  {
+    n = snprintf(buf, len, "{\"rssi\":null,");
+  }
+  if (n < len)
+  {
+    n += rtt_format(buf + n, len - n, "ping", &p);
+  }
+  if (n < len)
+  {
+    n += rtt_format(buf + n, len - n, "puback", &a);
+  }
+  if (n < len)
+  {
+    n += counters_format(buf + n, len - n);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "}");
+  }
+  return (n < len) ? n : -ENOMEM;
+}
+
+static int cmd_net(const struct shell *sh, size_t argc, char **argv)
+{
+  char buf[NET_TELEMETRY_MAXLEN];
+
+  if (net_telemetry_format(buf, sizeof(buf)) < 0)
+  {
+    shell_error(sh, "Telemetry truncated");
+    return -ENOMEM;
+  }
+  shell_print(sh, "%s", buf);
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), net, NULL, "Broker round trips and net counters",
+                 cmd_net, 1, 0);
@@ -0,0 +1,64 @@
+#ifndef __GET_NET_TELEMETRY__
+#define __GET_NET_TELEMETRY__
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NET_TELEMETRY_MAXLEN 384
+
+/**
+ * Network health, to tell a slow Wi-Fi link or broker from a busy radio.
+ * The broker round trip is timed two ways, PINGREQ to PINGRESP and
+ * the telemetry's own QoS 1 PUBLISH to its PUBACK. Every
+ * GETSMART_NET_TELEMETRY_INTERVAL_S both are published to
+ * getsmart/device/<id>/telemetry with the net stack counters and the
+ * Wi-Fi RSSI, see mqtt_thread.c. 'gs net' shows the same.
+ */
+#if defined(CONFIG_GETSMART_NET_TELEMETRY)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void net_telemetry_ping_sent(void);
+    void net_telemetry_pingresp(void);
+    /* A QoS 1 PUBLISH went out, its PUBACK is timed */
+    void net_telemetry_publish_sent(uint16_t message_id);
+    void net_telemetry_puback(uint16_t message_id);
+    /* The connection is gone, round trips in flight are not counted */
+    void net_telemetry_disconnected(void);
+    /* Whether the next publish is due, then not again for an interval */
+    bool net_telemetry_due(void);
+    /* The telemetry as a JSON object */
+    int net_telemetry_format(char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline void net_telemetry_ping_sent(void) {}
+static inline void net_telemetry_pingresp(void) {}
+static inline void net_telemetry_publish_sent(uint16_t message_id)
+{
+  (void)message_id;
+}
+static inline void net_telemetry_puback(uint16_t message_id)
+{
+  (void)message_id;
+}
+static inline void net_telemetry_disconnected(void) {}
+static inline bool net_telemetry_due(void) { return false; }
+static inline int net_telemetry_format(char *buf, size_t len)
+{
+  (void)buf;
+  (void)len;
+  return -ENOTSUP;
+}
+
+#endif
+
+#endif /*__GET_NET_TELEMETRY__*/
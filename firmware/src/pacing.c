@@ -0,0 +1,193 @@
+#include "pacing.h"
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "affinity.h"
+#include "latency.h"
+#include "radio.h"
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+/**
+ * Power of two jitter buckets: values below 2^PACE_MIN_SHIFT us share
+ * bucket 0, the last one (~0.5 s) catches everything larger.
+ */
+#define PACE_MIN_SHIFT 4
+#define PACE_BUCKETS 16
+
+/* A ramp's last pair, only touched by the radio's TX worker */
+struct pace_ramp
+{
+  uint64_t last_us;
+  uint32_t interval_us;
+  int cpu;
+};
+
+struct pace_stats
+{
+  uint32_t buckets[PACE_BUCKETS];
+  uint32_t ramps;
+  uint32_t pairs;
+  /* Intervals and jitter counted, the first pairs of a ramp have none */
+  uint32_t intervals;
+  uint32_t jitters;
+  uint64_t interval_sum_us;
+  uint64_t jitter_sum_us;
+  uint32_t interval_max_us;
+  uint32_t jitter_max_us;
+  uint32_t cpu_changes;
+};
+
+static struct pace_ramp ramps[RADIO_COUNT];
+static struct k_spinlock pace_lock;
+static struct pace_stats pace;
+
+static uint32_t bucket_of(uint32_t us)
+{
+  uint32_t idx = (us < BIT(PACE_MIN_SHIFT))
+                     ? 0
+                     : 32 - __builtin_clz(us >> PACE_MIN_SHIFT);
+
+  return MIN(idx, PACE_BUCKETS - 1);
+}
+
+static int current_cpu(void)
+{
+#if defined(CONFIG_SMP)
+  /* May be stale by the time it is used, good enough for counting */
+  return arch_curr_cpu()->id;
+#else
+  return 0;
+#endif
+}
+
+void pacing_pair(uint8_t radio)
+{
+  struct pace_ramp *r = &ramps[radio];
+  uint64_t now = latency_now();
+  int cpu = current_cpu();
+  k_spinlock_key_t key = k_spin_lock(&pace_lock);
+
+  pace.pairs++;
+  if (r->last_us == 0)
+  {
+    pace.ramps++;
+  }
+  else
+  {
+    uint32_t interval = (uint32_t)MIN(now - r->last_us, UINT32_MAX);
+
+    pace.intervals++;
+    pace.interval_sum_us += interval;
+    pace.interval_max_us = MAX(pace.interval_max_us, interval);
+    pace.cpu_changes += (cpu != r->cpu);
+    if (r->interval_us != 0)
+    {
+      uint32_t jitter = (interval > r->interval_us)
+                            ? interval - r->interval_us
+                            : r->interval_us - interval;
+
+      pace.buckets[bucket_of(jitter)]++;
+      pace.jitters++;
+      pace.jitter_sum_us += jitter;
+      pace.jitter_max_us = MAX(pace.jitter_max_us, jitter);
+    }
+    r->interval_us = interval;
+  }
+  k_spin_unlock(&pace_lock, key);
+
+  r->last_us = now;
+  r->cpu = cpu;
+}
+
+void pacing_end(uint8_t radio)
+{
+  memset(&ramps[radio], 0, sizeof(ramps[radio]));
+}
+
+void pacing_reset(void)
+{
+  k_spinlock_key_t key = k_spin_lock(&pace_lock);
+  memset(&pace, 0, sizeof(pace));
+  k_spin_unlock(&pace_lock, key);
+}
+
+/* Call with a copy of the stats */
+static uint32_t jitter_percentile(const struct pace_stats *s, uint32_t pct)
+{
+  uint32_t target = DIV_ROUND_UP(s->jitters * (uint64_t)pct, 100U);
+  uint32_t seen = 0;
+
+  if (s->jitters == 0)
+  {
+    return 0;
+  }
+  for (uint32_t i = 0; i < PACE_BUCKETS; i++)
+  {
+    seen += s->buckets[i];
+    if (seen >= target)
+    {
+      return MIN(BIT(PACE_MIN_SHIFT + i), s->jitter_max_us);
+    }
+  }
+  return s->jitter_max_us;
+}
+
+static int pacing_stats_format(char *buf, size_t len)
+{
+  k_spinlock_key_t key = k_spin_lock(&pace_lock);
+  struct pace_stats s = pace;
+  k_spin_unlock(&pace_lock, key);
+
+  return snprintf(
+      buf, len,
+      "\"pinned\":%s,\"radio_cpu\":%d,\"ramps\":%u,\"pairs\":%u,"
+      "\"interval_us\":%u,\"interval_max_us\":%u,\"jitter_us\":%u,"
+      "\"jitter_p99_us\":%u,\"jitter_max_us\":%u,\"cpu_changes\":%u",
+      IS_ENABLED(CONFIG_GETSMART_CPU_PINNING) ? "true" : "false",
+      AFFINITY_RADIO_CPU, s.ramps, s.pairs,
+      (unsigned int)(s.interval_sum_us / MAX(s.intervals, 1U)),
+      s.interval_max_us,
+      (unsigned int)(s.jitter_sum_us / MAX(s.jitters, 1U)),
+      jitter_percentile(&s, 99), s.jitter_max_us, s.cpu_changes);
+}
+
+static int cmd_pacing(const struct shell *sh, size_t argc, char **argv)
+{
+  char buf[256];
+
+  if (argc > 1 && strcmp(argv[1], "reset") == 0)
+  {
+    pacing_reset();
+    shell_print(sh, "Pacing stats reset");
+    return 0;
+  }
+
+  pacing_stats_format(buf, sizeof(buf));
+  shell_print(sh, "{%s}", buf);
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), pacing, NULL, "Dim frame pacing jitter [reset]",
+                 cmd_pacing, 1, 1);
+
+static struct stats_provider pacing_stats = {
+    .name = "pacing",
+    .format = pacing_stats_format,
+};
+
+static int pacing_init(void)
+{
+  stats_register(&pacing_stats);
+  return 0;
+}
+
+SYS_INIT(pacing_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,40 @@
+#ifndef __GET_PACING__
+#define __GET_PACING__
+#include <stdint.h>
+
+/**
+ * Frame pacing of the dim ramps. A dim step is a pulse 0/1 pair followed
+ * by a short gap, and the receivers only count it as one step while
+ * the pairs keep a steady rhythm. Each pair's start is timed against the
+ * one before it on the same radio, the jitter is how much that interval
+ * changed from the previous one. The "pacing" stats and 'gs pacing' also
+ * say whether the radio threads are pinned to a core (see affinity.h)
+ * and how often a ramp moved between cores, so builds with and without
+ * pinning can be compared on the same trace.
+ */
+#if defined(CONFIG_GETSMART_PACING_STATS)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* A dim pair is about to go out on the radio */
+    void pacing_pair(uint8_t radio);
+    /* The ramp on the radio is over, the next pair starts a new one */
+    void pacing_end(uint8_t radio);
+    void pacing_reset(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline void pacing_pair(uint8_t radio) { (void)radio; }
+static inline void pacing_end(uint8_t radio) { (void)radio; }
+static inline void pacing_reset(void) {}
+
+#endif
+
+#endif /*__GET_PACING__*/
@@ -1,9 +1,20 @@
+#include <errno.h>
+#include <new>
+#include <stdio.h>
 #include <stdlib.h>
+#include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
 
 #include "../lib/radiolib/src/RadioLib.h"
 #include "../lib/radiolib/zephyr/src/ZephyrHal.h"
 #include "../lib/radiolib/zephyr/src/ZephyrModule.h"
+#include "airtime.h"
+#include "latency.h"
+#include "mem_mgr.h"
+#include "radio.h"
+#include "radio_power.h"
+#include "stats.h"
+#include "trace.h"
 
 LOG_MODULE_REGISTER(gs_radio, CONFIG_GETSMART_LOG_LEVEL);
 
@@ -11,11 +22,43 @@ LOG_MODULE_REGISTER(gs_radio, CONFIG_GETSMART_LOG_LEVEL);
 BUILD_ASSERT(DT_NODE_HAS_STATUS(DEFAULT_RADIO_NODE, okay),
              "No default sx1278 radio specified in DT");
 
-SX1278* fsk;
+/* Every semtech,sx1278 node, radio_tx() takes the index into these */
+#define RADIO_DEV(node) DEVICE_DT_GET(node),
+static const struct device* const radio_devs[] = {
+    DT_FOREACH_STATUS_OKAY(semtech_sx1278, RADIO_DEV)};
+BUILD_ASSERT(ARRAY_SIZE(radio_devs) == RADIO_COUNT);
 
-extern "C" {
-int radio_init() {
-  const struct device* radio_dev = DEVICE_DT_GET(DEFAULT_RADIO_NODE);
+static SX1278* radios[RADIO_COUNT];
+
+/* Counts RadioLib's SPI transactions, for the radio stats */
+class CountingHal : public ZephyrHal {
+ public:
+  using ZephyrHal::ZephyrHal;
+  uint32_t transactions = 0;
+
+  void spiBeginTransaction() override {
+    transactions++;
+    ZephyrHal::spiBeginTransaction();
+  }
+};
+
+struct radio_tx_stats {
+  CountingHal* hal;
+  uint32_t frames;
+  /* Time spent per frame beyond its time on air */
+  uint64_t overhead_us;
+};
+
+static struct radio_tx_stats tx_stats[RADIO_COUNT];
+
+/* The HAL objects live for the life of the app, so come from the arena */
+template <typename T, typename... Args>
+static T* arena_new(Args... args) {
+  void* mem = mem_arena_alloc(sizeof(T), alignof(T));
+  return (mem == nullptr) ? nullptr : new (mem) T(args...);
+}
+
+static int radio_init_one(uint8_t radio, const struct device* radio_dev) {
   LOG_INF("[%s] Checking SPI Ready...", radio_dev->name);
   if (!device_is_ready(radio_dev)) {
     LOG_ERR("[%s] Device Not Ready.", radio_dev->name);
@@ -23,12 +66,21 @@ int radio_init() {
   }
   LOG_INF("[%s] Device Ready.", radio_dev->name);
 
-  ZephyrHal* hal = new ZephyrHal(radio_dev);
+  CountingHal* hal = arena_new<CountingHal>(radio_dev);
+  ZephyrModule* module = arena_new<ZephyrModule>(hal);
+  if (hal == nullptr || module == nullptr) {
+    LOG_ERR("No memory for the radio HAL");
+    return -ENOMEM;
+  }
   LOG_INF("Hal Ready.");
 
   // TODO: How can I init the module with the radio device Params
   // fsk = new SX1278(new Module(hal, RADIOLIB_NC, 47, 21, 48));
-  fsk = new SX1278(new ZephyrModule(hal));
+  SX1278* fsk = arena_new<SX1278>(static_cast<Module*>(module));
+  if (fsk == nullptr) {
+    LOG_ERR("No memory for the radio");
+    return -ENOMEM;
+  }
 
   LOG_INF("Initializing FSK ...");
   int state = fsk->beginFSK(433.978, 1.6, 30.0, 7.8, 8, 0, false);
@@ -38,15 +90,108 @@ int radio_init() {
   }
   LOG_INF("beginFSK success!");
   fsk->setGain(1);
+  radios[radio] = fsk;
+  tx_stats[radio].hal = hal;
+  LOG_INF("%u SPI transactions to configure", hal->transactions);
   return 0;
 }
 
-int radio_tx_repeat(uint8_t* msg, uint8_t len, uint8_t count) {
+extern "C" {
+int radio_init() {
+  int err = 0;
+  for (uint8_t i = 0; i < RADIO_COUNT; i++) {
+    int res = radio_init_one(i, radio_devs[i]);
+    if (res != 0) {
+      err = res;
+    }
+  }
+  return err;
+}
+
+/* The repeats are redundancy, fails only if none of them went out */
+int radio_tx_repeat(uint8_t radio, uint8_t* msg, uint8_t len, uint8_t count) {
+  if (radio >= RADIO_COUNT || radios[radio] == nullptr) {
+    return -ENODEV;
+  }
+
+  SX1278* fsk = radios[radio];
+  int sent = 0;
   for (int i = 0; i < count; i++) {
-    LOG_HEXDUMP_INF(msg, len, "TX:");
-    fsk->transmit(msg, len);
+    latency_mark(LAT_STAGE_FIRST_TX);
+    uint64_t start = latency_now();
+    int state = fsk->transmit(msg, len);
+    uint64_t spent = latency_now() - start;
+
+    tx_stats[radio].frames++;
+    tx_stats[radio].overhead_us +=
+        spent - MIN(spent, (uint64_t)radio_airtime_us(len));
+    if (state != RADIOLIB_ERR_NONE) {
+      TRACE(TR_RADIO_TX_ERR, TRACE_CODE(msg), state);
+    } else {
+      /* TX mode is set inside transmit(), PacketSent marks the end */
+      radio_power_first_bit(radio, start + spent - radio_airtime_us(len));
+      TRACE(TR_RADIO_TX, TRACE_CODE(msg), len);
+      airtime_charge(radio, radio_airtime_us(len));
+      sent++;
+    }
+  }
+  return (sent > 0) ? 0 : -EIO;
+}
+int radio_tx(uint8_t radio, uint8_t* msg, uint8_t len) {
+  return radio_tx_repeat(radio, msg, len, 1);
+}
+
+/* transmit() goes through standby before TX, so the synthesizer can't be
+ * kept locked in FSTX between frames */
+int radio_set_mode(uint8_t radio, enum radio_mode mode) {
+  if (radio >= RADIO_COUNT || radios[radio] == nullptr) {
+    return -ENODEV;
   }
+
+  int state;
+  switch (mode) {
+    case RADIO_MODE_SLEEP:
+      state = radios[radio]->sleep();
+      break;
+    case RADIO_MODE_STANDBY:
+      state = radios[radio]->standby();
+      break;
+    default:
+      return -ENOTSUP;
+  }
+  return (state == RADIOLIB_ERR_NONE) ? 0 : -EIO;
+}
+
+/* RadioLib's Zephyr HAL doesn't deliver DIO0, so no remote RX here, see
+ * GETSMART_REMOTE_RX */
+int radio_rx_start(void) { return -ENOTSUP; }
+int radio_rx_read(uint8_t* code, uint8_t len) { return -ENOTSUP; }
+
+static int radio_stats_format(char* buf, size_t len) {
+  int n = snprintf(buf, len, "\"backend\":\"radiolib\",\"radios\":[");
+
+  for (int i = 0; i < RADIO_COUNT && n < (int)len; i++) {
+    const struct radio_tx_stats* st = &tx_stats[i];
+    uint32_t frames = MAX(st->frames, 1U);
+    uint32_t xfers = (st->hal != nullptr) ? st->hal->transactions : 0;
+
+    n += snprintf(buf + n, len - n,
+                  "%s{\"frames\":%u,\"spi_xfers\":%u,\"overhead_us\":%u}",
+                  (i > 0) ? "," : "", st->frames, xfers,
+                  (unsigned int)(st->overhead_us / frames));
+  }
+  if (n < (int)len) {
+    n += snprintf(buf + n, len - n, "]");
+  }
+  return n;
+}
+
+static struct stats_provider radio_stats = {{}, "radio", radio_stats_format};
+
+static int radio_stats_init(void) {
+  stats_register(&radio_stats);
   return 0;
 }
-int radio_tx(uint8_t* msg, uint8_t len) { return radio_tx_repeat(msg, len, 1); }
-}
\ No newline at end of file
+
+SYS_INIT(radio_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+}
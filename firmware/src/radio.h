@@ -1,12 +1,64 @@
+#ifndef __GET_RADIO__
+#define __GET_RADIO__
+#include <stdint.h>
+#include <zephyr/devicetree.h>
+
+/* Every enabled radio of the backend's compatible is used, in DT order */
+#if defined(CONFIG_GETSMART_RADIO_MOCK)
+#define RADIO_COUNT DT_NUM_INST_STATUS_OKAY(getsmart_mock_radio)
+#else
+#define RADIO_COUNT DT_NUM_INST_STATUS_OKAY(semtech_sx1278)
+#endif
+
+/* On-air packet format, as configured by beginFSK() in radio.cpp */
+#define RADIO_BITRATE_BPS 1600
+#define RADIO_PREAMBLE_BITS 0
+#define RADIO_SYNC_BITS 16
+#define RADIO_LENGTH_BITS 8
+#define RADIO_CRC_BITS 16
+
+/* What the GET remotes send, the RX sync word is their header */
+#define RADIO_GET_HEADER {0x54, 0x2A, 0xAA, 0xA5, 0x55, 0x55}
+#define RADIO_GET_HEADER_LEN 6
+#define RADIO_CODE_LEN 4
+
+/* Time on air of a packet with a len byte payload */
+static inline uint32_t radio_airtime_us(uint8_t len)
+{
+  uint32_t bits = RADIO_PREAMBLE_BITS + RADIO_SYNC_BITS + RADIO_LENGTH_BITS +
+                  (len * 8U) + RADIO_CRC_BITS;
+  return (uint32_t)(((uint64_t)bits * 1000000U) / RADIO_BITRATE_BPS);
+}
+
+/* SX1278 modes a radio is parked in between commands, see radio_power.h.
+ * In order of supply current, RADIO_MODE_RX is only ever reported. */
+enum radio_mode {
+  RADIO_MODE_SLEEP,
+  RADIO_MODE_STANDBY,
+  RADIO_MODE_FSTX,
+  RADIO_MODE_RX,
+  RADIO_MODE_COUNT
+};
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 int radio_init();
-int radio_tx(uint8_t* msg, uint8_t len);
-int radio_tx_repeat(uint8_t* msg, uint8_t len, uint8_t count);
+int radio_tx(uint8_t radio, uint8_t* msg, uint8_t len);
+int radio_tx_repeat(uint8_t radio, uint8_t* msg, uint8_t len, uint8_t count);
+
+/* Park a radio, from its TX thread. -ENOTSUP if the backend can't hold
+ * that mode, -EBUSY for the radio listening for the wall remote. */
+int radio_set_mode(uint8_t radio, enum radio_mode mode);
+
+/* Listen for the wall remote between transmissions on the first radio,
+ * see remote_rx.h */
+int radio_rx_start(void);
+int radio_rx_read(uint8_t* code, uint8_t len);
 
 #ifdef __cplusplus
 }
-#endif
\ No newline at end of file
+#endif
+
+#endif /* __GET_RADIO__ */
@@ -0,0 +1,391 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "airtime.h"
+#include "controller.h"
+#include "fault.h"
+#include "get_model.h"
+#include "latency.h"
+#include "lights.h"
+#include "mem_mgr.h"
+#include "radio.h"
+#include "radio_power.h"
+#include "remote_rx.h"
+#include "stats.h"
+#include "trace.h"
+
+LOG_MODULE_REGISTER(gs_radio, CONFIG_GETSMART_LOG_LEVEL);
+
+/**
+ * Stand-in for radio.cpp on boards without an SX1278 (i.e. native_sim).
+ * Each frame keeps the "radio" busy for its real time on air, the bytes
+ * are captured with their virtual timestamps and fed to the GET receiver
+ * model. Every getsmart,mock-radio node is a transmitter of its own,
+ * they only share the receivers. 'gs sim press' puts wall remote frames
+ * on air the same way.
+ */
+#define DEFAULT_RADIO_NODE DT_ALIAS(radio0)
+BUILD_ASSERT(DT_NODE_HAS_COMPAT_STATUS(DEFAULT_RADIO_NODE, getsmart_mock_radio,
+                                       okay),
+             "No mock radio specified in DT");
+
+#define RADIO_NAME(node) DT_NODE_FULL_NAME(node),
+static const char *const radio_names[] = {
+    DT_FOREACH_STATUS_OKAY(getsmart_mock_radio, RADIO_NAME)};
+
+/* The wall remote transmits after the radios */
+#define TX_REMOTE RADIO_COUNT
+
+#define CAPTURE_FRAMES CONFIG_GETSMART_MOCK_CAPTURE_FRAMES
+
+struct mock_frame {
+  uint64_t t_start_us;
+  uint64_t t_end_us;
+  uint8_t tx;
+  uint8_t len;
+  uint8_t data[TRANSMIT_BUF_SIZE];
+};
+
+/* A transmitter is busy for the whole time on air of its frame */
+struct mock_tx {
+  struct k_mutex busy;
+  uint64_t airtime_us;
+};
+
+static struct mock_tx txs[RADIO_COUNT + 1];
+/* Where the power policy parked each radio, it pays the SX1278's start
+ * up from there before a frame */
+static enum radio_mode modes[RADIO_COUNT];
+static struct mock_frame capture[CAPTURE_FRAMES];
+static uint32_t capture_head;
+static uint64_t airtime_total_us;
+static struct k_spinlock capture_lock;
+/* The lights on the other end */
+static struct get_model sim_model;
+
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+/* Code words heard by the receiver, read back by radio_rx_read() */
+K_MSGQ_DEFINE(mock_rx_msgq, RADIO_CODE_LEN, CONFIG_GETSMART_REMOTE_RX_QUEUE, 1);
+static bool rx_started;
+#endif
+
+int radio_init()
+{
+  for (int i = 0; i < RADIO_COUNT; i++)
+  {
+    LOG_INF("[%s] Mock radio ready.", radio_names[i]);
+    modes[i] = RADIO_MODE_STANDBY;
+  }
+  get_model_reset(&sim_model);
+  return 0;
+}
+
+/* Keep the transmitter busy for the frame, then deliver it to the receivers */
+static void mock_air(uint8_t tx, const uint8_t *msg, uint8_t len)
+{
+  k_mutex_lock(&txs[tx].busy, K_FOREVER);
+
+  uint32_t airtime = radio_airtime_us(len);
+  uint64_t t_start = latency_now();
+
+  k_sleep(K_USEC(airtime));
+  k_mutex_unlock(&txs[tx].busy);
+
+  uint64_t t_end = t_start + airtime;
+  k_spinlock_key_t key = k_spin_lock(&capture_lock);
+  struct mock_frame *f = &capture[capture_head++ % CAPTURE_FRAMES];
+
+  f->t_start_us = t_start;
+  f->t_end_us = t_end;
+  f->tx = tx;
+  f->len = len;
+  memcpy(f->data, msg, len);
+  txs[tx].airtime_us += airtime;
+  airtime_total_us += airtime;
+  k_spin_unlock(&capture_lock, key);
+
+  get_model_rx(&sim_model, msg, len, t_start, t_end);
+
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+  /* A real SX1278 can't hear itself, hearing everything here exercises
+   * the echo suppression too */
+  if (rx_started && len >= RADIO_GET_HEADER_LEN + RADIO_CODE_LEN &&
+      k_msgq_put(&mock_rx_msgq, &msg[RADIO_GET_HEADER_LEN], K_NO_WAIT) == 0)
+  {
+    remote_rx_irq(t_end);
+  }
+#endif
+}
+
+int radio_tx_repeat(uint8_t radio, uint8_t* msg, uint8_t len, uint8_t count)
+{
+  if (radio >= RADIO_COUNT)
+  {
+    return -ENODEV;
+  }
+  if (len > TRANSMIT_BUF_SIZE)
+  {
+    return -EINVAL;
+  }
+
+  int sent = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (fault_inject(FAULT_RADIO_TX))
+    {
+      TRACE(TR_RADIO_TX_ERR, TRACE_CODE(msg), -EIO);
+      continue;
+    }
+
+    k_sleep(K_USEC(radio_power_ramp_us(modes[radio])));
+    modes[radio] = MAX(modes[radio], RADIO_MODE_STANDBY);
+    radio_power_first_bit(radio, latency_now());
+    latency_mark(LAT_STAGE_FIRST_TX);
+    remote_rx_note_tx(TRACE_CODE(msg), latency_now() + radio_airtime_us(len));
+    mock_air(radio, msg, len);
+    airtime_charge(radio, radio_airtime_us(len));
+    TRACE(TR_RADIO_TX, TRACE_CODE(msg), len);
+    sent++;
+  }
+  return (sent > 0) ? 0 : -EIO;
+}
+
+int radio_tx(uint8_t radio, uint8_t* msg, uint8_t len)
+{
+  return radio_tx_repeat(radio, msg, len, 1);
+}
+
+int radio_set_mode(uint8_t radio, enum radio_mode mode)
+{
+  if (radio >= RADIO_COUNT)
+  {
+    return -ENODEV;
+  }
+  if (mode >= RADIO_MODE_RX)
+  {
+    return -EINVAL;
+  }
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+  /* The first radio listens, like radio.cpp */
+  if (radio == 0 && rx_started)
+  {
+    return -EBUSY;
+  }
+#endif
+  modes[radio] = mode;
+  return 0;
+}
+
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+int radio_rx_start(void)
+{
+  rx_started = true;
+  return 0;
+}
+
+int radio_rx_read(uint8_t* code, uint8_t len)
+{
+  if (len != RADIO_CODE_LEN)
+  {
+    return -EINVAL;
+  }
+  return k_msgq_get(&mock_rx_msgq, code, K_NO_WAIT);
+}
+#else
+int radio_rx_start(void) { return -ENOTSUP; }
+int radio_rx_read(uint8_t* code, uint8_t len) { return -ENOTSUP; }
+#endif
+
+static int sim_stats_format(char *buf, size_t len)
+{
+  struct get_model_stats ms;
+  struct light_state ls;
+  int n;
+
+  get_model_get_stats(&sim_model, &ms);
+  n = snprintf(buf, len,
+               "\"frames\":%u,\"unknown\":%u,\"dim_steps\":%u,"
+               "\"reversals\":%u,\"airtime_ms\":%u,\"lights\":[",
+               ms.frames, ms.unknown, ms.dim_steps, ms.reversals,
+               (unsigned int)(airtime_total_us / 1000U));
+  for (int ch = 0; ch < lights_count() && n < len; ch++)
+  {
+    get_model_state(&sim_model, ch, &ls);
+    n += snprintf(buf + n, len - n, "%s{\"state\":\"%s\",\"brightness\":%d}",
+                  (ch > 0) ? "," : "", (ls.state == STATE_ON) ? "ON" : "OFF",
+                  ls.brightness);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "],\"radio_airtime_ms\":[");
+  }
+  for (int i = 0; i < RADIO_COUNT && n < len; i++)
+  {
+    n += snprintf(buf + n, len - n, "%s%u", (i > 0) ? "," : "",
+                  (unsigned int)(txs[i].airtime_us / 1000U));
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "]");
+  }
+  return n;
+}
+
+static int cmd_sim_state(const struct shell *sh, size_t argc, char **argv)
+{
+  struct get_model_stats ms;
+  struct light_state ls;
+
+  get_model_get_stats(&sim_model, &ms);
+  shell_print(sh, "frames %u, unknown %u, dim steps %u, reversals %u",
+              ms.frames, ms.unknown, ms.dim_steps, ms.reversals);
+  shell_print(sh, "airtime %u ms", (unsigned int)(airtime_total_us / 1000U));
+  for (int i = 0; i < RADIO_COUNT; i++)
+  {
+    shell_print(sh, "  radio %d [%s] %u ms", i, radio_names[i],
+                (unsigned int)(txs[i].airtime_us / 1000U));
+  }
+  for (int ch = 0; ch < lights_count(); ch++)
+  {
+    get_model_state(&sim_model, ch, &ls);
+    shell_print(sh, "channel %d: %s, brightness %d", ch,
+                (ls.state == STATE_ON) ? "ON" : "OFF", ls.brightness);
+  }
+  return 0;
+}
+
+static int cmd_sim_frames(const struct shell *sh, size_t argc, char **argv)
+{
+  uint32_t head = capture_head;
+  uint32_t count = MIN(head, CAPTURE_FRAMES);
+
+  for (uint32_t i = head - count; i != head; i++)
+  {
+    struct mock_frame f;
+    k_spinlock_key_t key = k_spin_lock(&capture_lock);
+
+    f = capture[i % CAPTURE_FRAMES];
+    k_spin_unlock(&capture_lock, key);
+
+    if (f.tx == TX_REMOTE)
+    {
+      shell_print(sh, "%llu-%llu us remote code 0x%08x",
+                  (unsigned long long)f.t_start_us,
+                  (unsigned long long)f.t_end_us, TRACE_CODE(f.data));
+    }
+    else
+    {
+      shell_print(sh, "%llu-%llu us radio %u code 0x%08x",
+                  (unsigned long long)f.t_start_us,
+                  (unsigned long long)f.t_end_us, f.tx, TRACE_CODE(f.data));
+    }
+  }
+  return 0;
+}
+
+static int cmd_sim_reset(const struct shell *sh, size_t argc, char **argv)
+{
+  k_spinlock_key_t key = k_spin_lock(&capture_lock);
+  capture_head = 0;
+  airtime_total_us = 0;
+  for (int i = 0; i <= RADIO_COUNT; i++)
+  {
+    txs[i].airtime_us = 0;
+  }
+  k_spin_unlock(&capture_lock, key);
+  get_model_reset(&sim_model);
+  shell_print(sh, "Receiver model reset");
+  return 0;
+}
+
+/* Send a frame from the wall remote, 4 repeats like the controller */
+static void remote_press(uint8_t channel, uint8_t op, uint8_t pulse_no,
+                         int repeats)
+{
+  uint8_t *msg = NULL;
+  uint8_t len = get_radio_msg(channel, op, pulse_no, &msg);
+
+  for (int i = 0; i < repeats && len > 0; i++)
+  {
+    mock_air(TX_REMOTE, msg, len);
+  }
+  mem_frame_free(msg);
+}
+
+static int cmd_sim_press(const struct shell *sh, size_t argc, char **argv)
+{
+  int channel = atoi(argv[1]);
+  int steps = (argc > 3) ? atoi(argv[3]) : 1;
+
+  if (channel < 0 || channel >= lights_count())
+  {
+    shell_error(sh, "No channel %d", channel);
+    return -EINVAL;
+  }
+
+  if (strcmp(argv[2], "on") == 0)
+  {
+    remote_press(channel, OP_ON, 0, 4);
+  }
+  else if (strcmp(argv[2], "off") == 0)
+  {
+    remote_press(channel, OP_OFF, 0, 4);
+  }
+  else if (strcmp(argv[2], "up") == 0 || strcmp(argv[2], "down") == 0)
+  {
+    /* Same pairs the controller sends, a quick extra pair reverses */
+    if (argv[2][0] == 'd')
+    {
+      remote_press(channel, OP_DIM_DOWN, 0, 1);
+      remote_press(channel, OP_DIM_DOWN, 1, 1);
+    }
+    for (int i = 0; i < steps; i++)
+    {
+      remote_press(channel, OP_DIM_DOWN, 0, 1);
+      remote_press(channel, OP_DIM_DOWN, 1, 1);
+      k_sleep(K_MSEC(5));
+    }
+  }
+  else
+  {
+    shell_error(sh, "Unknown button %s", argv[2]);
+    return -EINVAL;
+  }
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    sim_cmds,
+    SHELL_CMD(state, NULL, "Receiver model state", cmd_sim_state),
+    SHELL_CMD(frames, NULL, "Captured frames", cmd_sim_frames),
+    SHELL_CMD(reset, NULL, "Reset the receiver model", cmd_sim_reset),
+    SHELL_CMD_ARG(press, NULL,
+                  "Wall remote press <channel> <on|off|up|down> [steps]",
+                  cmd_sim_press, 3, 1),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), sim, &sim_cmds, "Mock radio and receiver model",
+                 cmd_sim_state, 1, 0);
+
+static struct stats_provider sim_stats = {
+    .name = "sim",
+    .format = sim_stats_format,
+};
+
+static int radio_mock_init(void)
+{
+  for (int i = 0; i <= RADIO_COUNT; i++)
+  {
+    k_mutex_init(&txs[i].busy);
+  }
+  stats_register(&sim_stats);
+  return 0;
+}
+
+SYS_INIT(radio_mock_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,344 @@
+#include "radio_power.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "latency.h"
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define HOLD_MS CONFIG_GETSMART_RADIO_HOLD_MS
+#define SLEEP_MS ((int64_t)CONFIG_GETSMART_RADIO_SLEEP_S * 1000)
+
+BUILD_ASSERT(SLEEP_MS >= HOLD_MS, "Radios would sleep before the hold ends");
+
+/* SX1278 datasheet, FSK: crystal oscillator and PLL start up, then the
+ * TX ramp of 5 us + 1.25 PaRamp (40 us) + half a bit */
+#define TS_OSC_US 250
+#define TS_FS_US 60
+#define TS_TR_US (5 + 50 + 500000 / RADIO_BITRATE_BPS)
+
+/* Supply current in each mode, nA, also from the datasheet */
+static const uint32_t mode_current_na[RADIO_MODE_COUNT] = {
+    [RADIO_MODE_SLEEP] = 200,
+    [RADIO_MODE_STANDBY] = 1600000,
+    [RADIO_MODE_FSTX] = 5800000,
+    [RADIO_MODE_RX] = 10800000,
+};
+
+static const char *const mode_names[RADIO_MODE_COUNT] = {
+    [RADIO_MODE_SLEEP] = "sleep",
+    [RADIO_MODE_STANDBY] = "standby",
+    [RADIO_MODE_FSTX] = "fstx",
+    [RADIO_MODE_RX] = "rx",
+};
+
+static const char *const policy_names[RADIO_POLICY_COUNT] = {
+    [RADIO_POLICY_FSTX] = "fstx",
+    [RADIO_POLICY_STANDBY] = "standby",
+    [RADIO_POLICY_SLEEP] = "sleep",
+};
+
+/* What each policy holds a radio in after activity */
+static const enum radio_mode policy_hold[RADIO_POLICY_COUNT] = {
+    [RADIO_POLICY_FSTX] = RADIO_MODE_FSTX,
+    [RADIO_POLICY_STANDBY] = RADIO_MODE_STANDBY,
+    [RADIO_POLICY_SLEEP] = RADIO_MODE_SLEEP,
+};
+
+struct power_radio {
+  /* Parked mode, RADIO_MODE_COUNT while the radio is in use */
+  enum radio_mode mode;
+  uint64_t since_us;
+  /* The hold and the sleep timeout run from the last activity */
+  int64_t last_ms;
+  /* Start of the command being timed, 0 for none */
+  uint64_t begin_us;
+};
+
+struct power_stats {
+  uint32_t cmds;
+  uint64_t first_bit_us;
+  uint32_t first_bit_max_us;
+  /* Commands that found the radio in each mode */
+  uint32_t from[RADIO_MODE_COUNT];
+  uint64_t idle_us[RADIO_MODE_COUNT];
+};
+
+static struct k_spinlock power_lock;
+static enum radio_policy policy =
+    IS_ENABLED(CONFIG_GETSMART_RADIO_POLICY_SLEEP)     ? RADIO_POLICY_SLEEP
+    : IS_ENABLED(CONFIG_GETSMART_RADIO_POLICY_STANDBY) ? RADIO_POLICY_STANDBY
+                                                       : RADIO_POLICY_FSTX;
+/* The backends start the radios in standby */
+static struct power_radio radios[RADIO_COUNT] = {
+    [0 ... RADIO_COUNT - 1] = {.mode = RADIO_MODE_STANDBY}};
+static struct power_stats stats[RADIO_POLICY_COUNT];
+
+uint32_t radio_power_ramp_us(enum radio_mode from)
+{
+  switch (from)
+  {
+  case RADIO_MODE_SLEEP:
+    return TS_OSC_US + TS_FS_US + TS_TR_US;
+  case RADIO_MODE_FSTX:
+    return TS_TR_US;
+  default:
+    return TS_FS_US + TS_TR_US;
+  }
+}
+
+/* Charge the time in the parked mode to the policy, call with power_lock */
+static void charge(struct power_radio *p, uint64_t now)
+{
+  if (p->mode < RADIO_MODE_COUNT)
+  {
+    stats[policy].idle_us[p->mode] += now - p->since_us;
+  }
+  p->since_us = now;
+}
+
+static void park(uint8_t radio, enum radio_mode mode)
+{
+  int err = radio_set_mode(radio, mode);
+
+  if (err == -ENOTSUP && mode == RADIO_MODE_FSTX)
+  {
+    mode = RADIO_MODE_STANDBY;
+    err = radio_set_mode(radio, mode);
+  }
+  if (err == -EBUSY)
+  {
+    /* Listening for the wall remote */
+    mode = RADIO_MODE_RX;
+  }
+  else if (err != 0)
+  {
+    LOG_WRN("Radio %d: failed to enter %s: %d", radio, mode_names[mode], err);
+    return;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&power_lock);
+  charge(&radios[radio], latency_now());
+  radios[radio].mode = mode;
+  k_spin_unlock(&power_lock, key);
+}
+
+void radio_power_begin(uint8_t radio, bool timed)
+{
+  struct power_radio *p = &radios[radio];
+  uint64_t now = latency_now();
+  k_spinlock_key_t key = k_spin_lock(&power_lock);
+
+  if (timed && p->mode < RADIO_MODE_COUNT)
+  {
+    stats[policy].from[p->mode]++;
+  }
+  charge(p, now);
+  p->mode = RADIO_MODE_COUNT;
+  p->begin_us = timed ? now : 0;
+  k_spin_unlock(&power_lock, key);
+}
+
+void radio_power_first_bit(uint8_t radio, uint64_t t_us)
+{
+  if (radio >= RADIO_COUNT)
+  {
+    return;
+  }
+
+  struct power_radio *p = &radios[radio];
+  k_spinlock_key_t key = k_spin_lock(&power_lock);
+
+  if (p->begin_us != 0)
+  {
+    struct power_stats *s = &stats[policy];
+    uint32_t us = (uint32_t)(t_us - MIN(t_us, p->begin_us));
+
+    s->cmds++;
+    s->first_bit_us += us;
+    s->first_bit_max_us = MAX(s->first_bit_max_us, us);
+    p->begin_us = 0;
+  }
+  k_spin_unlock(&power_lock, key);
+}
+
+void radio_power_end(uint8_t radio)
+{
+  radios[radio].begin_us = 0;
+  radios[radio].last_ms = k_uptime_get();
+  park(radio, policy_hold[policy]);
+}
+
+int32_t radio_power_idle(uint8_t radio)
+{
+  struct power_radio *p = &radios[radio];
+  int64_t idle = k_uptime_get() - p->last_ms;
+  enum radio_mode want = policy_hold[policy];
+
+  if (p->mode == RADIO_MODE_RX)
+  {
+    return SYS_FOREVER_MS;
+  }
+
+  if (idle >= HOLD_MS)
+  {
+    want = MIN(want, RADIO_MODE_STANDBY);
+  }
+  if (idle >= SLEEP_MS)
+  {
+    want = RADIO_MODE_SLEEP;
+  }
+  if (want != p->mode)
+  {
+    park(radio, want);
+  }
+
+  if (want == RADIO_MODE_FSTX)
+  {
+    return (int32_t)(HOLD_MS - idle);
+  }
+  if (want == RADIO_MODE_STANDBY)
+  {
+    return (int32_t)MIN(SLEEP_MS - idle, INT32_MAX);
+  }
+  return SYS_FOREVER_MS;
+}
+
+/* Idle current in nA, the time each mode was held for weighs it */
+static uint32_t idle_current_na(const struct power_stats *s, uint64_t *ms)
+{
+  uint64_t charge_na_ms = 0;
+
+  *ms = 0;
+  for (int m = 0; m < RADIO_MODE_COUNT; m++)
+  {
+    uint64_t mode_ms = s->idle_us[m] / 1000U;
+
+    charge_na_ms += mode_ms * mode_current_na[m];
+    *ms += mode_ms;
+  }
+  return (*ms == 0) ? 0 : (uint32_t)(charge_na_ms / *ms);
+}
+
+/* Stats and shell work on a copy, the lock is a spinlock */
+static void snapshot(struct power_stats *out)
+{
+  uint64_t now = latency_now();
+  k_spinlock_key_t key = k_spin_lock(&power_lock);
+
+  for (int r = 0; r < RADIO_COUNT; r++)
+  {
+    charge(&radios[r], now);
+  }
+  memcpy(out, stats, sizeof(stats));
+  k_spin_unlock(&power_lock, key);
+}
+
+static int power_stats_format(char *buf, size_t len)
+{
+  struct power_stats s[RADIO_POLICY_COUNT];
+  int n;
+
+  snapshot(s);
+  n = snprintf(buf, len,
+               "\"policy\":\"%s\",\"hold_ms\":%d,\"sleep_s\":%d,"
+               "\"policies\":{",
+               policy_names[policy], HOLD_MS, CONFIG_GETSMART_RADIO_SLEEP_S);
+  for (int i = 0; i < RADIO_POLICY_COUNT && n < len; i++)
+  {
+    uint64_t ms;
+    uint32_t na = idle_current_na(&s[i], &ms);
+
+    n += snprintf(buf + n, len - n,
+                  "%s\"%s\":{\"cmds\":%u,\"first_bit_us\":%u,"
+                  "\"first_bit_max_us\":%u,\"idle_s\":%u,"
+                  "\"idle_ua\":%u.%03u}",
+                  (i > 0) ? "," : "", policy_names[i], s[i].cmds,
+                  (unsigned int)(s[i].first_bit_us / MAX(s[i].cmds, 1U)),
+                  s[i].first_bit_max_us, (unsigned int)(ms / 1000U),
+                  na / 1000U, na % 1000U);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "}");
+  }
+  return n;
+}
+
+static int cmd_power(const struct shell *sh, size_t argc, char **argv)
+{
+  struct power_stats s[RADIO_POLICY_COUNT];
+
+  snapshot(s);
+  shell_print(sh, "policy %s, hold %d ms, sleep after %d s",
+              policy_names[policy], HOLD_MS, CONFIG_GETSMART_RADIO_SLEEP_S);
+  shell_print(sh, "%-8s %6s %10s %10s %8s %10s  %s", "policy", "cmds",
+              "bit_us", "max_us", "idle_s", "idle_ua", "from sleep/stdby/fstx");
+  for (int i = 0; i < RADIO_POLICY_COUNT; i++)
+  {
+    uint64_t ms;
+    uint32_t na = idle_current_na(&s[i], &ms);
+
+    shell_print(sh, "%-8s %6u %10u %10u %8u %6u.%03u  %u/%u/%u",
+                policy_names[i], s[i].cmds,
+                (unsigned int)(s[i].first_bit_us / MAX(s[i].cmds, 1U)),
+                s[i].first_bit_max_us, (unsigned int)(ms / 1000U),
+                na / 1000U, na % 1000U, s[i].from[RADIO_MODE_SLEEP],
+                s[i].from[RADIO_MODE_STANDBY], s[i].from[RADIO_MODE_FSTX]);
+  }
+  return 0;
+}
+
+/* Applies from each radio's next command, or its next idle step */
+static int cmd_power_policy(const struct shell *sh, size_t argc, char **argv)
+{
+  for (int i = 0; i < RADIO_POLICY_COUNT; i++)
+  {
+    if (strcmp(argv[1], policy_names[i]) == 0)
+    {
+      uint64_t now = latency_now();
+      k_spinlock_key_t key = k_spin_lock(&power_lock);
+
+      for (int r = 0; r < RADIO_COUNT; r++)
+      {
+        charge(&radios[r], now);
+      }
+      policy = i;
+      k_spin_unlock(&power_lock, key);
+      shell_print(sh, "Radio power policy %s", policy_names[i]);
+      return 0;
+    }
+  }
+  shell_error(sh, "Policy is one of fstx, standby or sleep");
+  return -EINVAL;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    power_cmds,
+    SHELL_CMD_ARG(policy, NULL, "Switch policy <fstx|standby|sleep>",
+                  cmd_power_policy, 2, 0),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), power, &power_cmds,
+                 "Radio power policies, first bit latency and idle current",
+                 cmd_power, 1, 0);
+
+static struct stats_provider power_stats = {
+    .name = "power",
+    .format = power_stats_format,
+};
+
+static int radio_power_init(void)
+{
+  stats_register(&power_stats);
+  return 0;
+}
+
+SYS_INIT(radio_power_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,77 @@
+#ifndef __GET_RADIO_POWER__
+#define __GET_RADIO_POWER__
+#include <stdbool.h>
+#include <stdint.h>
+#include <zephyr/kernel.h>
+
+#include "radio.h"
+
+/**
+ * What a radio is left in between commands. After activity a radio is
+ * held in the policy's mode for GETSMART_RADIO_HOLD_MS, FSTX keeps the
+ * synthesizer locked so the next frame only waits for the PA ramp. It
+ * then drops to standby and after GETSMART_RADIO_SLEEP_S without
+ * activity to sleep. The TX worker of each radio drives this, see
+ * tx_sched.c. Every policy keeps its own command to first bit times
+ * and idle current estimate, so they can be compared by switching with
+ * 'gs power policy'.
+ */
+enum radio_policy {
+  RADIO_POLICY_FSTX,
+  RADIO_POLICY_STANDBY,
+  RADIO_POLICY_SLEEP,
+  RADIO_POLICY_COUNT
+};
+
+#if defined(CONFIG_GETSMART_RADIO_POWER)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    /* A command (timed) or a re-home starts on the radio */
+    void radio_power_begin(uint8_t radio, bool timed);
+    /* The first bit of the command went on air, from the backends */
+    void radio_power_first_bit(uint8_t radio, uint64_t t_us);
+    /* Done with the radio, park it per the policy */
+    void radio_power_end(uint8_t radio);
+    /**
+     * Move an idle radio on to its next mode once due. Returns the ms
+     * until it is next due, SYS_FOREVER_MS if it stays put.
+     */
+    int32_t radio_power_idle(uint8_t radio);
+    /* Datasheet time from TX mode being set to the first bit */
+    uint32_t radio_power_ramp_us(enum radio_mode from);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline void radio_power_begin(uint8_t radio, bool timed)
+{
+  (void)radio;
+  (void)timed;
+}
+static inline void radio_power_first_bit(uint8_t radio, uint64_t t_us)
+{
+  (void)radio;
+  (void)t_us;
+}
+static inline void radio_power_end(uint8_t radio) { (void)radio; }
+static inline int32_t radio_power_idle(uint8_t radio)
+{
+  (void)radio;
+  return SYS_FOREVER_MS;
+}
+static inline uint32_t radio_power_ramp_us(enum radio_mode from)
+{
+  (void)from;
+  return 0;
+}
+
+#endif
+
+#endif /*__GET_RADIO_POWER__*/
@@ -0,0 +1,586 @@
+#include <errno.h>
+#include <stdio.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/drivers/gpio.h>
+#include <zephyr/drivers/spi.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+
+#include "airtime.h"
+#include "latency.h"
+#include "radio.h"
+#include "radio_power.h"
+#include "remote_rx.h"
+#include "stats.h"
+#include "trace.h"
+
+LOG_MODULE_REGISTER(gs_radio, CONFIG_GETSMART_LOG_LEVEL);
+
+/**
+ * SX1278 FSK driver for the semtech,sx1278 nodes, in place of RadioLib.
+ * The modem is configured once at boot with the same packet format as
+ * radio.cpp's beginFSK(). A frame is then one burst write of the FIFO,
+ * a write of RegOpMode to start it and one to return to standby, or
+ * FSTX while the power policy holds it there, when DIO0 signals
+ * PacketSent. Frames are 13 bytes on the bus, well inside the 64 byte
+ * buffer of the ESP32 SPI controller, so each transaction goes out in
+ * one go without DMA.
+ */
+#define DEFAULT_RADIO_NODE DT_ALIAS(radio0)
+BUILD_ASSERT(DT_NODE_HAS_STATUS(DEFAULT_RADIO_NODE, okay),
+             "No default sx1278 radio specified in DT");
+
+/* Registers, FSK/OOK page */
+#define REG_FIFO 0x00
+#define REG_OP_MODE 0x01
+#define REG_BITRATE_MSB 0x02
+#define REG_PA_CONFIG 0x09
+#define REG_LNA 0x0C
+#define REG_RX_BW 0x12
+#define REG_PREAMBLE_MSB 0x25
+#define REG_SYNC_CONFIG 0x27
+#define REG_FIFO_THRESH 0x35
+#define REG_IRQ_FLAGS2 0x3F
+#define REG_DIO_MAPPING1 0x40
+#define REG_VERSION 0x42
+
+#define SPI_WRITE 0x80
+#define SX1278_VERSION 0x12
+
+/* RegOpMode, FSK with the low frequency registers for 433 MHz */
+#define OP_MODE_LF 0x08
+#define MODE_SLEEP 0x00
+#define MODE_STDBY 0x01
+#define MODE_FSTX 0x02
+#define MODE_TX 0x03
+#define MODE_RX 0x05
+
+#define IRQ2_PACKET_SENT BIT(3)
+
+/* The modulation beginFSK(433.978, 1.6, 30.0, 7.8, 8, 0) sets up */
+#define FXOSC_HZ 32000000ULL
+#define FREQ_HZ 433978000ULL
+#define FDEV_HZ 30000ULL
+#define FRF ((FREQ_HZ << 19) / FXOSC_HZ)
+#define FDEV ((FDEV_HZ << 19) / FXOSC_HZ)
+#define BITRATE (FXOSC_HZ / RADIO_BITRATE_BPS)
+/* PA_BOOST, 8 dBm */
+#define PA_CONFIG (0x80 | 0x70 | (8 - 2))
+/* Highest LNA gain with the HF boost, as setGain(1), AGC off */
+#define LNA_CONFIG 0x23
+#define RX_CONFIG 0x00
+/* 7.8 kHz, mantissa 16 and exponent 6, for both RX and AFC */
+#define RX_BW 0x06
+/* Start sending as soon as the FIFO has a byte */
+#define FIFO_THRESH 0x8F
+
+/* Contiguous registers written in one burst */
+struct reg_block {
+  uint8_t addr;
+  uint8_t len;
+  uint8_t val[12];
+};
+
+static const struct reg_block fsk_config[] = {
+    {REG_BITRATE_MSB,
+     7,
+     {BITRATE >> 8, BITRATE & 0xFF, FDEV >> 8, FDEV & 0xFF, (FRF >> 16) & 0xFF,
+      (FRF >> 8) & 0xFF, FRF & 0xFF}},
+    {REG_PA_CONFIG, 1, {PA_CONFIG}},
+    {REG_LNA, 2, {LNA_CONFIG, RX_CONFIG}},
+    {REG_RX_BW, 2, {RX_BW, RX_BW}},
+    {REG_PREAMBLE_MSB, 2, {0, 0}},
+    {REG_FIFO_THRESH, 1, {FIFO_THRESH}},
+    /* DIO0 is PacketSent in TX and PayloadReady in RX */
+    {REG_DIO_MAPPING1, 1, {0x00}},
+};
+
+/*
+ * RegSyncConfig to RegPayloadLength. Our frames: 2 byte sync word,
+ * variable length with CRC. Remote frames: the GET header as the sync
+ * word, fixed length, no CRC. Both restart RX after each packet.
+ */
+static const struct reg_block tx_format = {
+    REG_SYNC_CONFIG,
+    12,
+    {0x51, 0x12, 0xAD, 0, 0, 0, 0, 0, 0, 0x90, 0x40, 0xFF}};
+
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+static const struct reg_block rx_format = {
+    REG_SYNC_CONFIG,
+    12,
+    {0x55, 0x54, 0x2A, 0xAA, 0xA5, 0x55, 0x55, 0, 0, 0x00, 0x40,
+     RADIO_CODE_LEN}};
+#endif
+
+struct sx1278_cfg {
+  struct spi_dt_spec spi;
+  struct gpio_dt_spec reset;
+  struct gpio_dt_spec dio0;
+};
+
+#define SX1278_CFG(node)                                                       \
+  {                                                                            \
+      .spi = SPI_DT_SPEC_GET(node, SPI_WORD_SET(8) | SPI_TRANSFER_MSB, 0),     \
+      .reset = GPIO_DT_SPEC_GET_OR(node, reset_gpios, {0}),                    \
+      .dio0 = GPIO_DT_SPEC_GET_BY_IDX_OR(node, dio_gpios, 0, {0}),             \
+  },
+
+static const struct sx1278_cfg cfgs[] = {
+    DT_FOREACH_STATUS_OKAY(semtech_sx1278, SX1278_CFG)};
+BUILD_ASSERT(ARRAY_SIZE(cfgs) == RADIO_COUNT);
+
+struct sx1278 {
+  const struct sx1278_cfg *cfg;
+  struct gpio_callback dio0_cb;
+  struct k_sem tx_done;
+  uint8_t mode;
+  /* Where a frame leaves the radio, FSTX while the policy holds it there */
+  uint8_t park;
+  bool ready;
+  /* For the radio stats */
+  uint32_t frames;
+  uint32_t spi_xfers;
+  /* Time spent per frame beyond its time on air */
+  uint64_t overhead_us;
+};
+
+static struct sx1278 radios[RADIO_COUNT];
+
+static int reg_write(struct sx1278 *r, uint8_t addr, const uint8_t *val,
+                     size_t len)
+{
+  uint8_t cmd = addr | SPI_WRITE;
+  const struct spi_buf bufs[] = {
+      {.buf = &cmd, .len = 1},
+      {.buf = (uint8_t *)val, .len = len},
+  };
+  const struct spi_buf_set tx = {.buffers = bufs, .count = ARRAY_SIZE(bufs)};
+
+  r->spi_xfers++;
+  return spi_write_dt(&r->cfg->spi, &tx);
+}
+
+static int reg_read(struct sx1278 *r, uint8_t addr, uint8_t *val, size_t len)
+{
+  const struct spi_buf tx_buf = {.buf = &addr, .len = 1};
+  const struct spi_buf_set tx = {.buffers = &tx_buf, .count = 1};
+  const struct spi_buf rx_bufs[] = {
+      {.buf = NULL, .len = 1},
+      {.buf = val, .len = len},
+  };
+  const struct spi_buf_set rx = {.buffers = rx_bufs,
+                                 .count = ARRAY_SIZE(rx_bufs)};
+
+  r->spi_xfers++;
+  return spi_transceive_dt(&r->cfg->spi, &tx, &rx);
+}
+
+static int write_block(struct sx1278 *r, const struct reg_block *b)
+{
+  return reg_write(r, b->addr, b->val, b->len);
+}
+
+static int set_mode(struct sx1278 *r, uint8_t mode)
+{
+  uint8_t val = OP_MODE_LF | mode;
+
+  r->mode = mode;
+  return reg_write(r, REG_OP_MODE, &val, 1);
+}
+
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+/* Back to RX once the radio has been idle this long after a TX, so a
+ * dim sequence is not slowed down by reconfiguring between frames */
+#define RX_RESUME_MS 20
+
+/* The radio that listens, the others only transmit */
+#define RX_RADIO 0
+
+/* The RX thread and the TX path both talk to the RX radio */
+static K_MUTEX_DEFINE(radio_lock);
+static bool rx_active;
+static bool rx_started;
+
+static void rx_resume_handler(struct k_work *work);
+static K_WORK_DELAYABLE_DEFINE(rx_resume_work, rx_resume_handler);
+
+static int rx_enter(void)
+{
+  struct sx1278 *r = &radios[RX_RADIO];
+  int err = write_block(r, &rx_format);
+
+  if (err == 0)
+  {
+    err = set_mode(r, MODE_RX);
+  }
+  rx_active = (err == 0);
+  return err;
+}
+
+static int rx_leave(void)
+{
+  struct sx1278 *r = &radios[RX_RADIO];
+
+  rx_active = false;
+  int err = set_mode(r, MODE_STDBY);
+  if (err == 0)
+  {
+    err = write_block(r, &tx_format);
+  }
+  return err;
+}
+
+static void rx_resume_handler(struct k_work *work)
+{
+  k_mutex_lock(&radio_lock, K_FOREVER);
+  int err = rx_enter();
+  k_mutex_unlock(&radio_lock);
+  if (err != 0)
+  {
+    LOG_ERR("Failed to enter RX: %d", err);
+  }
+}
+#endif
+
+/* DIO0, PacketSent while sending and PayloadReady while listening */
+static void dio0_isr(const struct device *port, struct gpio_callback *cb,
+                     uint32_t pins)
+{
+  struct sx1278 *r = CONTAINER_OF(cb, struct sx1278, dio0_cb);
+
+  if (r->mode == MODE_TX)
+  {
+    k_sem_give(&r->tx_done);
+  }
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+  else if (r->mode == MODE_RX)
+  {
+    remote_rx_irq(latency_now());
+  }
+#endif
+}
+
+/* Without DIO0 wired the flags are polled once the frame should be out */
+static int wait_sent(struct sx1278 *r, uint32_t airtime_us)
+{
+  k_timeout_t timeout = K_USEC(2 * airtime_us + 10000);
+
+  if (r->cfg->dio0.port != NULL)
+  {
+    return k_sem_take(&r->tx_done, timeout);
+  }
+
+  k_sleep(K_USEC(airtime_us));
+  for (int i = 0; i < 10; i++)
+  {
+    uint8_t flags = 0;
+    int err = reg_read(r, REG_IRQ_FLAGS2, &flags, 1);
+
+    if (err != 0 || (flags & IRQ2_PACKET_SENT))
+    {
+      return err;
+    }
+    k_sleep(K_MSEC(1));
+  }
+  return -ETIMEDOUT;
+}
+
+/* The mode the power policy sees the radio in */
+static enum radio_mode power_mode(uint8_t mode)
+{
+  switch (mode)
+  {
+  case MODE_SLEEP:
+    return RADIO_MODE_SLEEP;
+  case MODE_FSTX:
+    return RADIO_MODE_FSTX;
+  case MODE_RX:
+    return RADIO_MODE_RX;
+  default:
+    return RADIO_MODE_STANDBY;
+  }
+}
+
+/* Length byte and payload in one burst, then TX until PacketSent */
+static int tx_frame(struct sx1278 *r, const uint8_t *msg, uint8_t len)
+{
+  uint8_t hdr[2] = {REG_FIFO | SPI_WRITE, len};
+  const struct spi_buf bufs[] = {
+      {.buf = hdr, .len = sizeof(hdr)},
+      {.buf = (uint8_t *)msg, .len = len},
+  };
+  const struct spi_buf_set tx = {.buffers = bufs, .count = ARRAY_SIZE(bufs)};
+  uint64_t start = latency_now();
+  int err = 0;
+
+  k_sem_reset(&r->tx_done);
+  /* The FIFO can't be written in sleep */
+  if (r->mode == MODE_SLEEP)
+  {
+    err = set_mode(r, MODE_STDBY);
+  }
+  enum radio_mode from = power_mode(r->mode);
+  if (err == 0)
+  {
+    r->spi_xfers++;
+    err = spi_write_dt(&r->cfg->spi, &tx);
+  }
+  if (err == 0)
+  {
+    err = set_mode(r, MODE_TX);
+  }
+  if (err == 0)
+  {
+    radio_power_first_bit(r - radios,
+                          latency_now() + radio_power_ramp_us(from));
+    err = wait_sent(r, radio_airtime_us(len));
+  }
+  /* Standby after a failure, it also empties the FIFO */
+  int stdby = set_mode(r, (err == 0) ? r->park : MODE_STDBY);
+
+  uint64_t spent = latency_now() - start;
+
+  r->frames++;
+  r->overhead_us += spent - MIN(spent, (uint64_t)radio_airtime_us(len));
+  return (err != 0) ? err : stdby;
+}
+
+static int radio_init_one(struct sx1278 *r, const struct sx1278_cfg *cfg)
+{
+  const char *name = cfg->spi.bus->name;
+  uint8_t version = 0;
+  int err;
+
+  r->cfg = cfg;
+  r->park = MODE_STDBY;
+  k_sem_init(&r->tx_done, 0, 1);
+
+  if (!spi_is_ready_dt(&cfg->spi))
+  {
+    LOG_ERR("[%s] SPI not ready", name);
+    return -ENODEV;
+  }
+
+  /* NRESET is pulled low for 100 us then let go, ready 5 ms later */
+  if (cfg->reset.port != NULL)
+  {
+    gpio_pin_configure(cfg->reset.port, cfg->reset.pin, GPIO_OUTPUT_LOW);
+    k_busy_wait(100);
+    gpio_pin_configure(cfg->reset.port, cfg->reset.pin, GPIO_INPUT);
+    k_msleep(5);
+  }
+
+  err = reg_read(r, REG_VERSION, &version, 1);
+  if (err != 0 || version != SX1278_VERSION)
+  {
+    LOG_ERR("[%s] No SX1278, version 0x%02x err %d", name, version, err);
+    return -ENODEV;
+  }
+
+  /* LoRa or FSK can only be changed in sleep */
+  err = set_mode(r, MODE_SLEEP);
+  if (err == 0)
+  {
+    err = set_mode(r, MODE_STDBY);
+  }
+  for (int i = 0; err == 0 && i < ARRAY_SIZE(fsk_config); i++)
+  {
+    err = write_block(r, &fsk_config[i]);
+  }
+  if (err == 0)
+  {
+    err = write_block(r, &tx_format);
+  }
+  if (err != 0)
+  {
+    LOG_ERR("[%s] Failed to configure FSK: %d", name, err);
+    return err;
+  }
+
+  if (cfg->dio0.port != NULL)
+  {
+    gpio_pin_configure_dt(&cfg->dio0, GPIO_INPUT);
+    gpio_init_callback(&r->dio0_cb, dio0_isr, BIT(cfg->dio0.pin));
+    gpio_add_callback(cfg->dio0.port, &r->dio0_cb);
+    gpio_pin_interrupt_configure_dt(&cfg->dio0, GPIO_INT_EDGE_TO_ACTIVE);
+  }
+
+  r->ready = true;
+  LOG_INF("[%s] SX1278 ready, %u SPI transactions to configure", name,
+          r->spi_xfers);
+  return 0;
+}
+
+int radio_init()
+{
+  int err = 0;
+
+  for (int i = 0; i < RADIO_COUNT; i++)
+  {
+    int res = radio_init_one(&radios[i], &cfgs[i]);
+    if (res != 0)
+    {
+      err = res;
+    }
+  }
+  return err;
+}
+
+/* The repeats are redundancy, fails only if none of them went out */
+int radio_tx_repeat(uint8_t radio, uint8_t *msg, uint8_t len, uint8_t count)
+{
+  if (radio >= RADIO_COUNT || !radios[radio].ready)
+  {
+    return -ENODEV;
+  }
+
+  struct sx1278 *r = &radios[radio];
+  int sent = 0;
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+  if (radio == RX_RADIO)
+  {
+    k_mutex_lock(&radio_lock, K_FOREVER);
+    k_work_cancel_delayable(&rx_resume_work);
+    if (rx_active)
+    {
+      int err = rx_leave();
+      if (err != 0)
+      {
+        LOG_ERR("Failed to leave RX: %d", err);
+      }
+    }
+  }
+#endif
+  for (int i = 0; i < count; i++)
+  {
+    latency_mark(LAT_STAGE_FIRST_TX);
+    int err = tx_frame(r, msg, len);
+    if (err != 0)
+    {
+      TRACE(TR_RADIO_TX_ERR, TRACE_CODE(msg), err);
+    }
+    else
+    {
+      TRACE(TR_RADIO_TX, TRACE_CODE(msg), len);
+      airtime_charge(radio, radio_airtime_us(len));
+      remote_rx_note_tx(TRACE_CODE(msg), latency_now());
+      sent++;
+    }
+  }
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+  if (radio == RX_RADIO)
+  {
+    if (rx_started)
+    {
+      k_work_reschedule(&rx_resume_work, K_MSEC(RX_RESUME_MS));
+    }
+    k_mutex_unlock(&radio_lock);
+  }
+#endif
+  return (sent > 0) ? 0 : -EIO;
+}
+
+int radio_tx(uint8_t radio, uint8_t *msg, uint8_t len)
+{
+  return radio_tx_repeat(radio, msg, len, 1);
+}
+
+int radio_set_mode(uint8_t radio, enum radio_mode mode)
+{
+  static const uint8_t modes[] = {
+      [RADIO_MODE_SLEEP] = MODE_SLEEP,
+      [RADIO_MODE_STANDBY] = MODE_STDBY,
+      [RADIO_MODE_FSTX] = MODE_FSTX,
+  };
+
+  if (radio >= RADIO_COUNT || !radios[radio].ready)
+  {
+    return -ENODEV;
+  }
+  if (mode >= ARRAY_SIZE(modes))
+  {
+    return -EINVAL;
+  }
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+  if (radio == RX_RADIO && rx_started)
+  {
+    return -EBUSY;
+  }
+#endif
+
+  struct sx1278 *r = &radios[radio];
+
+  r->park = (mode == RADIO_MODE_FSTX) ? MODE_FSTX : MODE_STDBY;
+  return (r->mode == modes[mode]) ? 0 : set_mode(r, modes[mode]);
+}
+
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+int radio_rx_start(void)
+{
+  if (!radios[RX_RADIO].ready)
+  {
+    return -ENODEV;
+  }
+  if (radios[RX_RADIO].cfg->dio0.port == NULL)
+  {
+    LOG_ERR("Remote RX needs DIO0 wired");
+    return -ENOTSUP;
+  }
+  rx_started = true;
+  k_work_reschedule(&rx_resume_work, K_NO_WAIT);
+  return 0;
+}
+
+/* Called by the RX thread after PayloadReady, the FIFO holds the code.
+ * RX restarts by itself once it's read. */
+int radio_rx_read(uint8_t *code, uint8_t len)
+{
+  k_mutex_lock(&radio_lock, K_FOREVER);
+  if (!rx_active)
+  {
+    k_mutex_unlock(&radio_lock);
+    return -EAGAIN;
+  }
+  int err = reg_read(&radios[RX_RADIO], REG_FIFO, code, len);
+  k_mutex_unlock(&radio_lock);
+  return (err == 0) ? 0 : -EIO;
+}
+#else
+int radio_rx_start(void) { return -ENOTSUP; }
+int radio_rx_read(uint8_t *code, uint8_t len) { return -ENOTSUP; }
+#endif
+
+static int radio_stats_format(char *buf, size_t len)
+{
+  int n = snprintf(buf, len, "\"backend\":\"sx1278\",\"radios\":[");
+
+  for (int i = 0; i < RADIO_COUNT && n < len; i++)
+  {
+    const struct sx1278 *r = &radios[i];
+    uint32_t frames = MAX(r->frames, 1U);
+
+    n += snprintf(buf + n, len - n,
+                  "%s{\"frames\":%u,\"spi_xfers\":%u,\"overhead_us\":%u}",
+                  (i > 0) ? "," : "", r->frames, r->spi_xfers,
+                  (unsigned int)(r->overhead_us / frames));
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "]");
+  }
+  return n;
+}
+
+static struct stats_provider radio_stats = {
+    .name = "radio",
+    .format = radio_stats_format,
+};
+
+static int radio_stats_init(void)
+{
+  stats_register(&radio_stats);
+  return 0;
+}
+
+SYS_INIT(radio_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
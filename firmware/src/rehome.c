@@ -0,0 +1,198 @@
+#include "rehome.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "airtime.h"
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define IDLE_MS ((int64_t)CONFIG_GETSMART_REHOME_IDLE_S * 1000)
+
+static controller_t *controller;
+static struct k_spinlock rehome_lock;
+/* When each light was last re-homed, -1 for never */
+static int64_t homed_at[CHANNEL_COUNT] = {[0 ... CHANNEL_COUNT - 1] = -1};
+/* Lights that are on are only re-homed before this uptime */
+static int64_t window_until;
+/* Lights to re-home whatever their state, from 'gs rehome now' */
+static uint32_t forced;
+static int next_light;
+
+static struct {
+  uint32_t done;
+  uint32_t cut_short;
+  uint32_t failed;
+  uint32_t airtime_waits;
+} rehome_stats;
+
+/**
+ * Changed since it was last re-homed and idle long enough. A light whose
+ * state was never set is left alone, it may have been left on before a
+ * reboot or switched at the wall.
+ */
+static bool rehome_due(int ch, int64_t now, bool window_open)
+{
+  k_spinlock_key_t key = k_spin_lock(&controller->state_lock);
+  int64_t changed_at = controller->changed_at[ch];
+  bool on = controller->latest[ch].state == STATE_ON;
+  k_spin_unlock(&controller->state_lock, key);
+
+  if (forced & BIT(ch))
+  {
+    return true;
+  }
+  return changed_at > 0 && homed_at[ch] < changed_at &&
+         now - changed_at >= IDLE_MS && (!on || window_open);
+}
+
+int rehome_pick(void)
+{
+  int64_t now = k_uptime_get();
+  int n = controller->num_lights;
+  int picked = -1;
+
+  k_spinlock_key_t key = k_spin_lock(&rehome_lock);
+  bool window_open = now < window_until;
+
+  for (int i = 0; i < n && picked < 0; i++)
+  {
+    int ch = (next_light + i) % n;
+
+    if (!rehome_due(ch, now, window_open))
+    {
+      continue;
+    }
+    /* Never the reserve, that is for live commands */
+    if (airtime_delay_ms(controller_rehome_airtime_us(controller, ch),
+                         true) > 0)
+    {
+      rehome_stats.airtime_waits++;
+      continue;
+    }
+    picked = ch;
+    next_light = ch + 1;
+  }
+  k_spin_unlock(&rehome_lock, key);
+  return picked;
+}
+
+void rehome_done(int channel, int err)
+{
+  k_spinlock_key_t key = k_spin_lock(&rehome_lock);
+  homed_at[channel] = k_uptime_get();
+  forced &= ~BIT(channel);
+  if (err == 0)
+  {
+    rehome_stats.done++;
+  }
+  else if (err == -EINTR)
+  {
+    rehome_stats.cut_short++;
+  }
+  else
+  {
+    rehome_stats.failed++;
+  }
+  k_spin_unlock(&rehome_lock, key);
+
+  if (err != 0 && err != -EINTR)
+  {
+    LOG_ERR("Channel %d: re-home failed: %d", channel, err);
+  }
+}
+
+static int rehome_stats_format(char *buf, size_t len)
+{
+  int64_t now = k_uptime_get();
+
+  return snprintf(buf, len,
+                  "\"done\":%u,\"cut_short\":%u,\"failed\":%u,"
+                  "\"airtime_waits\":%u,\"window_s\":%u",
+                  rehome_stats.done, rehome_stats.cut_short,
+                  rehome_stats.failed, rehome_stats.airtime_waits,
+                  (unsigned int)(MAX(window_until - now, 0) / 1000));
+}
+
+static int cmd_rehome(const struct shell *sh, size_t argc, char **argv)
+{
+  int64_t now = k_uptime_get();
+
+  shell_print(sh, "%u done, %u cut short, %u failed, window %u s",
+              rehome_stats.done, rehome_stats.cut_short, rehome_stats.failed,
+              (unsigned int)(MAX(window_until - now, 0) / 1000));
+  for (int ch = 0; ch < controller->num_lights; ch++)
+  {
+    int64_t homed = homed_at[ch];
+
+    if (homed < 0)
+    {
+      shell_print(sh, "  light %-3d never", ch);
+    }
+    else
+    {
+      shell_print(sh, "  light %-3d %u s ago", ch,
+                  (unsigned int)((now - homed) / 1000));
+    }
+  }
+  return 0;
+}
+
+/* Let lights that are on be re-homed for the next <minutes> */
+static int cmd_rehome_window(const struct shell *sh, size_t argc, char **argv)
+{
+  int minutes = atoi(argv[1]);
+
+  if (minutes < 0)
+  {
+    shell_error(sh, "Minutes must be 0 or more");
+    return -EINVAL;
+  }
+  k_spinlock_key_t key = k_spin_lock(&rehome_lock);
+  window_until = k_uptime_get() + (int64_t)minutes * 60 * 1000;
+  k_spin_unlock(&rehome_lock, key);
+  shell_print(sh, "Lights that are on re-homed for %d minutes", minutes);
+  return 0;
+}
+
+/* Re-home a light as soon as a radio is free, whatever its state */
+static int cmd_rehome_now(const struct shell *sh, size_t argc, char **argv)
+{
+  int ch = atoi(argv[1]);
+
+  if (ch < 0 || ch >= controller->num_lights)
+  {
+    shell_error(sh, "No light %d", ch);
+    return -EINVAL;
+  }
+  k_spinlock_key_t key = k_spin_lock(&rehome_lock);
+  forced |= BIT(ch);
+  k_spin_unlock(&rehome_lock, key);
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    rehome_cmds,
+    SHELL_CMD_ARG(window, NULL, "Re-home lights that are on <minutes>",
+                  cmd_rehome_window, 2, 0),
+    SHELL_CMD_ARG(now, NULL, "Re-home a light <light>", cmd_rehome_now, 2, 0),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), rehome, &rehome_cmds, "Light re-homing", cmd_rehome, 1,
+                 0);
+
+static struct stats_provider rehome_stats_provider = {
+    .name = "rehome",
+    .format = rehome_stats_format,
+};
+
+void rehome_init(controller_t *ctrl)
+{
+  controller = ctrl;
+  stats_register(&rehome_stats_provider);
+}
@@ -0,0 +1,45 @@
+#ifndef __GET_REHOME__
+#define __GET_REHOME__
+#include <stdint.h>
+
+#include "controller.h"
+
+/**
+ * Dim steps are open loop, lost frames leave a receiver at a different
+ * level from controller->state[]. Lights are re-homed, driven to a
+ * level they are known to be at and back, once they have been left
+ * alone for GETSMART_REHOME_IDLE_S: lights that are off right away,
+ * lights that are on only during a window opened with 'gs rehome
+ * window'. A TX worker re-homes a light only while its queue is empty
+ * and gives the radio back to a queued command after the current dim
+ * pair, see tx_sched.c.
+ */
+#if defined(CONFIG_GETSMART_REHOME)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void rehome_init(controller_t *controller);
+    /* The next light due, -1 if none */
+    int rehome_pick(void);
+    void rehome_done(int channel, int err);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline void rehome_init(controller_t *controller) { (void)controller; }
+static inline int rehome_pick(void) { return -1; }
+static inline void rehome_done(int channel, int err)
+{
+  (void)channel;
+  (void)err;
+}
+
+#endif
+
+#endif /*__GET_REHOME__*/
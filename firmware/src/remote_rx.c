@@ -0,0 +1,201 @@
+#include "remote_rx.h"
+
+#include <stdio.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "affinity.h"
+#include "get_model.h"
+#include "latency.h"
+#include "radio.h"
+#include "stats.h"
+#include "trace.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define REMOTE_RX_STACK_SIZE 1536
+#define REMOTE_RX_PRIORITY 2
+
+/* Our last transmissions, a frame repeats at most 4 times per command */
+#define ECHO_SLOTS 8
+#define ECHO_WINDOW_US (CONFIG_GETSMART_REMOTE_ECHO_MS * 1000U)
+
+/* Time on air of a remote frame, the IRQ comes at its end */
+#define REMOTE_FRAME_US                                                  \
+  (((RADIO_GET_HEADER_LEN + RADIO_CODE_LEN) * 8U * 1000000U) /           \
+   RADIO_BITRATE_BPS)
+
+struct echo {
+  uint32_t code;
+  uint64_t t_end_us;
+};
+
+struct remote_rx_stats {
+  uint32_t irqs;
+  uint32_t overruns;
+  uint32_t frames;
+  uint32_t read_errors;
+  uint32_t echoes;
+  uint32_t unknown;
+  uint32_t changes;
+  uint32_t last_us;
+  uint32_t max_us;
+};
+
+/* Packet end timestamps from the ISR */
+K_MSGQ_DEFINE(rx_msgq, sizeof(uint64_t), CONFIG_GETSMART_REMOTE_RX_QUEUE, 8);
+
+static controller_t *controller;
+/* The lights as the wall remote drives them, seeded from the controller */
+static struct get_model remote_model;
+static struct echo echoes[ECHO_SLOTS];
+static uint32_t echo_head;
+static struct k_spinlock echo_lock;
+static struct remote_rx_stats rx_stats;
+
+void remote_rx_irq(uint64_t t_us)
+{
+  rx_stats.irqs++;
+  if (k_msgq_put(&rx_msgq, &t_us, K_NO_WAIT) != 0)
+  {
+    rx_stats.overruns++;
+  }
+}
+
+void remote_rx_note_tx(uint32_t code, uint64_t t_end_us)
+{
+  k_spinlock_key_t key = k_spin_lock(&echo_lock);
+  echoes[echo_head++ % ECHO_SLOTS] = (struct echo){code, t_end_us};
+  k_spin_unlock(&echo_lock, key);
+}
+
+static bool is_echo(uint32_t code, uint64_t t_us)
+{
+  bool echo = false;
+  k_spinlock_key_t key = k_spin_lock(&echo_lock);
+
+  for (int i = 0; i < ECHO_SLOTS && !echo; i++)
+  {
+    echo = (echoes[i].code == code && echoes[i].t_end_us != 0 &&
+            t_us < echoes[i].t_end_us + ECHO_WINDOW_US);
+  }
+  k_spin_unlock(&echo_lock, key);
+  return echo;
+}
+
+static void remote_rx_frame(uint8_t *frame, uint64_t t_us)
+{
+  uint32_t code = TRACE_CODE(frame);
+  struct light_state ls;
+  int ch;
+
+  if (is_echo(code, t_us))
+  {
+    rx_stats.echoes++;
+    TRACE(TR_REMOTE_RX, code, -EALREADY);
+    return;
+  }
+
+  /* Frames for one light are decoded against its current state, held
+   * while the result is tracked. Dim pulse 0 only arms the lights. */
+  int light = get_model_lookup(code);
+  if (light >= 0 && light < controller->num_lights)
+  {
+    k_mutex_lock(&controller->light_lock[light], K_FOREVER);
+    get_model_set_state(&remote_model, light, &controller->state[light]);
+  }
+
+  ch = get_model_rx(&remote_model, frame, TRANSMIT_BUF_SIZE,
+                    t_us - REMOTE_FRAME_US, t_us);
+  if (ch >= 0 && get_model_state(&remote_model, ch, &ls) == 0)
+  {
+    controller_track_state(controller, ch, ls.state, ls.brightness);
+    rx_stats.changes++;
+    rx_stats.last_us = (uint32_t)(latency_now() - t_us);
+    rx_stats.max_us = MAX(rx_stats.max_us, rx_stats.last_us);
+    LOG_INF("Wall remote: channel %d %s, brightness %d", ch,
+            (ls.state == STATE_ON) ? "on" : "off", ls.brightness);
+  }
+  else if (ch == -ENOENT)
+  {
+    rx_stats.unknown++;
+  }
+  if (light >= 0 && light < controller->num_lights)
+  {
+    k_mutex_unlock(&controller->light_lock[light]);
+  }
+
+  TRACE(TR_REMOTE_RX, code, ch);
+}
+
+static void remote_rx_thread(void)
+{
+  uint8_t frame[TRANSMIT_BUF_SIZE] = RADIO_GET_HEADER;
+  uint64_t t_us;
+
+  while (1)
+  {
+    k_msgq_get(&rx_msgq, &t_us, K_FOREVER);
+    if (controller == NULL)
+    {
+      continue;
+    }
+
+    if (radio_rx_read(&frame[RADIO_GET_HEADER_LEN], RADIO_CODE_LEN) != 0)
+    {
+      rx_stats.read_errors++;
+      continue;
+    }
+    rx_stats.frames++;
+    remote_rx_frame(frame, t_us);
+  }
+}
+
+K_THREAD_DEFINE(remote_rx, REMOTE_RX_STACK_SIZE, remote_rx_thread, NULL, NULL,
+                NULL, REMOTE_RX_PRIORITY, 0, 0);
+
+static int remote_stats_format(char *buf, size_t len)
+{
+  return snprintf(buf, len,
+                  "\"irqs\":%u,\"overruns\":%u,\"frames\":%u,"
+                  "\"read_errors\":%u,\"echoes\":%u,\"unknown\":%u,"
+                  "\"changes\":%u,\"last_us\":%u,\"max_us\":%u",
+                  rx_stats.irqs, rx_stats.overruns, rx_stats.frames,
+                  rx_stats.read_errors, rx_stats.echoes, rx_stats.unknown,
+                  rx_stats.changes, rx_stats.last_us, rx_stats.max_us);
+}
+
+static int cmd_remote(const struct shell *sh, size_t argc, char **argv)
+{
+  shell_print(sh, "irqs %u (%u overruns), frames %u, read errors %u",
+              rx_stats.irqs, rx_stats.overruns, rx_stats.frames,
+              rx_stats.read_errors);
+  shell_print(sh, "echoes %u, unknown %u, state changes %u",
+              rx_stats.echoes, rx_stats.unknown, rx_stats.changes);
+  shell_print(sh, "rx to zbus last %u us, max %u us", rx_stats.last_us,
+              rx_stats.max_us);
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), remote, NULL, "Wall remote decoder", cmd_remote, 1, 0);
+
+static struct stats_provider remote_stats = {
+    .name = "remote",
+    .format = remote_stats_format,
+};
+
+int remote_rx_init(controller_t *ctrl)
+{
+  /* Blocked on its queue until the radio starts receiving */
+  int err = affinity_pin_radio(remote_rx);
+  if (err != 0)
+  {
+    LOG_WRN("Remote decoder not pinned: %d", err);
+  }
+
+  get_model_reset(&remote_model);
+  stats_register(&remote_stats);
+  controller = ctrl;
+  return radio_rx_start();
+}
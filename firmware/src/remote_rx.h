@@ -0,0 +1,41 @@
+#ifndef __GET_REMOTE_RX__
+#define __GET_REMOTE_RX__
+#include <stdint.h>
+
+#include "controller.h"
+
+/**
+ * Tracks presses on the original GET wall remote. The radio listens
+ * between our own transmissions with the GET header as its sync word;
+ * the backend signals each received packet with remote_rx_irq() (ISR
+ * safe) and the RX thread reads the code word, runs it through a
+ * receiver model and hands the resulting state to the controller.
+ * Frames we sent ourselves, reported with remote_rx_note_tx(), are
+ * ignored for CONFIG_GETSMART_REMOTE_ECHO_MS.
+ */
+#if defined(CONFIG_GETSMART_REMOTE_RX)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int remote_rx_init(controller_t *controller);
+    void remote_rx_irq(uint64_t t_us);
+    void remote_rx_note_tx(uint32_t code, uint64_t t_end_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline void remote_rx_note_tx(uint32_t code, uint64_t t_end_us)
+{
+  (void)code;
+  (void)t_end_us;
+}
+
+#endif
+
+#endif /*__GET_REMOTE_RX__*/
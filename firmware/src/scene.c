@@ -0,0 +1,392 @@
+#include "scene.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "config_mgr.h"
+#include "latency.h"
+#include "lights.h"
+#include "radio.h"
+#include "stats.h"
+#include "tx_sched.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+BUILD_ASSERT(SCENE_COUNT <= UINT8_MAX, "Scene ids are 8 bit");
+
+/* The scenes as stored, saved as a whole on every change */
+static K_MUTEX_DEFINE(scene_lock);
+static struct scene_cfg scenes[SCENE_COUNT];
+
+struct scene_stats
+{
+  uint32_t recalls;
+  uint32_t failed;
+  uint32_t rejected;
+  uint64_t recall_ms;
+  uint32_t recall_max_ms;
+  uint64_t frames;
+  uint64_t individual;
+};
+
+static struct k_spinlock stats_lock;
+static struct scene_stats scene_stats;
+
+/* Call with scene_lock held */
+static int scene_find(const char *name)
+{
+  for (int i = 0; i < SCENE_COUNT; i++)
+  {
+    if (scenes[i].name[0] != '\0' && strcmp(scenes[i].name, name) == 0)
+    {
+      return i;
+    }
+  }
+  return -ENOENT;
+}
+
+/* The name is a topic level too */
+static bool scene_name_valid(const char *name)
+{
+  size_t len = strlen(name);
+
+  return len > 0 && len < SCENE_NAME_MAXLEN && strpbrk(name, "/+#") == NULL;
+}
+
+/**
+ * Define a scene, replacing one with the same name. The targets are
+ * sorted into light order, which is the order their locks are taken in.
+ * A recall already queued sends the new definition.
+ */
+int scene_define(const char *name, const struct scene_target *targets,
+                 int count)
+{
+  struct scene_cfg sc = {0};
+
+  if (!scene_name_valid(name) || count < 0 || count > CHANNEL_COUNT)
+  {
+    return -EINVAL;
+  }
+
+  strncpy(sc.name, name, sizeof(sc.name) - 1);
+  for (int i = 0; i < count; i++)
+  {
+    const struct scene_target *t = &targets[i];
+    int j = sc.count;
+
+    if (t->light >= lights_count() || t->state > STATE_ON ||
+        t->brightness > DIM_LEVELS)
+    {
+      return -EINVAL;
+    }
+    for (; j > 0 && sc.targets[j - 1].light > t->light; j--)
+    {
+      sc.targets[j] = sc.targets[j - 1];
+    }
+    if (j > 0 && sc.targets[j - 1].light == t->light)
+    {
+      return -EINVAL;
+    }
+    sc.targets[j] = *t;
+    sc.count++;
+  }
+
+  k_mutex_lock(&scene_lock, K_FOREVER);
+  int id = scene_find(name);
+  for (int i = 0; i < SCENE_COUNT && id < 0 && count > 0; i++)
+  {
+    id = (scenes[i].name[0] == '\0') ? i : id;
+  }
+
+  int rc = (id < 0) ? ((count > 0) ? -ENOMEM : -ENOENT) : 0;
+  if (rc == 0)
+  {
+    struct scene_cfg old = scenes[id];
+
+    if (count == 0)
+    {
+      memset(&scenes[id], 0, sizeof(scenes[id]));
+    }
+    else
+    {
+      scenes[id] = sc;
+    }
+    rc = cfg_set_value(CFG_SCENES_ID, scenes, sizeof(scenes));
+    if (rc < 0)
+    {
+      scenes[id] = old;
+    }
+  }
+  k_mutex_unlock(&scene_lock);
+
+  if (rc < 0)
+  {
+    LOG_ERR("Scene %s not saved: %d", name, rc);
+    return rc;
+  }
+  LOG_INF("Scene %s %s, %d lights", name, (count > 0) ? "saved" : "deleted",
+          count);
+  return 0;
+}
+
+int scene_get(int id, struct scene_target *targets)
+{
+  int count = 0;
+
+  if (id < 0 || id >= SCENE_COUNT)
+  {
+    return 0;
+  }
+
+  k_mutex_lock(&scene_lock, K_FOREVER);
+  if (scenes[id].name[0] != '\0')
+  {
+    count = MIN(scenes[id].count, CHANNEL_COUNT);
+    memcpy(targets, scenes[id].targets, count * sizeof(targets[0]));
+  }
+  k_mutex_unlock(&scene_lock);
+  return count;
+}
+
+/* Queue a scene on the radios, never blocks */
+int scene_recall(const char *name)
+{
+  struct scene_target targets[CHANNEL_COUNT];
+  struct tx_cmd cmd = {.kind = TX_SCENE};
+
+  k_mutex_lock(&scene_lock, K_FOREVER);
+  int id = scene_find(name);
+  int count = (id < 0) ? 0 : scenes[id].count;
+  memcpy(targets, scenes[MAX(id, 0)].targets, count * sizeof(targets[0]));
+  k_mutex_unlock(&scene_lock);
+
+  if (id < 0)
+  {
+    LOG_ERR("No scene %s", name);
+    return id;
+  }
+
+  cmd.scene = id;
+  latency_mark(LAT_STAGE_QUEUED);
+  latency_handoff(&cmd.trace);
+  int err = tx_sched_submit_scene(&cmd, targets, count);
+  if (err != 0)
+  {
+    k_spinlock_key_t key = k_spin_lock(&stats_lock);
+    scene_stats.rejected++;
+    k_spin_unlock(&stats_lock, key);
+  }
+  return err;
+}
+
+void scene_done(int id, int err, uint32_t frames, uint32_t individual,
+                uint32_t ms)
+{
+  k_spinlock_key_t key = k_spin_lock(&stats_lock);
+  scene_stats.recalls++;
+  scene_stats.failed += (err != 0);
+  scene_stats.recall_ms += ms;
+  scene_stats.recall_max_ms = MAX(scene_stats.recall_max_ms, ms);
+  scene_stats.frames += frames;
+  scene_stats.individual += individual;
+  k_spin_unlock(&stats_lock, key);
+
+  LOG_DBG("Scene %d: %u ms, %u frames, %u one by one", id, ms, frames,
+          individual);
+}
+
+static int scene_stats_format(char *buf, size_t len)
+{
+  uint32_t frame_us = radio_airtime_us(TRANSMIT_BUF_SIZE);
+  int defined = 0;
+
+  for (int i = 0; i < SCENE_COUNT; i++)
+  {
+    defined += (scenes[i].name[0] != '\0');
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&stats_lock);
+  struct scene_stats s = scene_stats;
+  k_spin_unlock(&stats_lock, key);
+
+  return snprintf(buf, len,
+                  "\"scenes\":%d,\"recalls\":%u,\"failed\":%u,"
+                  "\"rejected\":%u,\"recall_ms\":%u,\"recall_max_ms\":%u,"
+                  "\"frames\":%u,\"individual_frames\":%u,"
+                  "\"airtime_ms\":%u,\"individual_airtime_ms\":%u",
+                  defined, s.recalls, s.failed, s.rejected,
+                  (unsigned int)(s.recall_ms / MAX(s.recalls, 1U)),
+                  s.recall_max_ms, (unsigned int)s.frames,
+                  (unsigned int)s.individual,
+                  (unsigned int)(s.frames * frame_us / 1000U),
+                  (unsigned int)(s.individual * frame_us / 1000U));
+}
+
+static int cmd_scene_list(const struct shell *sh, size_t argc, char **argv)
+{
+  k_mutex_lock(&scene_lock, K_FOREVER);
+  for (int i = 0; i < SCENE_COUNT; i++)
+  {
+    const struct scene_cfg *sc = &scenes[i];
+    char line[CHANNEL_COUNT * 12 + 1];
+    int n = 0;
+
+    if (sc->name[0] == '\0')
+    {
+      continue;
+    }
+    line[0] = '\0';
+    for (int t = 0; t < sc->count && n < sizeof(line); t++)
+    {
+      const struct scene_target *st = &sc->targets[t];
+
+      n += snprintf(line + n, sizeof(line) - n, " %d:%s", st->light,
+                    (st->state == STATE_ON) ? "on" : "off");
+      if (st->brightness != 0 && n < sizeof(line))
+      {
+        n += snprintf(line + n, sizeof(line) - n, ":%d", st->brightness);
+      }
+    }
+    shell_print(sh, "%d: %-*s%s", i, SCENE_NAME_MAXLEN, sc->name, line);
+  }
+  k_mutex_unlock(&scene_lock);
+
+  char stats[256];
+  scene_stats_format(stats, sizeof(stats));
+  shell_print(sh, "{%s}", stats);
+  return 0;
+}
+
+/* <light>:<on|off>[:<brightness>] */
+static int parse_target(const char *arg, struct scene_target *t)
+{
+  char *end;
+  long light = strtol(arg, &end, 10);
+  long brightness = 0;
+
+  if (end == arg || *end != ':' || light < 0 || light >= CHANNEL_COUNT)
+  {
+    return -EINVAL;
+  }
+  arg = end + 1;
+  if (strncmp(arg, "on", 2) == 0)
+  {
+    t->state = STATE_ON;
+    arg += 2;
+  }
+  else if (strncmp(arg, "off", 3) == 0)
+  {
+    t->state = STATE_OFF;
+    arg += 3;
+  }
+  else
+  {
+    return -EINVAL;
+  }
+  if (*arg == ':')
+  {
+    brightness = strtol(arg + 1, &end, 10);
+    if (end == arg + 1 || *end != '\0' || brightness < 0 ||
+        brightness > DIM_LEVELS)
+    {
+      return -EINVAL;
+    }
+  }
+  else if (*arg != '\0')
+  {
+    return -EINVAL;
+  }
+  t->light = light;
+  t->brightness = brightness;
+  return 0;
+}
+
+static int cmd_scene_set(const struct shell *sh, size_t argc, char **argv)
+{
+  struct scene_target targets[CHANNEL_COUNT];
+  int count = argc - 2;
+
+  for (int i = 0; i < count; i++)
+  {
+    if (parse_target(argv[i + 2], &targets[i]) != 0)
+    {
+      shell_error(sh, "Bad light %s, use <light>:<on|off>[:<brightness>]",
+                  argv[i + 2]);
+      return -EINVAL;
+    }
+  }
+
+  int err = scene_define(argv[1], targets, count);
+  if (err != 0)
+  {
+    shell_error(sh, "Scene %s not saved: %d", argv[1], err);
+  }
+  return err;
+}
+
+static int cmd_scene_delete(const struct shell *sh, size_t argc, char **argv)
+{
+  int err = scene_define(argv[1], NULL, 0);
+  if (err != 0)
+  {
+    shell_error(sh, "Scene %s not deleted: %d", argv[1], err);
+  }
+  return err;
+}
+
+static int cmd_scene_recall(const struct shell *sh, size_t argc, char **argv)
+{
+  int err = scene_recall(argv[1]);
+  if (err != 0)
+  {
+    shell_error(sh, "Scene %s not recalled: %d", argv[1], err);
+  }
+  return err;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    scene_cmds,
+    SHELL_CMD(list, NULL, "Scenes and recall stats", cmd_scene_list),
+    SHELL_CMD_ARG(set, NULL,
+                  "Define a scene <name> <light>:<on|off>[:<brightness>]...",
+                  cmd_scene_set, 3, CHANNEL_COUNT - 1),
+    SHELL_CMD_ARG(delete, NULL, "Delete a scene <name>", cmd_scene_delete, 2,
+                  0),
+    SHELL_CMD_ARG(recall, NULL, "Recall a scene <name>", cmd_scene_recall, 2,
+                  0),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), scene, &scene_cmds, "Scenes", cmd_scene_list, 1, 0);
+
+static struct stats_provider scene_stats_provider = {
+    .name = "scene",
+    .format = scene_stats_format,
+};
+
+/* Load the scenes, after cfg_init() and lights_init() */
+int scene_init(void)
+{
+  int defined = 0;
+  ssize_t rc = cfg_get_value(CFG_SCENES_ID, scenes, sizeof(scenes));
+
+  /* A different scene or light count makes the stored ones unreadable */
+  if (rc != sizeof(scenes))
+  {
+    memset(scenes, 0, sizeof(scenes));
+  }
+  for (int i = 0; i < SCENE_COUNT; i++)
+  {
+    scenes[i].name[SCENE_NAME_MAXLEN - 1] = '\0';
+    defined += (scenes[i].name[0] != '\0');
+  }
+
+  stats_register(&scene_stats_provider);
+  LOG_INF("%d scenes", defined);
+  return defined;
+}
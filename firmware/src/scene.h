@@ -0,0 +1,67 @@
+#ifndef __GET_SCENE__
+#define __GET_SCENE__
+#include <errno.h>
+#include <stdint.h>
+
+#include "controller.h"
+
+/**
+ * Scenes are named sets of light targets kept in config, defined and
+ * recalled with one MQTT message or from 'gs scene'. A recall is queued
+ * as one command and sent as one program, see controller_scene(), so
+ * lights of a house code share their dim frames. The "scene" stats give
+ * the recall time and the frames sent against those of the same
+ * commands sent one by one.
+ */
+#define SCENE_COUNT CONFIG_GETSMART_MAX_SCENES
+#define SCENE_NAME_MAXLEN 16
+
+/* A scene as stored in config, an empty name is a free slot */
+struct scene_cfg {
+  char name[SCENE_NAME_MAXLEN];
+  uint8_t count;
+  struct scene_target targets[CHANNEL_COUNT];
+};
+
+#if defined(CONFIG_GETSMART_SCENES)
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int scene_init(void);
+    /* No targets deletes the scene */
+    int scene_define(const char *name, const struct scene_target *targets,
+                     int count);
+    int scene_recall(const char *name);
+    /* Targets of a scene in light order, returns how many */
+    int scene_get(int id, struct scene_target *targets);
+    /* A recall has run, from the TX thread */
+    void scene_done(int id, int err, uint32_t frames, uint32_t individual,
+                    uint32_t ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#else
+
+static inline int scene_init(void) { return 0; }
+static inline int scene_define(const char *name,
+                               const struct scene_target *targets, int count)
+{
+  (void)name;
+  (void)targets;
+  (void)count;
+  return -ENOTSUP;
+}
+static inline int scene_recall(const char *name)
+{
+  (void)name;
+  return -ENOTSUP;
+}
+
+#endif
+
+#endif /*__GET_SCENE__*/
@@ -0,0 +1,97 @@
+#include "stats.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "mqtt_thread.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+static sys_slist_t providers = SYS_SLIST_STATIC_INIT(&providers);
+K_MUTEX_DEFINE(providers_lock);
+
+static char stats_buf[CONFIG_GETSMART_STATS_BUF_SIZE];
+
+void stats_register(struct stats_provider *provider)
+{
+  k_mutex_lock(&providers_lock, K_FOREVER);
+  sys_slist_append(&providers, &provider->node);
+  k_mutex_unlock(&providers_lock);
+}
+
+int stats_format(struct stats_provider *provider, char *buf, size_t len)
+{
+  int n = snprintf(buf, len, "{\"type\":\"%s\",", provider->name);
+
+  if (n >= len)
+  {
+    return -ENOMEM;
+  }
+  n += provider->format(buf + n, len - n);
+  if (n + 1 >= len)
+  {
+    return -ENOMEM;
+  }
+  buf[n++] = '}';
+  buf[n] = '\0';
+  return n;
+}
+
+static void stats_task(void)
+{
+  struct stats_provider *provider;
+
+  while (1)
+  {
+    k_sleep(K_SECONDS(CONFIG_GETSMART_STATS_INTERVAL_S));
+
+    k_mutex_lock(&providers_lock, K_FOREVER);
+    SYS_SLIST_FOR_EACH_CONTAINER(&providers, provider, node)
+    {
+      if (provider->tick != NULL)
+      {
+        provider->tick();
+      }
+      if (stats_format(provider, stats_buf, sizeof(stats_buf)) < 0)
+      {
+        LOG_WRN("Stats '%s' truncated, not published", provider->name);
+        continue;
+      }
+      mqtt_publish_stats(stats_buf);
+    }
+    k_mutex_unlock(&providers_lock);
+  }
+}
+
+K_THREAD_DEFINE(stats_task_id, CONFIG_GETSMART_STATS_STACK_SIZE, stats_task,
+                NULL, NULL, NULL, 10, 0, 0);
+
+static int cmd_stats(const struct shell *sh, size_t argc, char **argv)
+{
+  struct stats_provider *provider;
+
+  k_mutex_lock(&providers_lock, K_FOREVER);
+  SYS_SLIST_FOR_EACH_CONTAINER(&providers, provider, node)
+  {
+    if (argc > 1 && strcmp(argv[1], provider->name) != 0)
+    {
+      continue;
+    }
+    if (stats_format(provider, stats_buf, sizeof(stats_buf)) < 0)
+    {
+      shell_error(sh, "%s: truncated", provider->name);
+      continue;
+    }
+    shell_print(sh, "%s", stats_buf);
+  }
+  k_mutex_unlock(&providers_lock);
+  return 0;
+}
+
+SHELL_SUBCMD_SET_CREATE(gs_cmds, (gs));
+SHELL_SUBCMD_ADD((gs), stats, NULL, "Print the published stats [type]",
+                 cmd_stats, 1, 1);
+SHELL_CMD_REGISTER(gs, &gs_cmds, "GET Smart Controller commands", NULL);
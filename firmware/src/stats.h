@@ -0,0 +1,32 @@
+#ifndef __GET_STATS__
+#define __GET_STATS__
+#include <stddef.h>
+#include <zephyr/sys/slist.h>
+
+/**
+ * A source of stats, periodically formatted as the body of a JSON object
+ * and published to the getsmart/device/<id>/stats topic as
+ * {"type":"<name>", <body>}. 'tick', if set, is called by the collector
+ * just before each periodic publish, never for 'gs stats', so figures
+ * taken over an interval only ever cover the publish interval.
+ */
+struct stats_provider {
+  sys_snode_t node;
+  const char *name;
+  int (*format)(char *buf, size_t len);
+  void (*tick)(void);
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    void stats_register(struct stats_provider *provider);
+    int stats_format(struct stats_provider *provider, char *buf, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_STATS__*/
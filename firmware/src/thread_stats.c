@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "stats.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define THREAD_NAME_LEN 16
+
+/**
+ * Last sample of a thread, cpu usage is over the previous collector
+ * interval. A thread's first sample only sets 'cycles', it has no cpu
+ * usage until the next one.
+ */
+struct thread_sample {
+  k_tid_t tid;
+  char name[THREAD_NAME_LEN];
+  size_t stack_size;
+  size_t unused;
+  uint64_t cycles;
+  uint32_t cpu_permille;
+  bool sampled;
+  bool has_cpu;
+  bool seen;
+};
+
+static struct thread_sample samples[CONFIG_GETSMART_THREAD_STATS_MAX];
+static uint64_t total_cycles;
+static uint64_t interval_cycles;
+K_MUTEX_DEFINE(samples_lock);
+
+static struct thread_sample *sample_get(k_tid_t tid)
+{
+  struct thread_sample *free_slot = NULL;
+
+  for (int i = 0; i < ARRAY_SIZE(samples); i++)
+  {
+    if (samples[i].tid == tid)
+    {
+      return &samples[i];
+    }
+    if (samples[i].tid == NULL && free_slot == NULL)
+    {
+      free_slot = &samples[i];
+    }
+  }
+
+  if (free_slot != NULL)
+  {
+    memset(free_slot, 0, sizeof(*free_slot));
+    free_slot->tid = tid;
+  }
+  return free_slot;
+}
+
+static void sample_thread(const struct k_thread *cthread, void *user_data)
+{
+  struct k_thread *thread = (struct k_thread *)cthread;
+  struct thread_sample *sample = sample_get(thread);
+  k_thread_runtime_stats_t rt;
+
+  if (sample == NULL)
+  {
+    return;
+  }
+
+  const char *name = k_thread_name_get(thread);
+  if (name != NULL && name[0] != '\0')
+  {
+    strncpy(sample->name, name, sizeof(sample->name) - 1);
+  }
+  else
+  {
+    snprintf(sample->name, sizeof(sample->name), "%p", (void *)thread);
+  }
+
+  sample->stack_size = thread->stack_info.size;
+  if (k_thread_stack_space_get(thread, &sample->unused) != 0)
+  {
+    sample->unused = 0;
+  }
+
+  if (k_thread_runtime_stats_get(thread, &rt) == 0)
+  {
+    if (sample->sampled && interval_cycles > 0)
+    {
+      uint64_t delta = rt.execution_cycles - sample->cycles;
+
+      sample->cpu_permille = (uint32_t)((delta * 1000U) / interval_cycles);
+      sample->has_cpu = true;
+    }
+    sample->cycles = rt.execution_cycles;
+    sample->sampled = true;
+  }
+  sample->seen = true;
+}
+
+/**
+ * Sample every thread, dropping entries for threads that have exited.
+ * Only at boot and from the collector tick, the interval is the time
+ * between two of them.
+ */
+static void threads_sample(void)
+{
+  k_thread_runtime_stats_t all;
+
+  k_mutex_lock(&samples_lock, K_FOREVER);
+  if (k_thread_runtime_stats_all_get(&all) == 0)
+  {
+    interval_cycles = all.execution_cycles - total_cycles;
+    total_cycles = all.execution_cycles;
+  }
+
+  for (int i = 0; i < ARRAY_SIZE(samples); i++)
+  {
+    samples[i].seen = false;
+  }
+  k_thread_foreach_unlocked(sample_thread, NULL);
+  for (int i = 0; i < ARRAY_SIZE(samples); i++)
+  {
+    if (!samples[i].seen)
+    {
+      samples[i].tid = NULL;
+    }
+  }
+  k_mutex_unlock(&samples_lock);
+}
+
+static int threads_stats_format(char *buf, size_t len)
+{
+  char cpu[12];
+  int n;
+
+  k_mutex_lock(&samples_lock, K_FOREVER);
+  n = snprintf(buf, len, "\"threads\":[");
+  for (int i = 0, first = 1; i < ARRAY_SIZE(samples) && n < len; i++)
+  {
+    if (samples[i].tid == NULL)
+    {
+      continue;
+    }
+    if (samples[i].has_cpu)
+    {
+      snprintf(cpu, sizeof(cpu), "%u", samples[i].cpu_permille);
+    }
+    else
+    {
+      strcpy(cpu, "null");
+    }
+    n += snprintf(buf + n, len - n,
+                  "%s{\"name\":\"%s\",\"stack\":%u,\"unused\":%u,"
+                  "\"cpu_pm\":%s}",
+                  first ? "" : ",", samples[i].name,
+                  (unsigned int)samples[i].stack_size,
+                  (unsigned int)samples[i].unused, cpu);
+    first = 0;
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "]");
+  }
+  k_mutex_unlock(&samples_lock);
+  return n;
+}
+
+static int cmd_threads(const struct shell *sh, size_t argc, char **argv)
+{
+  shell_print(sh, "%-16s %6s %6s %6s %6s", "thread", "stack", "unused",
+              "used%", "cpu%");
+
+  k_mutex_lock(&samples_lock, K_FOREVER);
+  for (int i = 0; i < ARRAY_SIZE(samples); i++)
+  {
+    struct thread_sample *s = &samples[i];
+    size_t unused;
+
+    if (s->tid == NULL)
+    {
+      continue;
+    }
+    /* Stack space is live, cpu is from the last collector interval */
+    if (k_thread_stack_space_get(s->tid, &unused) != 0)
+    {
+      unused = s->unused;
+    }
+    unsigned int used =
+        (s->stack_size > 0)
+            ? (unsigned int)(((s->stack_size - unused) * 100U) / s->stack_size)
+            : 0;
+
+    if (s->has_cpu)
+    {
+      shell_print(sh, "%-16s %6u %6u %5u%% %3u.%u%%", s->name,
+                  (unsigned int)s->stack_size, (unsigned int)unused, used,
+                  s->cpu_permille / 10, s->cpu_permille % 10);
+    }
+    else
+    {
+      shell_print(sh, "%-16s %6u %6u %5u%% %6s", s->name,
+                  (unsigned int)s->stack_size, (unsigned int)unused, used,
+                  "-");
+    }
+  }
+  k_mutex_unlock(&samples_lock);
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), threads, NULL, "Thread stack and CPU usage",
+                 cmd_threads, 1, 0);
+
+static struct stats_provider threads_stats = {
+    .name = "threads",
+    .format = threads_stats_format,
+    .tick = threads_sample,
+};
+
+static int thread_stats_init(void)
+{
+  threads_sample();
+  stats_register(&threads_stats);
+  return 0;
+}
+
+SYS_INIT(thread_stats_init, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,154 @@
+#include "trace.h"
+
+#include <string.h>
+#include <zephyr/init.h>
+#include <zephyr/kernel.h>
+#include <zephyr/linker/section_tags.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+
+#include "latency.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define TRACE_MAGIC 0x47535452 /* "GSTR" */
+#define TRACE_ENTRIES CONFIG_GETSMART_TRACE_ENTRIES
+
+BUILD_ASSERT(IS_POWER_OF_TWO(TRACE_ENTRIES),
+             "Trace entries must be a power of two");
+
+struct trace_ring {
+  uint32_t magic;
+  uint32_t head;
+  uint32_t boots;
+  uint32_t reserved;
+  struct trace_rec recs[TRACE_ENTRIES];
+};
+
+/* Not cleared on boot, so the records before a reset can be read back */
+static __noinit struct trace_ring ring;
+static struct k_spinlock ring_lock;
+
+static const char *const event_names[] = {
+    [TR_BOOT] = "boot",
+    [TR_MQTT_EVT] = "mqtt_evt",
+    [TR_MQTT_RX] = "mqtt_rx",
+    [TR_MQTT_CMD] = "mqtt_cmd",
+    [TR_CMD_REQUEST] = "cmd_request",
+    [TR_CMD_CURRENT] = "cmd_current",
+    [TR_RADIO_MSG] = "radio_msg",
+    [TR_RADIO_TX] = "radio_tx",
+    [TR_RADIO_TX_ERR] = "radio_tx_err",
+    [TR_STATE_UPDATE] = "state_update",
+    [TR_STATE_PUBLISH] = "state_publish",
+    [TR_STATE_OVERFLOW] = "state_overflow",
+    [TR_REMOTE_RX] = "remote_rx",
+    [TR_REHOME] = "rehome",
+    [TR_SCENE] = "scene",
+    [TR_MQTT_DUP] = "mqtt_dup",
+};
+
+void trace_write(uint16_t event, uint32_t a0, uint32_t a1)
+{
+  uint32_t ts = (uint32_t)latency_now();
+  k_spinlock_key_t key = k_spin_lock(&ring_lock);
+  uint32_t head = ring.head;
+  struct trace_rec *rec = &ring.recs[head & (TRACE_ENTRIES - 1)];
+
+  rec->ts_us = ts;
+  rec->event = event;
+  rec->seq = (uint16_t)head;
+  rec->a0 = a0;
+  rec->a1 = a1;
+  ring.head = head + 1;
+  k_spin_unlock(&ring_lock, key);
+}
+
+static void trace_clear(void)
+{
+  k_spinlock_key_t key = k_spin_lock(&ring_lock);
+  memset(&ring, 0, sizeof(ring));
+  ring.magic = TRACE_MAGIC;
+  k_spin_unlock(&ring_lock, key);
+}
+
+static const char *event_name(uint16_t event)
+{
+  if (event < ARRAY_SIZE(event_names) && event_names[event] != NULL)
+  {
+    return event_names[event];
+  }
+  return "?";
+}
+
+/* Oldest to newest, the ring is not locked while printing */
+static void trace_dump(const struct shell *sh, bool raw)
+{
+  uint32_t head = ring.head;
+  uint32_t count = MIN(head, TRACE_ENTRIES);
+
+  if (raw)
+  {
+    shell_print(sh, "# gstrace v1 boots=%u head=%u", ring.boots, head);
+  }
+
+  for (uint32_t i = head - count; i != head; i++)
+  {
+    const struct trace_rec *rec = &ring.recs[i & (TRACE_ENTRIES - 1)];
+
+    if (raw)
+    {
+      shell_print(sh, "%08x %04x %04x %08x %08x", rec->ts_us, rec->event,
+                  rec->seq, rec->a0, rec->a1);
+    }
+    else
+    {
+      shell_print(sh, "%10u.%06u %5u %-14s 0x%08x 0x%08x",
+                  rec->ts_us / USEC_PER_SEC, rec->ts_us % USEC_PER_SEC,
+                  rec->seq, event_name(rec->event), rec->a0, rec->a1);
+    }
+  }
+}
+
+static int cmd_trace_dump(const struct shell *sh, size_t argc, char **argv)
+{
+  trace_dump(sh, false);
+  return 0;
+}
+
+static int cmd_trace_raw(const struct shell *sh, size_t argc, char **argv)
+{
+  trace_dump(sh, true);
+  return 0;
+}
+
+static int cmd_trace_clear(const struct shell *sh, size_t argc, char **argv)
+{
+  trace_clear();
+  shell_print(sh, "Trace cleared");
+  return 0;
+}
+
+SHELL_STATIC_SUBCMD_SET_CREATE(
+    trace_cmds,
+    SHELL_CMD(dump, NULL, "Decode the trace ring", cmd_trace_dump),
+    SHELL_CMD(raw, NULL, "Hex records for tools/trace_decode.py",
+              cmd_trace_raw),
+    SHELL_CMD(clear, NULL, "Clear the trace ring", cmd_trace_clear),
+    SHELL_SUBCMD_SET_END);
+
+SHELL_SUBCMD_ADD((gs), trace, &trace_cmds, "Binary trace buffer",
+                 cmd_trace_dump, 1, 0);
+
+static int trace_init(void)
+{
+  if (ring.magic != TRACE_MAGIC)
+  {
+    trace_clear();
+  }
+  ring.boots++;
+  trace_write(TR_BOOT, ring.boots, 0);
+  return 0;
+}
+
+SYS_INIT(trace_init, POST_KERNEL, 0);
@@ -0,0 +1,68 @@
+#ifndef __GET_TRACE__
+#define __GET_TRACE__
+#include <stdint.h>
+
+/**
+ * Binary tracepoints for the hot paths, a fixed size record is written to
+ * a ring buffer in noinit RAM instead of formatting a log line. The ring
+ * survives a watchdog reset and is decoded by 'gs trace' or, from the
+ * 'gs trace raw' output, by tools/trace_decode.py.
+ *
+ * Keep the IDs in sync with tools/trace_decode.py, only ever append.
+ */
+enum trace_event {
+  TR_BOOT = 1,        /* a0: boots since the ring was cleared */
+  TR_MQTT_EVT,        /* a0: mqtt_evt_type, a1: result */
+  TR_MQTT_RX,         /* a0: payload len, a1: message id */
+  TR_MQTT_CMD,        /* a0: channel, a1: state << 16 | brightness */
+  TR_CMD_REQUEST,     /* a0: channel, a1: state << 16 | brightness */
+  TR_CMD_CURRENT,     /* a0: channel, a1: state << 16 | brightness */
+  TR_RADIO_MSG,       /* a0: channel << 16 | op << 8 | pulse, a1: code word */
+  TR_RADIO_TX,        /* a0: code word, a1: len */
+  TR_RADIO_TX_ERR,    /* a0: code word, a1: RadioLib state */
+  TR_STATE_UPDATE,    /* a0: channel << 16 | seq, a1: state << 16 | brightness */
+  TR_STATE_PUBLISH,   /* a0: channel << 16 | seq, a1: result */
+  TR_STATE_OVERFLOW,  /* a0: channel, a1: total overflows */
+  TR_REMOTE_RX,       /* a0: code word, a1: channel or -errno */
+  TR_REHOME,          /* a0: channel << 16 | plan, a1: result */
+  TR_SCENE,           /* a0: scene << 16 | frames, a1: result */
+  TR_MQTT_DUP,        /* a0: message id, a1: topic and payload hash */
+};
+
+struct trace_rec {
+  uint32_t ts_us;
+  uint16_t event;
+  uint16_t seq;
+  uint32_t a0;
+  uint32_t a1;
+};
+
+/* Pack a state/brightness pair into one argument */
+#define TRACE_STATE(state, brightness) \
+  ((((uint32_t)(state)&0xFFFF) << 16) | ((uint32_t)(brightness)&0xFFFF))
+
+/* The 32 bit code word of a GET frame, bytes 6..9 */
+#define TRACE_CODE(msg)                                              \
+  (((uint32_t)(msg)[6] << 24) | ((uint32_t)(msg)[7] << 16) |         \
+   ((uint32_t)(msg)[8] << 8) | (uint32_t)(msg)[9])
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if defined(CONFIG_GETSMART_TRACE)
+    void trace_write(uint16_t event, uint32_t a0, uint32_t a1);
+#define TRACE(event, a0, a1) trace_write((event), (a0), (a1))
+#else
+#define TRACE(event, a0, a1) \
+  do                         \
+  {                          \
+  } while (0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_TRACE__*/
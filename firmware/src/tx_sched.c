@@ -0,0 +1,800 @@
+#include "tx_sched.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/shell/shell.h>
+#include <zephyr/sys/util.h>
+
+#include "affinity.h"
+#include "airtime.h"
+#include "radio.h"
+#include "radio_power.h"
+#include "rehome.h"
+#include "scene.h"
+#include "stats.h"
+#include "trace.h"
+
+LOG_MODULE_DECLARE(gs, CONFIG_GETSMART_LOG_LEVEL);
+
+#define TX_QUEUE_DEPTH CONFIG_GETSMART_TX_QUEUE_DEPTH
+#define TX_PRIORITY K_PRIO_PREEMPT(6)
+
+/* How often an idle worker looks for a light to re-home */
+#if defined(CONFIG_GETSMART_REHOME)
+#define IDLE_POLL_MS 1000
+#else
+#define IDLE_POLL_MS SYS_FOREVER_MS
+#endif
+
+/**
+ * Power of two queueing delay buckets: values below 2^WAIT_MIN_SHIFT us
+ * share bucket 0, the last one (~8 s) catches everything larger.
+ */
+#define WAIT_MIN_SHIFT 8
+#define WAIT_BUCKETS 16
+
+BUILD_ASSERT(RADIO_COUNT > 0, "No radios in DT");
+
+struct tx_worker {
+  struct k_thread thread;
+  struct k_msgq queue[TX_PRIO_COUNT];
+  struct tx_cmd queue_buf[TX_PRIO_COUNT][TX_QUEUE_DEPTH];
+  /* Given when a command is queued, the queues are checked first */
+  struct k_sem ready;
+  /* Commands that gave the radio up to a higher class, one per class:
+   * a class only runs again once its held command has been taken, and
+   * each can be preempted in turn by the classes above it */
+  struct tx_cmd held[TX_PRIO_COUNT];
+  bool holding[TX_PRIO_COUNT];
+  /* Class of what is running, TX_PRIO_COUNT while re-homing */
+  uint8_t running;
+  struct lat_trace trace;
+  /* Commands queued or running, guarded by sched_lock */
+  uint32_t load;
+  uint32_t max_load;
+  uint32_t cmds;
+  uint32_t failed;
+  uint32_t rejected;
+  uint32_t moved;
+  uint32_t deferred;
+  uint32_t coalesced;
+  uint32_t preempted;
+  uint64_t busy_us;
+  uint64_t deferred_ms;
+  /* Re-homing a light, counts as load */
+  bool rehoming;
+};
+
+/* Time from being queued to starting, per class, guarded by sched_lock */
+struct prio_stats {
+  uint32_t buckets[WAIT_BUCKETS];
+  uint32_t cmds;
+  uint32_t preempted;
+  uint64_t wait_us;
+  uint32_t wait_max_us;
+};
+
+static const char *const prio_names[TX_PRIO_COUNT] = {
+    "interactive",
+    "automation",
+    "background",
+};
+
+/* What a light's queued commands add up to */
+struct tx_target {
+  int state;
+  bool set_brightness;
+  int brightness;
+};
+
+K_THREAD_STACK_ARRAY_DEFINE(tx_stacks, RADIO_COUNT,
+                            CONFIG_GETSMART_TX_STACK_SIZE);
+
+static struct tx_worker workers[RADIO_COUNT];
+static struct k_spinlock sched_lock;
+/* The radio each light's commands go to and how many are pending there */
+static uint8_t light_radio[CHANNEL_COUNT];
+static uint8_t light_pending[CHANNEL_COUNT];
+static uint32_t light_seq[CHANNEL_COUNT];
+/* A light's commands before this one were superseded, by a scene or by
+ * its latest command having been taken */
+static uint32_t light_floor[CHANNEL_COUNT];
+static struct tx_target light_target[CHANNEL_COUNT];
+static struct prio_stats prio_stats[TX_PRIO_COUNT];
+static controller_t *controller;
+
+int tx_prio_parse(const char *name)
+{
+  for (int p = 0; p < TX_PRIO_COUNT; p++)
+  {
+    if (strcmp(name, prio_names[p]) == 0)
+    {
+      return p;
+    }
+  }
+  return -EINVAL;
+}
+
+/* Call with sched_lock held */
+static uint8_t pick_radio(int channel)
+{
+  uint8_t best = light_radio[channel];
+
+  if (light_pending[channel] > 0)
+  {
+    return best;
+  }
+  for (uint8_t r = 0; r < RADIO_COUNT; r++)
+  {
+    if (workers[r].load + workers[r].rehoming <
+        workers[best].load + workers[best].rehoming)
+    {
+      best = r;
+    }
+  }
+  return best;
+}
+
+/**
+ * Fold a command into the light's target, call with sched_lock held.
+ * Switching on without a brightness keeps a brightness still queued.
+ */
+static void merge_target(const struct tx_cmd *cmd)
+{
+  struct tx_target *t = &light_target[cmd->channel];
+
+  if (light_pending[cmd->channel] == 0 || cmd->set_brightness ||
+      cmd->state != STATE_ON || t->state != STATE_ON)
+  {
+    t->set_brightness = cmd->set_brightness;
+    t->brightness = cmd->brightness;
+  }
+  t->state = cmd->state;
+}
+
+/**
+ * Queue a command on a radio, never blocks. Returns -ENOBUFS if that
+ * radio's queue is full.
+ */
+int tx_sched_submit(const struct tx_cmd *cmd)
+{
+  if (cmd->channel < 0 || cmd->channel >= CHANNEL_COUNT ||
+      cmd->prio >= TX_PRIO_COUNT)
+  {
+    return -EINVAL;
+  }
+
+  struct tx_cmd queued = *cmd;
+  int err;
+
+  queued.t_queued = latency_now();
+
+  /* Queued under the lock so the sequence numbers are in queue order */
+  k_spinlock_key_t key = k_spin_lock(&sched_lock);
+  uint8_t r = pick_radio(cmd->channel);
+  struct tx_worker *w = &workers[r];
+
+  queued.seq = light_seq[cmd->channel] + 1;
+  err = k_msgq_put(&w->queue[queued.prio], &queued, K_NO_WAIT);
+  if (err == 0)
+  {
+    if (r != light_radio[cmd->channel])
+    {
+      w->moved++;
+    }
+    merge_target(cmd);
+    light_seq[cmd->channel] = queued.seq;
+    light_radio[cmd->channel] = r;
+    light_pending[cmd->channel]++;
+    w->load++;
+    w->max_load = MAX(w->max_load, w->load);
+  }
+  else
+  {
+    w->rejected++;
+  }
+  k_spin_unlock(&sched_lock, key);
+
+  if (err != 0)
+  {
+    LOG_ERR("Radio %d queue full, channel %d command dropped", r,
+            cmd->channel);
+    return -ENOBUFS;
+  }
+  k_sem_give(&w->ready);
+  return 0;
+}
+
+/* A scene goes where one of its lights is pending, call with sched_lock */
+static uint8_t pick_scene_radio(uint32_t lights)
+{
+  uint32_t rest = lights;
+
+  while (rest != 0)
+  {
+    int ch = find_lsb_set(rest) - 1;
+
+    if (light_pending[ch] > 0)
+    {
+      return light_radio[ch];
+    }
+    rest &= ~BIT(ch);
+  }
+  return pick_radio(find_lsb_set(lights) - 1);
+}
+
+/**
+ * Queue a scene recall, never blocks. Each of its lights is pending on
+ * the radio until the scene has run and takes the scene's target, the
+ * light's commands queued before it are dropped when they come up.
+ */
+int tx_sched_submit_scene(const struct tx_cmd *cmd,
+                          const struct scene_target *targets, int count)
+{
+  struct tx_cmd queued = *cmd;
+  int err;
+
+  if (cmd->prio >= TX_PRIO_COUNT)
+  {
+    return -EINVAL;
+  }
+  queued.kind = TX_SCENE;
+  queued.t_queued = latency_now();
+  queued.lights = 0;
+  for (int i = 0; i < count; i++)
+  {
+    if (targets[i].light >= CHANNEL_COUNT)
+    {
+      return -EINVAL;
+    }
+    queued.lights |= BIT(targets[i].light);
+  }
+  if (queued.lights == 0)
+  {
+    return -EINVAL;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&sched_lock);
+  uint8_t r = pick_scene_radio(queued.lights);
+  struct tx_worker *w = &workers[r];
+
+  err = k_msgq_put(&w->queue[queued.prio], &queued, K_NO_WAIT);
+  if (err == 0)
+  {
+    for (int i = 0; i < count; i++)
+    {
+      const struct scene_target *t = &targets[i];
+      struct tx_target *lt = &light_target[t->light];
+
+      light_floor[t->light] = ++light_seq[t->light];
+      lt->state = t->state;
+      lt->set_brightness = (t->state == STATE_ON && t->brightness != 0);
+      lt->brightness = t->brightness;
+      light_radio[t->light] = r;
+      light_pending[t->light]++;
+    }
+    w->load++;
+    w->max_load = MAX(w->max_load, w->load);
+  }
+  else
+  {
+    w->rejected++;
+  }
+  k_spin_unlock(&sched_lock, key);
+
+  if (err != 0)
+  {
+    LOG_ERR("Radio %d queue full, scene %d dropped", r, cmd->scene);
+    return -ENOBUFS;
+  }
+  k_sem_give(&w->ready);
+  return 0;
+}
+
+/**
+ * Turn a command into what should be sent for it. The light's latest
+ * command carries everything merged into its target, once it is taken
+ * the older ones still queued in lower classes are dropped. Returns
+ * false if a newer command makes this one redundant and airtime is
+ * short.
+ */
+static bool take_cmd(struct tx_cmd *cmd)
+{
+  bool run = true;
+
+  k_spinlock_key_t key = k_spin_lock(&sched_lock);
+  if (cmd->seq < light_floor[cmd->channel])
+  {
+    run = false;
+  }
+  else if (cmd->seq == light_seq[cmd->channel])
+  {
+    const struct tx_target *t = &light_target[cmd->channel];
+
+    light_floor[cmd->channel] = cmd->seq;
+    cmd->state = t->state;
+    cmd->set_brightness = t->set_brightness;
+    cmd->brightness = t->brightness;
+  }
+  else
+  {
+    run = !airtime_tight();
+  }
+  k_spin_unlock(&sched_lock, key);
+  return run;
+}
+
+/* A command of a class above 'prio' is queued */
+static bool higher_queued(struct tx_worker *w, uint8_t prio)
+{
+  for (int p = 0; p < prio; p++)
+  {
+    if (k_msgq_num_used_get(&w->queue[p]) > 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Wait for the budget to have room for 'need' us on air, only interactive
+ * commands may use the reserve. Returns false as soon as a higher class
+ * is queued, the command is then held and waits again after it.
+ */
+static bool wait_airtime(struct tx_worker *w, uint32_t need, uint8_t prio)
+{
+  bool low = (prio != TX_PRIO_INTERACTIVE);
+  int32_t delay = airtime_delay_ms(need, low);
+
+  if (delay > 0)
+  {
+    LOG_WRN("Radio %d: airtime budget spent, %d ms wait",
+            (int)(w - workers), delay);
+    w->deferred++;
+  }
+  while (delay > 0)
+  {
+    if (higher_queued(w, prio))
+    {
+      return false;
+    }
+
+    /* Woken early by anything queued */
+    int64_t start = k_uptime_get();
+    (void)k_sem_take(&w->ready, K_MSEC(delay));
+    w->deferred_ms += k_uptime_get() - start;
+    delay = airtime_delay_ms(need, low);
+  }
+  return true;
+}
+
+/* A command starts, the first time, call with sched_lock held */
+static void record_wait(struct tx_cmd *cmd, uint64_t start)
+{
+  struct prio_stats *ps = &prio_stats[cmd->prio];
+
+  if (cmd->t_queued == 0)
+  {
+    return;
+  }
+
+  uint32_t us = (uint32_t)MIN(start - cmd->t_queued, UINT32_MAX);
+  uint32_t idx = (us < BIT(WAIT_MIN_SHIFT))
+                     ? 0
+                     : 32 - __builtin_clz(us >> WAIT_MIN_SHIFT);
+
+  ps->buckets[MIN(idx, WAIT_BUCKETS - 1)]++;
+  ps->cmds++;
+  ps->wait_us += us;
+  ps->wait_max_us = MAX(ps->wait_max_us, us);
+  cmd->t_queued = 0;
+}
+
+/* A command of a higher class than the one running is queued */
+static bool radio_wanted(uint8_t radio)
+{
+  struct tx_worker *w = &workers[radio];
+
+  return higher_queued(w, w->running);
+}
+
+/**
+ * The next command: the highest class queued first, a command that gave
+ * the radio up ahead of the rest of its class.
+ */
+static bool next_cmd(struct tx_worker *w, struct tx_cmd *cmd)
+{
+  for (int p = 0; p < TX_PRIO_COUNT; p++)
+  {
+    if (w->holding[p])
+    {
+      *cmd = w->held[p];
+      w->holding[p] = false;
+      return true;
+    }
+    if (k_msgq_get(&w->queue[p], cmd, K_NO_WAIT) == 0)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* Still pending, next_cmd() gives it back after the higher classes */
+static void hold_cmd(struct tx_worker *w, const struct tx_cmd *cmd)
+{
+  w->held[cmd->prio] = *cmd;
+  w->holding[cmd->prio] = true;
+}
+
+#if defined(CONFIG_GETSMART_SCENES)
+/**
+ * Recall a scene as one program. Only the lights it was queued with are
+ * sent, those are the ones pending here.
+ */
+static void run_scene(struct tx_worker *w, uint8_t radio, struct tx_cmd *cmd)
+{
+  struct scene_target targets[CHANNEL_COUNT];
+  int n = scene_get(cmd->scene, targets);
+  int count = 0;
+
+  for (int i = 0; i < n; i++)
+  {
+    if (cmd->lights & BIT(targets[i].light))
+    {
+      targets[count++] = targets[i];
+    }
+  }
+
+  uint32_t individual;
+  uint32_t need = controller_scene_frames(controller, targets, count,
+                                          &individual);
+
+  if (!wait_airtime(w, need * radio_airtime_us(TRANSMIT_BUF_SIZE),
+                    cmd->prio))
+  {
+    hold_cmd(w, cmd);
+    return;
+  }
+
+  uint64_t start = latency_now();
+  uint32_t frames = 0;
+  k_spinlock_key_t key = k_spin_lock(&sched_lock);
+  record_wait(cmd, start);
+  k_spin_unlock(&sched_lock, key);
+  latency_resume(&cmd->trace);
+  uint64_t t_rx = latency_current();
+  radio_power_begin(radio, true);
+  int err = controller_scene(controller, radio, targets, count, &frames);
+  radio_power_end(radio);
+  latency_end();
+
+  uint64_t end = latency_now();
+  TRACE(TR_SCENE, (cmd->scene << 16) | (frames & 0xFFFF), err);
+  scene_done(cmd->scene, err, frames, individual,
+             (uint32_t)((end - ((t_rx != 0) ? t_rx : start)) / 1000U));
+
+  key = k_spin_lock(&sched_lock);
+  for (uint32_t rest = cmd->lights; rest != 0; rest &= rest - 1)
+  {
+    light_pending[find_lsb_set(rest) - 1]--;
+  }
+  w->load--;
+  w->cmds++;
+  w->failed += (err != 0);
+  w->busy_us += end - start;
+  k_spin_unlock(&sched_lock, key);
+}
+#else
+static void run_scene(struct tx_worker *w, uint8_t radio, struct tx_cmd *cmd)
+{
+}
+#endif
+
+#if defined(CONFIG_GETSMART_REHOME)
+/**
+ * Re-home a light while the radio has nothing else to do. The light
+ * counts as pending meanwhile, so its commands queue on this radio and
+ * cut the re-home short, as do commands for other lights. Cut short for
+ * another light, it is put back to its level by a background command.
+ */
+static void run_idle(struct tx_worker *w, uint8_t radio)
+{
+  int channel = rehome_pick();
+
+  if (channel < 0)
+  {
+    return;
+  }
+
+  k_spinlock_key_t key = k_spin_lock(&sched_lock);
+  bool claimed = (light_pending[channel] == 0);
+  if (claimed)
+  {
+    light_pending[channel]++;
+    light_radio[channel] = radio;
+    w->rehoming = true;
+    w->running = TX_PRIO_COUNT;
+  }
+  k_spin_unlock(&sched_lock, key);
+  if (!claimed)
+  {
+    return;
+  }
+
+  struct light_state before;
+  radio_power_begin(radio, false);
+  airtime_attribute(radio, channel);
+  int err = controller_rehome(controller, radio, channel, radio_wanted,
+                              &before);
+  airtime_attribute(radio, -1);
+  radio_power_end(radio);
+  rehome_done(channel, err);
+
+  key = k_spin_lock(&sched_lock);
+  light_pending[channel]--;
+  bool restore = (err == -EINTR && light_pending[channel] == 0);
+  w->rehoming = false;
+  k_spin_unlock(&sched_lock, key);
+
+  if (restore)
+  {
+    struct tx_cmd cmd = {
+        .prio = TX_PRIO_BACKGROUND,
+        .channel = channel,
+        .state = before.state,
+        .set_brightness = true,
+        .brightness = before.brightness,
+    };
+    tx_sched_submit(&cmd);
+  }
+}
+#else
+static void run_idle(struct tx_worker *w, uint8_t radio) {}
+#endif
+
+/* Until the power policy or a re-home poll next has work for the radio */
+static k_timeout_t idle_wait(uint8_t radio)
+{
+  int32_t ms = radio_power_idle(radio);
+
+  if (IDLE_POLL_MS != SYS_FOREVER_MS &&
+      (ms == SYS_FOREVER_MS || ms > IDLE_POLL_MS))
+  {
+    ms = IDLE_POLL_MS;
+  }
+  return SYS_TIMEOUT_MS(ms);
+}
+
+static void tx_worker_thread(void *p1, void *p2, void *p3)
+{
+  struct tx_worker *w = p1;
+  uint8_t radio = w - workers;
+  struct tx_cmd cmd;
+
+  latency_attach(&w->trace);
+
+  while (1)
+  {
+    if (!next_cmd(w, &cmd))
+    {
+      if (k_sem_take(&w->ready, idle_wait(radio)) != 0)
+      {
+        run_idle(w, radio);
+      }
+      continue;
+    }
+    if (cmd.kind == TX_SCENE)
+    {
+      run_scene(w, radio, &cmd);
+      continue;
+    }
+
+    uint64_t start = 0;
+    int err = 0;
+    bool run = take_cmd(&cmd);
+
+    if (run)
+    {
+      uint32_t need = controller_airtime_us(controller, cmd.channel, cmd.state,
+                                            cmd.set_brightness,
+                                            cmd.brightness);
+
+      if (!wait_airtime(w, need, cmd.prio))
+      {
+        hold_cmd(w, &cmd);
+        continue;
+      }
+      /* Newer commands may have come in while waiting */
+      run = take_cmd(&cmd);
+    }
+    if (run)
+    {
+      start = latency_now();
+      k_spinlock_key_t key = k_spin_lock(&sched_lock);
+      record_wait(&cmd, start);
+      w->running = cmd.prio;
+      k_spin_unlock(&sched_lock, key);
+
+      latency_resume(&cmd.trace);
+      radio_power_begin(radio, true);
+      airtime_attribute(radio, cmd.channel);
+      err = controller_execute(controller, radio, cmd.channel, cmd.state,
+                               cmd.set_brightness, cmd.brightness,
+                               radio_wanted);
+      airtime_attribute(radio, -1);
+      radio_power_end(radio);
+    }
+
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    bool preempted = (err == -EINTR);
+    w->busy_us += run ? latency_now() - start : 0;
+    if (preempted)
+    {
+      /* Still pending, it carries on after the higher class */
+      w->preempted++;
+      prio_stats[cmd.prio].preempted++;
+    }
+    else
+    {
+      light_pending[cmd.channel]--;
+      w->load--;
+      w->cmds += run;
+      w->coalesced += !run;
+      w->failed += (err != 0);
+    }
+    k_spin_unlock(&sched_lock, key);
+
+    if (preempted)
+    {
+      latency_handoff(&cmd.trace);
+      hold_cmd(w, &cmd);
+    }
+    else if (run)
+    {
+      latency_end();
+    }
+  }
+}
+
+/* Call with a copy of the stats */
+static uint32_t wait_percentile(const struct prio_stats *ps, uint32_t pct)
+{
+  uint32_t target = DIV_ROUND_UP(ps->cmds * (uint64_t)pct, 100U);
+  uint32_t seen = 0;
+
+  if (ps->cmds == 0)
+  {
+    return 0;
+  }
+  for (uint32_t i = 0; i < WAIT_BUCKETS; i++)
+  {
+    seen += ps->buckets[i];
+    if (seen >= target)
+    {
+      return MIN(BIT(WAIT_MIN_SHIFT + i), ps->wait_max_us);
+    }
+  }
+  return ps->wait_max_us;
+}
+
+static int sched_stats_format(char *buf, size_t len)
+{
+  int n = snprintf(buf, len, "\"radios\":[");
+
+  for (int r = 0; r < RADIO_COUNT && n < len; r++)
+  {
+    struct tx_worker *w = &workers[r];
+
+    n += snprintf(buf + n, len - n,
+                  "%s{\"cmds\":%u,\"failed\":%u,\"rejected\":%u,"
+                  "\"moved\":%u,\"load\":%u,\"max_load\":%u,\"busy_ms\":%u,"
+                  "\"deferred\":%u,\"deferred_ms\":%u,\"coalesced\":%u,"
+                  "\"preempted\":%u}",
+                  (r > 0) ? "," : "", w->cmds, w->failed, w->rejected,
+                  w->moved, w->load, w->max_load,
+                  (unsigned int)(w->busy_us / 1000U), w->deferred,
+                  (unsigned int)w->deferred_ms, w->coalesced, w->preempted);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "],\"prio\":{");
+  }
+  for (int p = 0; p < TX_PRIO_COUNT && n < len; p++)
+  {
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    struct prio_stats ps = prio_stats[p];
+    k_spin_unlock(&sched_lock, key);
+
+    n += snprintf(buf + n, len - n,
+                  "%s\"%s\":{\"cmds\":%u,\"preempted\":%u,\"wait_us\":%u,"
+                  "\"wait_p95_us\":%u,\"wait_max_us\":%u}",
+                  (p > 0) ? "," : "", prio_names[p], ps.cmds, ps.preempted,
+                  (unsigned int)(ps.wait_us / MAX(ps.cmds, 1U)),
+                  wait_percentile(&ps, 95), ps.wait_max_us);
+  }
+  if (n < len)
+  {
+    n += snprintf(buf + n, len - n, "}");
+  }
+  return n;
+}
+
+static int cmd_sched(const struct shell *sh, size_t argc, char **argv)
+{
+  shell_print(sh, "%-6s %8s %8s %8s %8s %6s %8s %10s %8s %9s %9s", "radio",
+              "cmds", "failed", "rejected", "moved", "load", "max_load",
+              "busy_ms", "deferred", "coalesced", "preempted");
+  for (int r = 0; r < RADIO_COUNT; r++)
+  {
+    struct tx_worker *w = &workers[r];
+
+    shell_print(sh, "%-6d %8u %8u %8u %8u %6u %8u %10u %8u %9u %9u", r,
+                w->cmds, w->failed, w->rejected, w->moved, w->load,
+                w->max_load, (unsigned int)(w->busy_us / 1000U), w->deferred,
+                w->coalesced, w->preempted);
+  }
+
+  shell_print(sh, "%-12s %8s %9s %10s %10s %10s", "class", "cmds",
+              "preempted", "wait_us", "p95_us", "max_us");
+  for (int p = 0; p < TX_PRIO_COUNT; p++)
+  {
+    k_spinlock_key_t key = k_spin_lock(&sched_lock);
+    struct prio_stats ps = prio_stats[p];
+    k_spin_unlock(&sched_lock, key);
+
+    shell_print(sh, "%-12s %8u %9u %10u %10u %10u", prio_names[p], ps.cmds,
+                ps.preempted, (unsigned int)(ps.wait_us / MAX(ps.cmds, 1U)),
+                wait_percentile(&ps, 95), ps.wait_max_us);
+  }
+  return 0;
+}
+
+SHELL_SUBCMD_ADD((gs), sched, NULL, "Radio queues, load and queueing delay",
+                 cmd_sched, 1, 0);
+
+static struct stats_provider sched_stats = {
+    .name = "sched",
+    .format = sched_stats_format,
+};
+
+int tx_sched_init(controller_t *ctrl)
+{
+  char name[16];
+
+  controller = ctrl;
+  rehome_init(ctrl);
+  for (int ch = 0; ch < CHANNEL_COUNT; ch++)
+  {
+    light_radio[ch] = ch % RADIO_COUNT;
+  }
+
+  for (int r = 0; r < RADIO_COUNT; r++)
+  {
+    struct tx_worker *w = &workers[r];
+
+    for (int p = 0; p < TX_PRIO_COUNT; p++)
+    {
+      k_msgq_init(&w->queue[p], (char *)w->queue_buf[p], sizeof(struct tx_cmd),
+                  TX_QUEUE_DEPTH);
+    }
+    k_sem_init(&w->ready, 0, 1);
+    k_thread_create(&w->thread, tx_stacks[r],
+                    K_THREAD_STACK_SIZEOF(tx_stacks[r]), tx_worker_thread, w,
+                    NULL, NULL, TX_PRIORITY, 0, K_FOREVER);
+    snprintf(name, sizeof(name), "tx%d", r);
+    k_thread_name_set(&w->thread, name);
+    int err = affinity_pin_radio(&w->thread);
+    if (err != 0)
+    {
+      LOG_WRN("tx%d not pinned: %d", r, err);
+    }
+    k_thread_start(&w->thread);
+  }
+  stats_register(&sched_stats);
+  return 0;
+}
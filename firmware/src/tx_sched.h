@@ -0,0 +1,77 @@
+#ifndef __GET_TX_SCHED__
+#define __GET_TX_SCHED__
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "controller.h"
+#include "latency.h"
+
+/**
+ * Runs light commands on the radios, each radio has its own queue and
+ * thread so a long dim ramp only holds up the commands queued behind it.
+ * A light's commands stay on one radio while any are pending, so they
+ * are carried out in order; otherwise the least loaded radio is picked,
+ * the light's previous radio winning a tie.
+ *
+ * Before a command runs its time on air is checked against the duty
+ * cycle budget, see airtime.h. Dim ramps wait while only the reserve is
+ * left, anything waits once the budget is spent, and while the budget
+ * is tight a light's queued commands collapse into its latest one.
+ * A radio with nothing queued re-homes idle lights, see rehome.h.
+ *
+ * A scene recall is one command for all of its lights, it supersedes
+ * their commands queued before it wherever they are queued.
+ *
+ * Commands come in priority classes, each radio has a queue per class
+ * and runs the highest class queued first. A dim ramp gives the radio
+ * up between pairs to a command of a higher class, then carries on from
+ * the level it reached ahead of the rest of its class. Once a light's
+ * latest command has been taken, its older ones still queued in a lower
+ * class are dropped.
+ */
+enum tx_kind {
+  TX_LIGHT,
+  TX_SCENE,
+};
+
+enum tx_prio {
+  TX_PRIO_INTERACTIVE, /* Someone is waiting for it, the default */
+  TX_PRIO_AUTOMATION,  /* Scheduled, nobody watching closely */
+  TX_PRIO_BACKGROUND,  /* Long transitions and restores */
+  TX_PRIO_COUNT,
+};
+
+struct tx_cmd {
+  uint8_t kind;
+  uint8_t prio;
+  /* TX_SCENE: the scene and its lights, set by tx_sched_submit_scene() */
+  uint8_t scene;
+  uint32_t lights;
+  int channel;
+  int state;
+  bool set_brightness;
+  int brightness;
+  struct lat_trace trace;
+  /* Per light, set by tx_sched_submit() */
+  uint32_t seq;
+  /* When it was queued, 0 once it has started */
+  uint64_t t_queued;
+};
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    int tx_sched_init(controller_t *controller);
+    int tx_sched_submit(const struct tx_cmd *cmd);
+    int tx_sched_submit_scene(const struct tx_cmd *cmd,
+                              const struct scene_target *targets, int count);
+    /* "interactive", "automation" or "background", -EINVAL otherwise */
+    int tx_prio_parse(const char *name);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /*__GET_TX_SCHED__*/
@@ -188,18 +188,32 @@ static void ip_mgmt_event_handler(struct net_mgmt_event_callback *cb, uint32_t m
   }
 }
 
-void wifi_status(void)
+static int wifi_iface_status(struct wifi_iface_status *status)
 {
   struct net_if *iface = net_if_get_default();
-  struct wifi_iface_status status = {0};
 
   if (!iface)
+  {
+    return -ENODEV;
+  }
+  if (net_mgmt(NET_REQUEST_WIFI_IFACE_STATUS, iface, status, sizeof(*status)))
+  {
+    return -EIO;
+  }
+  return 0;
+}
+
+void wifi_status(void)
+{
+  struct wifi_iface_status status = {0};
+  int err = wifi_iface_status(&status);
+
+  if (err == -ENODEV)
   {
     LOG_ERR("Failed to get default network interface");
     return;
   }
-
-  if (net_mgmt(NET_REQUEST_WIFI_IFACE_STATUS, iface, &status, sizeof(status)))
+  if (err != 0)
   {
     LOG_ERR("WiFi Status Request Failed");
     return;
@@ -220,6 +234,24 @@ void wifi_status(void)
   }
 }
 
+/* Signal strength of the current association, in dBm */
+int wifi_rssi(int *rssi)
+{
+  struct wifi_iface_status status = {0};
+  int err = wifi_iface_status(&status);
+
+  if (err != 0)
+  {
+    return err;
+  }
+  if (status.state < WIFI_STATE_ASSOCIATED)
+  {
+    return -ENOTCONN;
+  }
+  *rssi = status.rssi;
+  return 0;
+}
+
 static int wifi_sta_connect(void)
 {
   struct net_if *iface = net_if_get_first_wifi();
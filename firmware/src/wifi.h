@@ -10,6 +10,7 @@ extern "C"
     static void handle_ipv4_result(struct net_if *iface);
     int wifi_init();
     void wifi_status();
+    int wifi_rssi(int *rssi);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,53 @@
+#include <zephyr/ztest.h>
+
+#include "bench.h"
+#include "config_mgr.h"
+#include "lights.h"
+
+/**
+ * The 'gs bench' hot path microbenchmarks as a test. Each one has to run
+ * and leave nothing allocated behind, and the "BENCH {json}" lines are
+ * printed as 'gs bench' prints them, so the test output can be compared
+ * with tools/bench_compare.py. No timing is asserted, simulated time
+ * stands still while code runs on native_sim.
+ */
+
+static void *bench_setup(void)
+{
+  /* What main() does before the radios start, the code words of every
+   * light are generated here */
+  zassert_ok(cfg_init(), "No config storage");
+  zassert_true(lights_init() > 0, "No lights");
+  return NULL;
+}
+
+ZTEST(bench, test_measure)
+{
+  struct bench_result r;
+
+  zassert_true(bench_count() > 0);
+  for (int b = 0; b < bench_count(); b++)
+  {
+    zassert_ok(bench_measure(b, CONFIG_GETSMART_BENCH_ITERATIONS, &r));
+    zassert_not_null(r.name);
+    zassert_equal(r.iters, CONFIG_GETSMART_BENCH_ITERATIONS);
+    zassert_equal(r.heap_leak_op, 0, "%s leaks %u bytes per operation",
+                  r.name, r.heap_leak_op);
+  }
+}
+
+ZTEST(bench, test_measure_bad_args)
+{
+  struct bench_result r;
+
+  zassert_equal(bench_measure(-1, 1, &r), -EINVAL);
+  zassert_equal(bench_measure(bench_count(), 1, &r), -EINVAL);
+  zassert_equal(bench_measure(0, 0, &r), -EINVAL);
+}
+
+ZTEST(bench, test_report)
+{
+  bench_run(NULL, NULL, CONFIG_GETSMART_BENCH_ITERATIONS);
+}
+
+ZTEST_SUITE(bench, NULL, bench_setup, NULL, NULL, NULL);
@@ -0,0 +1,63 @@
+#!/usr/bin/env python3
+"""Compare two runs of the 'gs bench' microbenchmarks.
+
+Each input is console output containing "BENCH {json}" lines, e.g.
+from native_sim with CONFIG_GETSMART_BENCH_AUTORUN=y:
+
+    ./build/zephyr/zephyr.exe -stop_at=5 > new.txt
+    bench_compare.py base.txt new.txt --threshold 10
+
+Exits non-zero if any benchmark got slower, or allocates more heap per
+operation, by more than the threshold.
+"""
+import argparse
+import json
+import re
+import sys
+
+LINE = re.compile(r"BENCH (\{.*\})")
+
+
+def load(path):
+    results = {}
+    with open(path) as f:
+        for line in f:
+            m = LINE.search(line)
+            if m:
+                r = json.loads(m.group(1))
+                results[r["name"]] = r
+    return results
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("base")
+    ap.add_argument("new")
+    ap.add_argument("--threshold", type=float, default=10.0,
+                    help="allowed slowdown in percent (default 10)")
+    ap.add_argument("--metric", default="cycles_op", choices=["cycles_op", "ns_op"])
+    args = ap.parse_args()
+
+    base, new = load(args.base), load(args.new)
+    failed = False
+
+    print("%-16s %12s %12s %8s %10s" % ("bench", "base", "new", "delta", "heap/op"))
+    for name in sorted(set(base) | set(new)):
+        if name not in base or name not in new:
+            print("%-16s %s" % (name, "only in " + ("new" if name in new else "base")))
+            continue
+        b, n = base[name][args.metric], new[name][args.metric]
+        delta = 100.0 * (n - b) / b if b else 0.0
+        leak = new[name]["heap_leak_bytes_op"] - base[name]["heap_leak_bytes_op"]
+        flag = ""
+        if delta > args.threshold or leak > 0:
+            flag = "  REGRESSION"
+            failed = True
+        print("%-16s %12d %12d %+7.1f%% %+10d%s" % (name, b, n, delta, leak, flag))
+
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,406 @@
+/**
+ * Decode GET remote frames from a capture into a PULSESEQ table.
+ *
+ * Reads a demodulated bitstream or raw IQ recorded around 433.978 MHz,
+ * finds the 0x542AAAA55555 header, turns each 32 bit code word back into
+ * its pulse runs (the inverse of get_code_word() in codec_get.h) and
+ * prints one row per button press, as a table ready to paste into
+ * controller.h. Press the remote's buttons in table order while
+ * recording (per channel: on, off, then the dim pulses) and the rows
+ * come out in place. With --distinct each code is printed once instead.
+ *
+ * Build:  c++ -O2 -std=c++17 -o capture_decode capture_decode.cpp
+ *
+ *   capture_decode --format bits capture.txt          ASCII 0/1
+ *   capture_decode --format bin capture.bin           packed, MSB first
+ *   capture_decode --format cs8 --rate 2e6 --offset -120e3 hackrf.cs8
+ *   capture_decode --format cu8 --rate 2.4e6 rtl.cu8
+ *   capture_decode --format cf32 --rate 1e6 gqrx.raw
+ *
+ * IQ is FM demodulated with a one sample discriminator, integrated over
+ * a bit period at 8 phases per bit and each phase sliced separately, so
+ * no clock recovery is needed for a 80 bit frame. --offset is the
+ * signal's frequency relative to the capture centre.
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+constexpr uint64_t SYNC = 0x542AAAA55555ULL;
+constexpr uint64_t SYNC_MASK = 0xFFFFFFFFFFFFULL;
+constexpr int OVERSAMPLE = 8;
+/* Frames of one press are repeated back to back, well under this */
+constexpr double PRESS_GAP_S = 0.25;
+
+struct options {
+  std::string format = "bin";
+  std::string path;
+  double rate = 2e6;
+  double offset = 0;
+  double bitrate = 1600;
+  bool invert = false;
+  bool frames = false;
+  bool distinct = false;
+  int width = 7;
+};
+
+struct code_info {
+  uint32_t code;
+  double first_s;
+  unsigned frames;
+  unsigned presses;
+  std::vector<int> runs;
+  bool valid;
+};
+
+/* A burst of repeats of the same code */
+struct press {
+  size_t code;
+  double t_s;
+  unsigned frames;
+};
+
+struct decoder {
+  double bitrate = 1600;
+  bool list_frames = false;
+  std::map<uint32_t, size_t> index;
+  std::vector<code_info> codes;
+  std::vector<press> presses;
+  unsigned long frames = 0;
+  unsigned long invalid = 0;
+  /* Last frame, to drop the same frame found at a neighbouring phase */
+  double last_s = -1;
+  uint32_t last_code = 0;
+  double press_end = 0;
+
+  void frame(uint32_t code, double t_s);
+};
+
+/**
+ * Inverse of get_code_word(): after the 0x4 prefix each pulse is a 1
+ * followed by a 0, with an extra 0 ending each run. Trailing empty runs
+ * can't be told from padding and are dropped, as in the PULSESEQ rows.
+ */
+bool code_to_runs(uint32_t code, std::vector<int> &runs) {
+  runs.clear();
+  if ((code & 0xF0000000U) != 0x40000000U) {
+    return false;
+  }
+
+  int bit = 27;
+  int run = 0;
+  while (bit >= 0) {
+    if (code & (1U << bit)) {
+      if (bit > 0 && (code & (1U << (bit - 1)))) {
+        return false; /* Two 1s in a row is not a pulse */
+      }
+      run++;
+      bit -= 2;
+    } else {
+      runs.push_back(run);
+      run = 0;
+      bit -= 1;
+    }
+  }
+  if (run > 0) {
+    runs.push_back(run);
+  }
+  while (!runs.empty() && runs.back() == 0) {
+    runs.pop_back();
+  }
+  return !runs.empty();
+}
+
+void decoder::frame(uint32_t code, double t_s) {
+  if (code == last_code && t_s - last_s < 40.0 / bitrate) {
+    return;
+  }
+  last_code = code;
+  last_s = t_s;
+  frames++;
+
+  auto it = index.find(code);
+  if (it == index.end()) {
+    code_info ci{code, t_s, 0, 0, {}, false};
+    ci.valid = code_to_runs(code, ci.runs);
+    it = index.emplace(code, codes.size()).first;
+    codes.push_back(ci);
+  }
+  code_info &ci = codes[it->second];
+  if (!ci.valid) {
+    invalid++;
+  }
+  ci.frames++;
+
+  press *last = presses.empty() ? nullptr : &presses.back();
+  if (last == nullptr || last->code != it->second ||
+      t_s - press_end > PRESS_GAP_S) {
+    presses.push_back(press{it->second, t_s, 0});
+    ci.presses++;
+  }
+  presses.back().frames++;
+  press_end = t_s;
+
+  if (list_frames) {
+    printf("%.6f,0x%08x\n", t_s, code);
+  }
+}
+
+/* 80 bit window over the bitstream, header then code word */
+struct bit_window {
+  uint64_t hi = 0; /* older 48 bits */
+  uint32_t lo = 0; /* newest 32 bits */
+
+  bool push(int bit) {
+    hi = ((hi << 1) | (lo >> 31)) & SYNC_MASK;
+    lo = (lo << 1) | (bit & 1);
+    return hi == SYNC;
+  }
+};
+
+int decode_bits(FILE *f, const options &opt, decoder &dec) {
+  bit_window w;
+  unsigned long long n = 0;
+  const bool packed = (opt.format == "bin");
+  unsigned char buf[1 << 16];
+  size_t len;
+
+  while ((len = fread(buf, 1, sizeof(buf), f)) > 0) {
+    for (size_t i = 0; i < len; i++) {
+      if (packed) {
+        for (int b = 7; b >= 0; b--) {
+          n++;
+          if (w.push(((buf[i] >> b) & 1) ^ opt.invert)) {
+            dec.frame(w.lo, (n - 80) / opt.bitrate);
+          }
+        }
+      } else if (buf[i] == '0' || buf[i] == '1') {
+        n++;
+        if (w.push((buf[i] - '0') ^ opt.invert)) {
+          dec.frame(w.lo, (n - 80) / opt.bitrate);
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+/* Reads IQ samples of one of the supported formats as floats */
+struct iq_reader {
+  FILE *f;
+  std::string format;
+  std::vector<unsigned char> raw;
+
+  size_t read(std::vector<float> &iq) {
+    size_t bytes_per = (format == "cf32") ? 8 : 2;
+    raw.resize(iq.size() / 2 * bytes_per);
+    size_t n = fread(raw.data(), bytes_per, iq.size() / 2, f);
+
+    if (format == "cf32") {
+      memcpy(iq.data(), raw.data(), n * 8);
+    } else if (format == "cs8") {
+      for (size_t i = 0; i < n * 2; i++) {
+        iq[i] = (float)(int8_t)raw[i];
+      }
+    } else {
+      for (size_t i = 0; i < n * 2; i++) {
+        iq[i] = (float)raw[i] - 127.5f;
+      }
+    }
+    return n;
+  }
+};
+
+int decode_iq(FILE *f, const options &opt, decoder &dec) {
+  const double sps = opt.rate / (opt.bitrate * OVERSAMPLE);
+  if (sps < 2) {
+    fprintf(stderr, "Sample rate too low for %g bps\n", opt.bitrate);
+    return 1;
+  }
+
+  iq_reader rd{f, opt.format, {}};
+  std::vector<float> iq(2 * (1 << 16));
+
+  /* NCO moving the signal to 0 Hz */
+  const double w = -2.0 * M_PI * opt.offset / opt.rate;
+  const float rot_re = (float)cos(w), rot_im = (float)sin(w);
+  float nco_re = 1, nco_im = 0;
+
+  float prev_re = 0, prev_im = 0;
+  double acc = 0, next_dump = sps;
+  /* The last bit period in OVERSAMPLE slots, each phase sums all of them */
+  double slots[OVERSAMPLE] = {0};
+  double bit_sum = 0;
+  unsigned long long sample = 0, slot = 0;
+  bit_window phases[OVERSAMPLE];
+  size_t n;
+
+  while ((n = rd.read(iq)) > 0) {
+    for (size_t i = 0; i < n; i++, sample++) {
+      float re = iq[2 * i], im = iq[2 * i + 1];
+      float m_re = re * nco_re - im * nco_im;
+      float m_im = re * nco_im + im * nco_re;
+
+      /* Sign of the phase step is all the slicer needs */
+      acc += m_im * prev_re - m_re * prev_im;
+      prev_re = m_re;
+      prev_im = m_im;
+
+      float t = nco_re * rot_re - nco_im * rot_im;
+      nco_im = nco_re * rot_im + nco_im * rot_re;
+      nco_re = t;
+      if ((sample & 0xFFF) == 0) {
+        float mag = std::sqrt(nco_re * nco_re + nco_im * nco_im);
+        nco_re /= mag;
+        nco_im /= mag;
+      }
+
+      if (sample + 1 >= next_dump) {
+        bit_sum += acc - slots[slot % OVERSAMPLE];
+        slots[slot % OVERSAMPLE] = acc;
+
+        bit_window &pw = phases[slot % OVERSAMPLE];
+        if (pw.push((bit_sum > 0) ^ opt.invert)) {
+          dec.frame(pw.lo, (sample / opt.rate) - 80.0 / opt.bitrate);
+        }
+        acc = 0;
+        slot++;
+        next_dump += sps;
+      }
+    }
+  }
+  return 0;
+}
+
+void print_row(const code_info &ci, size_t width, const char *note) {
+  printf("%zu", ci.runs.size());
+  for (size_t i = 0; i + 1 < width; i++) {
+    printf(", %d", (i < ci.runs.size()) ? ci.runs[i] : 0);
+  }
+  printf(" /* 0x%08x %s */", ci.code, note);
+}
+
+void print_table(const decoder &dec, const options &opt) {
+  printf("// %lu frames, %zu presses, %zu distinct codes, %lu invalid frames\n",
+         dec.frames, dec.presses.size(), dec.codes.size(), dec.invalid);
+
+  size_t width = opt.width;
+  for (const code_info &ci : dec.codes) {
+    if (ci.valid) {
+      width = std::max(width, ci.runs.size() + 1);
+    }
+  }
+  if ((int)width != opt.width) {
+    printf("// Rows need widening, update PLUSESEQ_SIZE to %zu\n", width);
+  }
+
+  printf("// clang-format off\n#define PULSESEQ {");
+  const char *sep = "";
+  char note[64];
+  if (opt.distinct) {
+    for (const code_info &ci : dec.codes) {
+      if (ci.valid) {
+        snprintf(note, sizeof(note), "%u presses, first at %.2fs",
+                 ci.presses, ci.first_s);
+        printf("%s", sep);
+        print_row(ci, width, note);
+        sep = ", \\\n                  ";
+      }
+    }
+  } else {
+    for (const press &p : dec.presses) {
+      const code_info &ci = dec.codes[p.code];
+      if (ci.valid) {
+        snprintf(note, sizeof(note), "%u frames at %.2fs", p.frames, p.t_s);
+        printf("%s", sep);
+        print_row(ci, width, note);
+        sep = ", \\\n                  ";
+      }
+    }
+  }
+  printf("}\n// clang-format on\n");
+
+  for (const code_info &ci : dec.codes) {
+    if (!ci.valid) {
+      printf("// not a pulse code: 0x%08x (%u frames, first at %.2fs)\n",
+             ci.code, ci.frames, ci.first_s);
+    }
+  }
+}
+
+void usage(const char *prog) {
+  fprintf(stderr,
+          "usage: %s [--format bits|bin|cs8|cu8|cf32] [--rate sps]\n"
+          "          [--offset hz] [--bitrate bps] [--invert] [--frames]\n"
+          "          [--distinct] [--width n] [file|-]\n",
+          prog);
+}
+
+}  // namespace
+
+int main(int argc, char **argv) {
+  options opt;
+
+  for (int i = 1; i < argc; i++) {
+    std::string a = argv[i];
+    bool has_val = (i + 1 < argc);
+    if (a == "--format" && has_val) {
+      opt.format = argv[++i];
+    } else if (a == "--rate" && has_val) {
+      opt.rate = atof(argv[++i]);
+    } else if (a == "--offset" && has_val) {
+      opt.offset = atof(argv[++i]);
+    } else if (a == "--bitrate" && has_val) {
+      opt.bitrate = atof(argv[++i]);
+    } else if (a == "--width" && has_val) {
+      opt.width = atoi(argv[++i]);
+    } else if (a == "--invert") {
+      opt.invert = true;
+    } else if (a == "--frames") {
+      opt.frames = true;
+    } else if (a == "--distinct") {
+      opt.distinct = true;
+    } else if (a[0] == '-' && a != "-") {
+      usage(argv[0]);
+      return 2;
+    } else {
+      opt.path = a;
+    }
+  }
+
+  bool iq = (opt.format == "cs8" || opt.format == "cu8" || opt.format == "cf32");
+  if (!iq && opt.format != "bits" && opt.format != "bin") {
+    usage(argv[0]);
+    return 2;
+  }
+
+  FILE *f = (opt.path.empty() || opt.path == "-") ? stdin
+                                                  : fopen(opt.path.c_str(), "rb");
+  if (f == nullptr) {
+    perror(opt.path.c_str());
+    return 1;
+  }
+
+  decoder dec;
+  dec.bitrate = opt.bitrate;
+  dec.list_frames = opt.frames;
+  if (opt.frames) {
+    printf("time_s,code\n");
+  }
+  int err = iq ? decode_iq(f, opt, dec) : decode_bits(f, opt, dec);
+  if (f != stdin) {
+    fclose(f);
+  }
+  if (err == 0 && !opt.frames) {
+    print_table(dec, opt);
+  }
+  return err;
+}
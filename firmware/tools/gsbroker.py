@@ -0,0 +1,232 @@
+"""Minimal in-process MQTT 3.1.1 broker for driving the native_sim firmware.
+
+Only what the firmware uses is implemented: CONNECT, SUBSCRIBE,
+UNSUBSCRIBE, PUBLISH at QoS 0/1, PINGREQ and DISCONNECT. The host tool
+publishes with Broker.publish() and sees every message the firmware
+publishes through the on_publish callback.
+
+A client connecting without clean session keeps its subscriptions and
+unacknowledged QoS 1 messages, which are sent again with DUP set when
+it reconnects. Broker.lose_acks throws PUBACKs away as if the
+connection failed before they arrived.
+"""
+import asyncio
+import struct
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK = 1, 2, 3, 4
+SUBSCRIBE, SUBACK, UNSUBSCRIBE, UNSUBACK = 8, 9, 10, 11
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+
+
+def topic_matches(pattern, topic):
+    p, t = pattern.split("/"), topic.split("/")
+    for i, part in enumerate(p):
+        if part == "#":
+            return True
+        if i >= len(t) or (part != "+" and part != t[i]):
+            return False
+    return len(p) == len(t)
+
+
+def encode_len(n):
+    out = bytearray()
+    while True:
+        b = n % 128
+        n //= 128
+        out.append(b | (0x80 if n else 0))
+        if not n:
+            return bytes(out)
+
+
+def packet(ptype, flags, body):
+    return bytes([(ptype << 4) | flags]) + encode_len(len(body)) + body
+
+
+class Client:
+    def __init__(self, broker, reader, writer):
+        self.broker = broker
+        self.reader = reader
+        self.writer = writer
+        self.client_id = None
+        self.session = Session()
+
+    async def read_packet(self):
+        hdr = await self.reader.readexactly(1)
+        mult, length = 1, 0
+        while True:
+            b = (await self.reader.readexactly(1))[0]
+            length += (b & 0x7F) * mult
+            if not b & 0x80:
+                break
+            mult *= 128
+        body = await self.reader.readexactly(length) if length else b""
+        return hdr[0] >> 4, hdr[0] & 0x0F, body
+
+    def send(self, data):
+        if not self.writer.is_closing():
+            self.writer.write(data)
+
+    @property
+    def subs(self):
+        return self.session.subs
+
+    def deliver(self, topic, payload, qos, retain=False, dup=False):
+        qos = min(qos, max((q for p, q in self.subs.items() if topic_matches(p, topic)), default=-1))
+        if qos < 0:
+            return None
+        pid = None
+        if qos > 0:
+            pid = self.session.next_id
+            self.session.next_id = pid % 65535 + 1
+            self.session.inflight[pid] = (topic, payload, retain, time.monotonic())
+        self.send_publish(topic, payload, qos, pid, retain, dup)
+        return pid
+
+    def send_publish(self, topic, payload, qos, pid, retain, dup):
+        t = topic.encode()
+        body = struct.pack("!H", len(t)) + t
+        if pid is not None:
+            body += struct.pack("!H", pid)
+        flags = (qos << 1) | (1 if retain else 0) | (8 if dup else 0)
+        self.send(packet(PUBLISH, flags, body + payload))
+
+    def resume(self):
+        """Send the unacknowledged messages of a kept session again."""
+        for pid, (topic, payload, retain, _) in list(self.session.inflight.items()):
+            self.send_publish(topic, payload, 1, pid, retain, True)
+            self.broker.redelivered += 1
+
+    async def run(self):
+        try:
+            while True:
+                ptype, flags, body = await self.read_packet()
+                if ptype == CONNECT:
+                    off = 2 + struct.unpack("!H", body[:2])[0] + 4
+                    clean = bool(body[off - 3] & 0x02)
+                    n = struct.unpack("!H", body[off:off + 2])[0]
+                    self.client_id = body[off + 2:off + 2 + n].decode()
+                    present = self.broker.attach(self, clean)
+                    self.send(packet(CONNACK, 0, bytes([present, 0])))
+                    self.broker.on_connect(self)
+                    if present:
+                        self.resume()
+                elif ptype == PUBLISH:
+                    n = struct.unpack("!H", body[:2])[0]
+                    topic = body[2:2 + n].decode()
+                    off, qos = 2 + n, (flags >> 1) & 3
+                    if qos:
+                        pid = struct.unpack("!H", body[off:off + 2])[0]
+                        off += 2
+                        self.send(packet(PUBACK, 0, struct.pack("!H", pid)))
+                    self.broker.route(self, topic, body[off:], qos, bool(flags & 1))
+                elif ptype == PUBACK:
+                    pid = struct.unpack("!H", body[:2])[0]
+                    if self.broker.lose_acks:
+                        self.broker.lose_acks -= 1
+                    else:
+                        self.session.inflight.pop(pid, None)
+                elif ptype == SUBSCRIBE:
+                    pid = struct.unpack("!H", body[:2])[0]
+                    off, granted = 2, bytearray()
+                    while off < len(body):
+                        n = struct.unpack("!H", body[off:off + 2])[0]
+                        topic = body[off + 2:off + 2 + n].decode()
+                        qos = min(body[off + 2 + n], 1)
+                        self.subs[topic] = qos
+                        granted.append(qos)
+                        off += 3 + n
+                    self.send(packet(SUBACK, 0, struct.pack("!H", pid) + bytes(granted)))
+                    self.broker.on_subscribe(self)
+                elif ptype == UNSUBSCRIBE:
+                    pid = struct.unpack("!H", body[:2])[0]
+                    self.send(packet(UNSUBACK, 0, struct.pack("!H", pid)))
+                elif ptype == PINGREQ:
+                    self.send(packet(PINGRESP, 0, b""))
+                elif ptype == DISCONNECT:
+                    break
+        except (asyncio.IncompleteReadError, asyncio.CancelledError, ConnectionError):
+            pass
+        finally:
+            self.broker.clients.discard(self)
+            self.writer.close()
+            self.broker.on_disconnect(self)
+
+    def drop(self):
+        """Close the connection without a DISCONNECT, like a network fault."""
+        self.writer.transport.abort()
+
+
+class Session:
+    def __init__(self):
+        self.subs = {}
+        self.next_id = 1
+        self.inflight = {}
+
+
+class Broker:
+    def __init__(self, host="127.0.0.1", port=1883):
+        self.host, self.port = host, port
+        self.clients = set()
+        self.retained = {}
+        self.sessions = {}
+        self.on_publish = lambda topic, payload: None
+        self.connected = asyncio.Event()
+        self.subscribed = asyncio.Event()
+        self.connects = 0
+        self.redelivered = 0
+        self.lose_acks = 0
+
+    async def start(self):
+        self.server = await asyncio.start_server(self._accept, self.host, self.port)
+
+    async def stop(self):
+        for c in list(self.clients):
+            c.drop()
+        self.server.close()
+        await self.server.wait_closed()
+
+    async def _accept(self, reader, writer):
+        c = Client(self, reader, writer)
+        self.clients.add(c)
+        await c.run()
+
+    def attach(self, client, clean):
+        """Give a connecting client its session, True if it was kept."""
+        present = not clean and client.client_id in self.sessions
+        if present:
+            client.session = self.sessions[client.client_id]
+        if clean:
+            self.sessions.pop(client.client_id, None)
+        else:
+            self.sessions[client.client_id] = client.session
+        return present
+
+    def on_connect(self, client):
+        self.connects += 1
+        self.connected.set()
+
+    def on_subscribe(self, client):
+        self.subscribed.set()
+        for topic, payload in self.retained.items():
+            client.deliver(topic, payload, 1, retain=True)
+
+    def on_disconnect(self, client):
+        if not self.clients:
+            self.connected.clear()
+            self.subscribed.clear()
+
+    def route(self, sender, topic, payload, qos, retain):
+        if retain:
+            self.retained[topic] = payload
+        self.on_publish(topic, payload)
+        for c in list(self.clients):
+            if c is not sender:
+                c.deliver(topic, payload, qos)
+
+    def publish(self, topic, payload, qos=1, retain=False, dup=False):
+        if isinstance(payload, str):
+            payload = payload.encode()
+        if retain:
+            self.retained[topic] = payload
+        return [c.deliver(topic, payload, qos, dup=dup) for c in list(self.clients)]
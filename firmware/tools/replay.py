@@ -0,0 +1,323 @@
+#!/usr/bin/env python3
+"""Replay a recorded command trace against the native_sim firmware.
+
+The trace is JSON lines, one MQTT command per line with its time in
+seconds from the start of the recording:
+
+    {"t": 0.0,  "channel": 0, "state": "ON"}
+    {"t": 12.5, "channel": 1, "state": "ON", "brightness": 20}
+    {"t": 30.0, "channel": 0, "state": "OFF", "priority": "background"}
+
+Runs its own broker on 127.0.0.1:1883, starts the firmware with
+-rt-ratio so simulated time runs --speed times faster than wall time,
+replays the commands on the same schedule and reports:
+
+  - command throughput
+  - end to end latency percentiles, command publish to state publish
+  - the firmware's own per stage latency, per radio load, RF airtime,
+    radio power policy and dim frame pacing ("latency", "sched",
+    "airtime", "power", "pacing" and "sim" stats, so the build wants a
+    short GETSMART_STATS_INTERVAL_S)
+  - lights whose modelled state differs from the reported state
+
+    west build -b native_sim firmware
+    replay.py tools/traces/evening.jsonl --firmware build/zephyr/zephyr.exe --speed 20
+
+Without --firmware it waits for one to connect, e.g. qemu_x86_64 which
+runs in real time and reaches the broker through QEMU user networking:
+
+    west build -b qemu_x86_64 firmware -t run
+    replay.py tools/traces/evening.jsonl --speed 1
+
+Exits non-zero if a light diverged, a command was never answered or a
+radio still counts commands as queued once the run has drained, or
+with --expect-preempt if no dim ramp gave its radio up.
+"""
+import argparse
+import asyncio
+import json
+import os
+import re
+import signal
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from gsbroker import Broker  # noqa: E402
+
+DIM_LEVELS = 64
+CMND = "getsmart/device/{}/channel/{}/cmnd"
+STATE = re.compile(r"getsmart/device/([^/]+)/channel/(\d+)/state")
+STATS = re.compile(r"getsmart/device/([^/]+)/stats")
+DEVICE = re.compile(r"getsmart/device/([^/]+)/")
+
+
+def load_trace(path):
+    cmds = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            c = json.loads(line)
+            if "t" not in c or "channel" not in c or "state" not in c:
+                sys.exit(f"{path}:{n}: needs t, channel and state")
+            cmds.append(c)
+    cmds.sort(key=lambda c: c["t"])
+    return cmds
+
+
+def expected(cur, cmd):
+    """What request_state() leaves the light at, None if it does nothing."""
+    state, brightness = cur
+    on = cmd["state"] == "ON"
+    if state != on:
+        state, brightness = on, DIM_LEVELS if on else 0
+    b = cmd.get("brightness")
+    if b is not None and b != brightness and 1 < b <= DIM_LEVELS:
+        state, brightness = True, b
+    return None if (state, brightness) == cur else (state, brightness)
+
+
+def percentile(values, p):
+    if not values:
+        return 0.0
+    s = sorted(values)
+    return s[min(len(s) - 1, int(round(p / 100.0 * (len(s) - 1))))]
+
+
+class Replay:
+    def __init__(self, args, cmds):
+        self.args = args
+        self.cmds = cmds
+        self.speed = args.speed
+        self.device_id = args.device_id
+        self.pending = {}
+        self.predicted = {}
+        self.reported = {}
+        self.latencies = []
+        self.noops = 0
+        self.stats = {}
+        self.stats_seen = asyncio.Event()
+        self.done_at = None
+
+    def sim_ms(self, wall_s):
+        return wall_s * self.speed * 1000.0
+
+    def on_publish(self, topic, payload):
+        now = time.monotonic()
+        m = DEVICE.match(topic)
+        if m and self.device_id is None:
+            self.device_id = m.group(1)
+        m = STATE.match(topic)
+        if m:
+            ch = int(m.group(2))
+            su = json.loads(payload)
+            got = (su["state"] == "ON", su["brightness"])
+            self.reported[ch] = got
+            self.complete(ch, got, now)
+            return
+        if STATS.match(topic):
+            s = json.loads(payload)
+            self.stats[s.pop("type")] = s
+            self.stats_seen.set()
+
+    def complete(self, ch, got, now):
+        queue = self.pending.get(ch, [])
+        for i, (sent, want) in enumerate(queue):
+            if want == got:
+                # Earlier commands were overtaken by this one
+                for s, _ in queue[:i + 1]:
+                    self.latencies.append(self.sim_ms(now - s))
+                del queue[:i + 1]
+                break
+        if not any(self.pending.values()):
+            self.done_at = now
+
+    async def send_all(self, broker):
+        start = time.monotonic()
+        t0 = self.cmds[0]["t"] if self.cmds else 0
+        for cmd in self.cmds:
+            delay = start + (cmd["t"] - t0) / self.speed - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            ch = cmd["channel"]
+            body = {"state": cmd["state"]}
+            if "brightness" in cmd:
+                body["brightness"] = cmd["brightness"]
+            if "priority" in cmd:
+                body["priority"] = cmd["priority"]
+            want = expected(self.predicted.get(ch, (False, 0)), cmd)
+            sent = time.monotonic()
+            broker.publish(CMND.format(self.device_id, ch), json.dumps(body))
+            if want is None:
+                self.noops += 1
+                continue
+            self.predicted[ch] = want
+            self.pending.setdefault(ch, []).append((sent, want))
+        return start
+
+    async def run(self):
+        broker = Broker(port=self.args.port)
+        broker.on_publish = self.on_publish
+        await broker.start()
+
+        proc = None
+        if self.args.firmware:
+            proc = await asyncio.create_subprocess_exec(
+                self.args.firmware, f"-rt-ratio={self.speed}",
+                stdout=asyncio.subprocess.DEVNULL if not self.args.verbose else None,
+                stderr=asyncio.subprocess.STDOUT if not self.args.verbose else None)
+        try:
+            await asyncio.wait_for(broker.subscribed.wait(), self.args.connect_timeout)
+            # Let the firmware finish subscribing to every channel
+            await asyncio.sleep(0.5)
+            if self.device_id is None:
+                for c in broker.clients:
+                    for topic in c.subs:
+                        m = DEVICE.match(topic)
+                        if m:
+                            self.device_id = m.group(1)
+            if self.device_id is None:
+                sys.exit("could not work out the device id, use --device-id")
+
+            start = await self.send_all(broker)
+            deadline = time.monotonic() + self.args.drain / self.speed
+            while any(self.pending.values()) and time.monotonic() < deadline:
+                await asyncio.sleep(0.01)
+            end = self.done_at or time.monotonic()
+
+            # Wait for a full set of stats covering the whole run
+            self.stats.clear()
+            self.stats_seen.clear()
+            try:
+                await asyncio.wait_for(self.stats_seen.wait(),
+                                       self.args.stats_timeout / self.speed + 5)
+                await asyncio.sleep(0.5)
+            except asyncio.TimeoutError:
+                pass
+        finally:
+            if proc and proc.returncode is None:
+                proc.send_signal(signal.SIGINT)
+                try:
+                    await asyncio.wait_for(proc.wait(), 5)
+                except asyncio.TimeoutError:
+                    proc.kill()
+            await broker.stop()
+        return self.report(self.sim_ms(end - start) / 1000.0)
+
+    def report(self, duration_s):
+        answered = len(self.latencies)
+        lost = sum(len(q) for q in self.pending.values())
+        print(f"commands   {len(self.cmds)} ({self.noops} no-op, {lost} unanswered)"
+              f" over {duration_s:.1f} s simulated at {self.speed}x")
+        if duration_s > 0:
+            print(f"throughput {answered / duration_s:.2f} cmd/s")
+        print("end to end (ms, simulated) "
+              + " ".join(f"p{p}={percentile(self.latencies, p):.1f}"
+                         for p in (50, 95, 99))
+              + f" max={max(self.latencies, default=0):.1f}")
+
+        lat = self.stats.get("latency", {}).get("stages", {})
+        if lat:
+            print(f"{'stage (us)':<12}{'n':>8}{'p50':>10}{'p95':>10}{'p99':>10}")
+            for name, h in lat.items():
+                print(f"{name:<12}{h['n']:>8}{h['p50']:>10}{h['p95']:>10}{h['p99']:>10}")
+            if "queued" in lat and "first_tx" in lat:
+                print(f"queueing   p50={lat['first_tx']['p50'] - lat['queued']['p50']} us"
+                      f" p95={lat['first_tx']['p95'] - lat['queued']['p95']} us")
+        else:
+            print("no latency stats received")
+
+        leaked = []
+        for r, radio in enumerate(self.stats.get("sched", {}).get("radios", [])):
+            print(f"radio {r}    {radio['cmds']} cmds, busy {radio['busy_ms']} ms,"
+                  f" max queue {radio['max_load']}, {radio['rejected']} rejected,"
+                  f" {radio.get('deferred', 0)} deferred, {radio.get('coalesced', 0)} coalesced")
+            if lost == 0 and radio.get("load"):
+                # Every command was answered, nothing should be queued
+                leaked.append(r)
+                print(f"LEAKED     radio {r} still counts {radio['load']} queued")
+
+        for name, c in self.stats.get("sched", {}).get("prio", {}).items():
+            if c["cmds"]:
+                print(f"{name:<12}{c['cmds']} cmds, queued {c['wait_us']} us"
+                      f" p95={c['wait_p95_us']} max={c['wait_max_us']},"
+                      f" {c['preempted']} preempted")
+
+        air = self.stats.get("airtime")
+        if air:
+            print(f"duty cycle {air['used_ms']} of {air['budget_ms']} ms budget"
+                  f" in {air['window_s']} s{', tight' if air['tight'] else ''}")
+
+        power = self.stats.get("power")
+        if power:
+            for name, p in power["policies"].items():
+                if p["cmds"] or p["idle_s"]:
+                    print(f"power      {name}: first bit {p['first_bit_us']} us"
+                          f" (max {p['first_bit_max_us']}) over {p['cmds']} cmds,"
+                          f" idle {p['idle_ua']} uA over {p['idle_s']} s")
+
+        pace = self.stats.get("pacing")
+        if pace:
+            cpu = f"pinned to cpu {pace['radio_cpu']}" if pace["pinned"] else "not pinned"
+            print(f"pacing     {pace['pairs']} dim pairs, {cpu}: interval {pace['interval_us']} us"
+                  f" (max {pace['interval_max_us']}), jitter {pace['jitter_us']} us"
+                  f" p99={pace['jitter_p99_us']} max={pace['jitter_max_us']},"
+                  f" {pace['cpu_changes']} core changes")
+
+        sim = self.stats.get("sim")
+        diverged = []
+        if sim:
+            print(f"airtime    {sim['airtime_ms']} ms in {sim['frames']} frames"
+                  f" ({100.0 * sim['airtime_ms'] / 1000.0 / max(duration_s, 1e-9):.2f}% duty)"
+                  f", {sim['unknown']} unknown")
+            for ch, light in enumerate(sim["lights"]):
+                modelled = (light["state"] == "ON", light["brightness"])
+                reported = self.reported.get(ch, (False, 0))
+                if modelled != reported:
+                    diverged.append(ch)
+                    print(f"DIVERGED   channel {ch}: reported {fmt(reported)}"
+                          f" modelled {fmt(modelled)}")
+        else:
+            print("no sim stats received, is the mock radio enabled?")
+
+        preempted = sum(c["preempted"] for c in
+                        self.stats.get("sched", {}).get("prio", {}).values())
+        if self.args.expect_preempt and not preempted:
+            print("NOT PREEMPTED no dim ramp gave its radio up")
+            return 1
+        return 1 if diverged or lost or leaked else 0
+
+
+def fmt(s):
+    return f"{'ON' if s[0] else 'OFF'}/{s[1]}"
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("trace", help="JSON lines command trace")
+    ap.add_argument("--firmware", help="native_sim zephyr.exe to start,"
+                    " otherwise wait for one to connect")
+    ap.add_argument("--speed", type=float, default=10.0,
+                    help="simulated seconds per wall second (default 10)")
+    ap.add_argument("--port", type=int, default=1883)
+    ap.add_argument("--device-id", help="default is taken from the firmware's subscriptions")
+    ap.add_argument("--drain", type=float, default=30.0,
+                    help="simulated seconds to wait for the last state updates")
+    ap.add_argument("--stats-timeout", type=float, default=120.0,
+                    help="simulated seconds to wait for the stats publish")
+    ap.add_argument("--connect-timeout", type=float, default=30.0)
+    ap.add_argument("--expect-preempt", action="store_true",
+                    help="fail unless a command was preempted, for traces"
+                    " such as preempt.jsonl")
+    ap.add_argument("-v", "--verbose", action="store_true", help="show the firmware console")
+    args = ap.parse_args()
+
+    cmds = load_trace(args.trace)
+    sys.exit(asyncio.run(Replay(args, cmds).run()))
+
+
+if __name__ == "__main__":
+    main()
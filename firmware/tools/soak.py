@@ -0,0 +1,337 @@
+#!/usr/bin/env python3
+"""Soak the native_sim firmware with a command storm and injected faults.
+
+Build with the fault injection fragment, then run:
+
+    west build -b native_sim firmware -- -DEXTRA_CONF_FILE=soak.conf
+    soak.py --firmware build/zephyr/zephyr.exe --commands 1000000 --speed 50
+
+Commands are sent at --rate per simulated second. Besides the valid
+on/off/dim commands the host randomly sends malformed JSON, oversize
+payloads and commands for unknown channels, and drops the connection
+from the broker side. The firmware adds radio frame failures and its
+own connection aborts (soak.conf).
+
+Before the storm it loses the PUBACK of one command, drops the
+connection and checks that the broker's redelivery with DUP set is
+acknowledged without the radio sending anything ("dups" goes up by one,
+the mock radio's "frames" stays put).
+
+Every stats interval the run checks that:
+  - heap in use stays within --heap-slack bytes of the first sample
+  - the MQTT and state threads keep beating (--max-stall-ms)
+  - the command latency p99 stays under --max-latency-ms
+  - the firmware reconnects after every drop (--reconnect-s)
+
+and ends with a summary. Exits non-zero if any check failed.
+"""
+import argparse
+import asyncio
+import json
+import os
+import random
+import re
+import signal
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+from gsbroker import Broker  # noqa: E402
+
+CMND = "getsmart/device/{}/channel/{}/cmnd"
+STATS = re.compile(r"getsmart/device/([^/]+)/stats")
+DEVICE = re.compile(r"getsmart/device/([^/]+)/")
+MALFORMED = [
+    b'{"state":',
+    b'{"state":"ON","brightness":}',
+    b'{"brightness":12}',
+    b'["ON"]',
+    b'{"state":12}',
+    b"\xff\xfe\x00garbage",
+    b"",
+]
+
+
+class Soak:
+    def __init__(self, args):
+        self.args = args
+        self.rng = random.Random(args.seed)
+        self.device_id = args.device_id
+        self.channels = args.channels
+        self.level = {}
+        self.sent = {"valid": 0, "malformed": 0, "oversize": 0, "bad_channel": 0}
+        self.drops = 0
+        self.failures = []
+        self.samples = 0
+        self.heap_base = None
+        self.heap_max = 0
+        self.heap_last = 0
+        self.max_age = {"loop_age_ms": 0, "sub_age_ms": 0}
+        self.p99_max = 0
+        self.stats = {}
+        self.reconnect_max = 0.0
+
+    def fail(self, msg):
+        if msg not in self.failures:
+            print(f"FAIL {msg}", flush=True)
+            self.failures.append(msg)
+
+    def sim_s(self, wall_s):
+        return wall_s * self.args.speed
+
+    def on_publish(self, topic, payload):
+        if self.device_id is None:
+            m = DEVICE.match(topic)
+            if m:
+                self.device_id = m.group(1)
+        if not STATS.match(topic):
+            return
+        s = json.loads(payload)
+        kind = s.pop("type")
+        self.stats[kind] = s
+        if kind == "mem":
+            self.check_heap(s)
+        elif kind == "mqtt":
+            self.check_liveness(s)
+        elif kind == "latency":
+            self.check_latency(s)
+
+    def check_heap(self, s):
+        used = sum(h["used"] for h in s.get("heap", []))
+        self.samples += 1
+        # The first samples include start up, the baseline is taken once running
+        if self.samples == self.args.warmup:
+            self.heap_base = used
+        self.heap_last = used
+        self.heap_max = max(self.heap_max, used)
+        if self.heap_base is not None and used > self.heap_base + self.args.heap_slack:
+            self.fail(f"heap grew from {self.heap_base} to {used} bytes")
+
+    def check_liveness(self, s):
+        for key in self.max_age:
+            self.max_age[key] = max(self.max_age[key], s[key])
+            if s[key] > self.args.max_stall_ms:
+                self.fail(f"{key} {s[key]} ms, thread stalled")
+
+    def check_latency(self, s):
+        sent = s["stages"].get("state_sent")
+        if sent and sent["n"]:
+            p99 = sent["p99"] / 1000.0
+            self.p99_max = max(self.p99_max, p99)
+            if p99 > self.args.max_latency_ms:
+                self.fail(f"state_sent p99 {p99:.1f} ms")
+
+    def next_command(self):
+        r = self.rng.random()
+        ch = self.rng.randrange(self.channels)
+        if r < self.args.p_malformed:
+            self.sent["malformed"] += 1
+            return ch, self.rng.choice(MALFORMED)
+        r -= self.args.p_malformed
+        if r < self.args.p_oversize:
+            self.sent["oversize"] += 1
+            size = self.rng.choice([4256, 4257, 9000, 20000])
+            return ch, b'{"state":"ON","pad":"' + b"x" * size + b'"}'
+        r -= self.args.p_oversize
+        if r < self.args.p_bad_channel:
+            self.sent["bad_channel"] += 1
+            return self.rng.choice([-1, self.channels, 99]), b'{"state":"ON"}'
+
+        self.sent["valid"] += 1
+        level = self.level.get(ch, 0)
+        if level == 0 or self.rng.random() < 0.5:
+            self.level[ch] = 0 if level else 64
+            return ch, json.dumps({"state": "OFF" if level else "ON"}).encode()
+        # Small dims keep the radio time per command bounded
+        level = min(64, max(2, level + self.rng.choice([-1, 1]) * self.rng.randint(1, 8)))
+        self.level[ch] = level
+        return ch, json.dumps({"state": "ON", "brightness": level}).encode()
+
+    async def wait_connected(self, broker):
+        t = time.monotonic()
+        try:
+            await asyncio.wait_for(broker.subscribed.wait(),
+                                   self.args.reconnect_s / self.args.speed + 5)
+        except asyncio.TimeoutError:
+            self.fail("firmware did not reconnect")
+            return False
+        self.reconnect_max = max(self.reconnect_max, self.sim_s(time.monotonic() - t))
+        return True
+
+    async def fresh_stats(self, *kinds, rounds=1):
+        """Wait for the next rounds of the given stats, False on timeout."""
+        deadline = time.monotonic() + 60 / self.args.speed + 5
+        for _ in range(rounds):
+            for kind in kinds:
+                self.stats.pop(kind, None)
+            while not all(kind in self.stats for kind in kinds):
+                if time.monotonic() > deadline:
+                    return False
+                await asyncio.sleep(0.05)
+        return True
+
+    async def check_redelivery(self, broker):
+        """A command whose PUBACK was lost comes back with DUP set after a
+        reconnect and must not reach the radio a second time."""
+        ch = 0
+        on = self.level.get(ch, 0) == 0
+        self.level[ch] = 64 if on else 0
+        broker.lose_acks = 1
+        broker.publish(CMND.format(self.device_id, ch),
+                       json.dumps({"state": "ON" if on else "OFF"}))
+        # Two rounds so the first one can't predate the frames
+        if not await self.fresh_stats("mqtt", "sim", rounds=2):
+            self.fail("no mqtt and sim stats, is the mock radio enabled?")
+            return
+        if broker.lose_acks:
+            self.fail("redelivery command was never acknowledged")
+            return
+        frames, dups = self.stats["sim"]["frames"], self.stats["mqtt"]["dups"]
+
+        redelivered = broker.redelivered
+        for c in list(broker.clients):
+            c.drop()
+        broker.subscribed.clear()
+        if not await self.wait_connected(broker):
+            return
+        if broker.redelivered == redelivered:
+            self.fail("broker did not redeliver, is clean_session still set?")
+            return
+        if not await self.fresh_stats("mqtt", "sim", rounds=2):
+            self.fail("no stats after the redelivery")
+            return
+        sent = self.stats["sim"]["frames"] - frames
+        if self.stats["mqtt"]["dups"] != dups + 1:
+            self.fail(f"dups went from {dups} to {self.stats['mqtt']['dups']}"
+                      " on a redelivery")
+        if sent:
+            self.fail(f"redelivered command sent {sent} frames again")
+        print(f"redelivery DUP acknowledged, {sent} frames sent", flush=True)
+
+    async def drive(self, broker):
+        interval = 1.0 / (self.args.rate * self.args.speed)
+        start = time.monotonic()
+        for n in range(self.args.commands):
+            if self.args.duration and self.sim_s(time.monotonic() - start) > self.args.duration:
+                break
+            if not broker.subscribed.is_set() and not await self.wait_connected(broker):
+                return n
+            if self.rng.random() < self.args.p_drop and broker.clients:
+                self.drops += 1
+                for c in list(broker.clients):
+                    c.drop()
+                broker.subscribed.clear()
+                continue
+            ch, payload = self.next_command()
+            broker.publish(CMND.format(self.device_id, ch), payload)
+            if n % 10000 == 0 and n:
+                print(f"{n} commands, {self.sim_s(time.monotonic() - start):.0f} s", flush=True)
+            delay = start + (n + 1) * interval - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+        return self.args.commands
+
+    async def run(self):
+        broker = Broker(port=self.args.port)
+        broker.on_publish = self.on_publish
+        await broker.start()
+
+        proc = None
+        if self.args.firmware:
+            proc = await asyncio.create_subprocess_exec(
+                self.args.firmware, f"-rt-ratio={self.args.speed}",
+                stdout=None if self.args.verbose else asyncio.subprocess.DEVNULL,
+                stderr=None if self.args.verbose else asyncio.subprocess.STDOUT)
+        start = time.monotonic()
+        try:
+            await asyncio.wait_for(broker.subscribed.wait(), self.args.connect_timeout)
+            await asyncio.sleep(0.5)
+            if self.device_id is None:
+                for c in broker.clients:
+                    for topic in c.subs:
+                        m = DEVICE.match(topic)
+                        if m:
+                            self.device_id = m.group(1)
+            if self.device_id is None:
+                sys.exit("could not work out the device id, use --device-id")
+
+            await self.check_redelivery(broker)
+            sent = await self.drive(broker)
+            # Let it drain and publish a last round of stats
+            await asyncio.sleep(self.args.drain / self.args.speed)
+            if proc and proc.returncode is not None:
+                self.fail(f"firmware exited with {proc.returncode}")
+        finally:
+            if proc and proc.returncode is None:
+                proc.send_signal(signal.SIGINT)
+                try:
+                    await asyncio.wait_for(proc.wait(), 5)
+                except asyncio.TimeoutError:
+                    proc.kill()
+            await broker.stop()
+        return self.report(sent, self.sim_s(time.monotonic() - start), broker)
+
+    def report(self, sent, duration_s, broker):
+        mqtt = self.stats.get("mqtt", {})
+        fault = self.stats.get("fault", {})
+        print()
+        print(f"soak       {sent} commands in {duration_s:.0f} s simulated"
+              f" at {self.args.speed}x")
+        print("sent       " + ", ".join(f"{k} {v}" for k, v in self.sent.items()))
+        print(f"faults     broker drops {self.drops}, "
+              + ", ".join(f"{k} {v['hits']}" for k, v in fault.items()))
+        print(f"mqtt       connects {broker.connects} (firmware {mqtt.get('connects')}),"
+              f" rx {mqtt.get('rx')}, failed {mqtt.get('failed')},"
+              f" oversize {mqtt.get('oversize')}, dups {mqtt.get('dups')},"
+              f" slowest reconnect"
+              f" {self.reconnect_max:.1f} s")
+        base = self.heap_base if self.heap_base is not None else 0
+        print(f"heap       base {base} last {self.heap_last} max {self.heap_max} bytes")
+        print(f"liveness   max loop age {self.max_age['loop_age_ms']} ms,"
+              f" max state age {self.max_age['sub_age_ms']} ms")
+        print(f"latency    max state_sent p99 {self.p99_max:.1f} ms")
+        if self.samples < self.args.warmup:
+            self.fail("not enough stats samples, is GETSMART_STATS_INTERVAL_S short?")
+        print("result     " + ("FAIL: " + "; ".join(self.failures)
+                               if self.failures else "PASS"))
+        return 1 if self.failures else 0
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("--firmware", help="native_sim zephyr.exe to start,"
+                    " otherwise wait for one to connect")
+    ap.add_argument("--commands", type=int, default=1000000)
+    ap.add_argument("--duration", type=float, default=0,
+                    help="stop after this many simulated seconds")
+    ap.add_argument("--rate", type=float, default=1.0,
+                    help="commands per simulated second (default 1)")
+    ap.add_argument("--speed", type=float, default=20.0,
+                    help="simulated seconds per wall second (default 20)")
+    ap.add_argument("--channels", type=int, default=2)
+    ap.add_argument("--p-malformed", type=float, default=0.02)
+    ap.add_argument("--p-oversize", type=float, default=0.005)
+    ap.add_argument("--p-bad-channel", type=float, default=0.01)
+    ap.add_argument("--p-drop", type=float, default=0.001,
+                    help="chance of a broker side disconnect per command")
+    ap.add_argument("--heap-slack", type=int, default=256)
+    ap.add_argument("--max-stall-ms", type=int, default=10000)
+    ap.add_argument("--max-latency-ms", type=float, default=20000)
+    ap.add_argument("--reconnect-s", type=float, default=30,
+                    help="simulated seconds allowed for a reconnect")
+    ap.add_argument("--warmup", type=int, default=3,
+                    help="stats samples before the heap baseline")
+    ap.add_argument("--drain", type=float, default=30.0,
+                    help="simulated seconds to wait after the last command")
+    ap.add_argument("--seed", type=int, default=1)
+    ap.add_argument("--port", type=int, default=1883)
+    ap.add_argument("--device-id")
+    ap.add_argument("--connect-timeout", type=float, default=30.0)
+    ap.add_argument("-v", "--verbose", action="store_true", help="show the firmware console")
+    args = ap.parse_args()
+    sys.exit(asyncio.run(Soak(args).run()))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,108 @@
+#!/usr/bin/env python3
+"""Decode the binary trace ring of the GET Smart controller.
+
+Input is either the text from the 'gs trace raw' shell command, or a
+binary image of the ring (struct trace_ring in src/trace.c) read from
+RAM, e.g. with 'esptool.py dump_mem' after a watchdog reset.
+
+    trace_decode.py capture.txt
+    trace_decode.py --binary ring.bin --entries 256
+"""
+import argparse
+import struct
+import sys
+
+# Must match enum trace_event in src/trace.h
+EVENTS = {
+    1: ("boot", "boots={a0}"),
+    2: ("mqtt_evt", "type={a0} result={a1s}"),
+    3: ("mqtt_rx", "len={a0} msg_id={a1}"),
+    4: ("mqtt_cmd", "channel={a0} {state}"),
+    5: ("cmd_request", "channel={a0} {state}"),
+    6: ("cmd_current", "channel={a0} {state}"),
+    7: ("radio_msg", "channel={hi} op={mid} pulse={lo} code=0x{a1:08x}"),
+    8: ("radio_tx", "code=0x{a0:08x} len={a1}"),
+    9: ("radio_tx_err", "code=0x{a0:08x} err={a1s}"),
+    10: ("state_update", "channel={hi} seq={lo16} {state}"),
+    11: ("state_publish", "channel={hi} seq={lo16} result={a1s}"),
+    12: ("state_overflow", "channel={a0} total={a1}"),
+    13: ("remote_rx", "code=0x{a0:08x} result={a1s}"),
+    14: ("rehome", "channel={hi} plan={lo16} result={a1s}"),
+    15: ("scene", "scene={hi} frames={lo16} result={a1s}"),
+    16: ("mqtt_dup", "msg_id={a0} hash=0x{a1:08x}"),
+}
+
+MAGIC = 0x47535452
+REC = struct.Struct("<IHHII")
+HDR = struct.Struct("<IIII")
+
+
+def signed(v):
+    return v - (1 << 32) if v & 0x80000000 else v
+
+
+def describe(event, a0, a1):
+    name, fmt = EVENTS.get(event, ("event_%d" % event, "a0=0x{a0:08x} a1=0x{a1:08x}"))
+    fields = {
+        "a0": a0,
+        "a1": a1,
+        "a1s": signed(a1),
+        "hi": a0 >> 16,
+        "mid": (a0 >> 8) & 0xFF,
+        "lo": a0 & 0xFF,
+        "lo16": a0 & 0xFFFF,
+        "state": "state=%d brightness=%d" % (a1 >> 16, a1 & 0xFFFF),
+    }
+    return name, fmt.format(**fields)
+
+
+def parse_text(lines):
+    for line in lines:
+        line = line.strip()
+        if not line or line.startswith("#"):
+            continue
+        parts = line.split()
+        if len(parts) != 5:
+            continue
+        try:
+            ts, event, seq, a0, a1 = (int(p, 16) for p in parts)
+        except ValueError:
+            continue
+        yield ts, event, seq, a0, a1
+
+
+def parse_binary(data, entries):
+    magic, head, boots, _ = HDR.unpack_from(data, 0)
+    if magic != MAGIC:
+        sys.exit("not a trace ring (magic 0x%08x)" % magic)
+    count = min(head, entries)
+    for i in range(head - count, head):
+        off = HDR.size + (i % entries) * REC.size
+        yield REC.unpack_from(data, off)
+
+
+def main():
+    ap = argparse.ArgumentParser(description=__doc__,
+                                 formatter_class=argparse.RawDescriptionHelpFormatter)
+    ap.add_argument("input", nargs="?", default="-")
+    ap.add_argument("--binary", action="store_true", help="input is a RAM image of the ring")
+    ap.add_argument("--entries", type=int, default=256, help="CONFIG_GETSMART_TRACE_ENTRIES")
+    args = ap.parse_args()
+
+    if args.binary:
+        with open(args.input, "rb") as f:
+            recs = list(parse_binary(f.read(), args.entries))
+    else:
+        f = sys.stdin if args.input == "-" else open(args.input)
+        recs = list(parse_text(f))
+
+    prev = None
+    for ts, event, seq, a0, a1 in recs:
+        delta = "" if prev is None else "+%d" % ((ts - prev) & 0xFFFFFFFF)
+        prev = ts
+        name, text = describe(event, a0, a1)
+        print("%10d.%06d %10s %5d %-14s %s" % (ts // 1000000, ts % 1000000, delta, seq, name, text))
+
+
+if __name__ == "__main__":
+    main()